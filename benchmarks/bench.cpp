@@ -0,0 +1,221 @@
+// Native benchmark for the lunasvg build that pylunasvg links against.
+//
+// Measures every phase separately over a corpus of SVG files and prints one
+// JSON document, so that runs before and after a lunasvg bump can be
+// compared with benchmarks/compare.py:
+//
+//   pylunasvg_bench [--iterations N] [--sizes 256,1024] file.svg...
+
+#include <lunasvg.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Result
+{
+    std::string file;
+    std::string phase;
+    int size;
+    std::vector<double> samples; // Seconds
+};
+
+uint64_t peak_rss_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+double percentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty())
+    {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    const size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    return samples[index];
+}
+
+// Runs setup() untimed and step() timed, once to warm up and then
+// `iterations` times.
+Result measure(const std::string &file, const std::string &phase, int size, int iterations, const std::function<void()> &setup, const std::function<void()> &step)
+{
+    Result result{file, phase, size, {}};
+    setup();
+    step();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        setup();
+        const auto start = Clock::now();
+        step();
+        result.samples.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return result;
+}
+
+std::string json_string(const std::string &value)
+{
+    std::string result = "\"";
+    for (char ch : value)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            result += '\\';
+        }
+        result += ch;
+    }
+    return result + "\"";
+}
+
+void usage()
+{
+    std::fprintf(stderr, "usage: pylunasvg_bench [--iterations N] [--sizes 256,1024] file.svg...\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int iterations = 50;
+    std::vector<int> sizes = {256, 1024};
+    std::vector<std::string> files;
+    for (int index = 1; index < argc; ++index)
+    {
+        const std::string arg = argv[index];
+        if (arg == "--iterations" && index + 1 < argc)
+        {
+            iterations = std::max(1, std::atoi(argv[++index]));
+        }
+        else if (arg == "--sizes" && index + 1 < argc)
+        {
+            sizes.clear();
+            std::stringstream list(argv[++index]);
+            std::string item;
+            while (std::getline(list, item, ','))
+            {
+                sizes.push_back(std::max(1, std::atoi(item.c_str())));
+            }
+        }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<Result> results;
+    for (const auto &file : files)
+    {
+        std::ifstream stream(file, std::ios::binary);
+        const std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        if (!stream.good() && !stream.eof())
+        {
+            std::fprintf(stderr, "failed to read %s\n", file.c_str());
+            return 1;
+        }
+        const std::string name = file.substr(file.find_last_of("/\\") + 1);
+
+        std::unique_ptr<lunasvg::Document> document;
+        results.push_back(measure(name, "parse", 0, iterations, [] {}, [&]
+                                  { document = lunasvg::Document::loadFromData(data); }));
+        if (!document)
+        {
+            std::fprintf(stderr, "failed to parse %s\n", file.c_str());
+            return 1;
+        }
+        results.push_back(measure(name, "layout", 0, iterations, [&]
+                                  { document = lunasvg::Document::loadFromData(data); }, [&]
+                                  { document->updateLayout(); }));
+
+        for (int size : sizes)
+        {
+            lunasvg::Bitmap bitmap;
+            results.push_back(measure(name, "render", size, iterations, [] {}, [&]
+                                      { bitmap = document->renderToBitmap(size, size); }));
+            const lunasvg::Bitmap rendered = bitmap;
+            lunasvg::Bitmap converted;
+            results.push_back(measure(name, "convert_rgba", size, iterations, [&]
+                                      { converted = lunasvg::Bitmap(rendered.width(), rendered.height());
+                                        std::memcpy(converted.data(), rendered.data(), static_cast<size_t>(rendered.stride()) * rendered.height()); }, [&]
+                                      { converted.convertToRGBA(); }));
+            std::vector<uint8_t> png;
+            results.push_back(measure(name, "png_encode", size, iterations, [&]
+                                      { png.clear(); }, [&]
+                                      { rendered.writeToPng([](void *closure, void *data, int length)
+                                                            {
+                                            auto &output = *static_cast<std::vector<uint8_t> *>(closure);
+                                            output.insert(output.end(), static_cast<uint8_t *>(data), static_cast<uint8_t *>(data) + length); }, &png); }));
+        }
+    }
+
+    std::printf("{\n  \"lunasvg_version\": %s,\n  \"iterations\": %d,\n  \"peak_rss_bytes\": %llu,\n  \"results\": [\n",
+                json_string(lunasvg_version_string()).c_str(), iterations, static_cast<unsigned long long>(peak_rss_bytes()));
+    for (size_t index = 0; index < results.size(); ++index)
+    {
+        const auto &result = results[index];
+        double total = 0.0;
+        for (double sample : result.samples)
+        {
+            total += sample;
+        }
+        std::printf("    {\"file\": %s, \"phase\": %s, \"size\": %d, \"ops_per_sec\": %.3f, \"p50_ms\": %.4f, \"p99_ms\": %.4f}%s\n",
+                    json_string(result.file).c_str(), json_string(result.phase).c_str(), result.size,
+                    total > 0.0 ? result.samples.size() / total : 0.0,
+                    percentile(result.samples, 0.50) * 1e3, percentile(result.samples, 0.99) * 1e3,
+                    index + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+"""Compare two benchmark runs and report the phases that got slower.
+
+Accepts the JSON printed by the pylunasvg_bench executable and the files
+written by ``pytest benchmarks/suite.py --benchmark-json=FILE``:
+
+    python benchmarks/compare.py before.json after.json [--threshold 0.05]
+
+Exits with status 1 when any phase lost more than the threshold.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path, encoding="utf-8") as file:
+        report = json.load(file)
+    results = {}
+    if "results" in report:
+        for result in report["results"]:
+            key = f"{result['file']}:{result['phase']}:{result['size']}"
+            results[key] = (result["ops_per_sec"], result["p50_ms"], result["p99_ms"])
+    else:
+        for benchmark in report["benchmarks"]:
+            stats = benchmark["stats"]
+            extra = benchmark.get("extra_info", {})
+            results[benchmark["name"]] = (stats["ops"], stats["median"] * 1e3, extra.get("p99_ms", float("nan")))
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("before")
+    parser.add_argument("after")
+    parser.add_argument("--threshold", type=float, default=0.05, help="allowed relative loss of ops/sec")
+    args = parser.parse_args()
+
+    before = load(args.before)
+    after = load(args.after)
+    regressions = 0
+    print(f"{'benchmark':<48} {'before ops/s':>12} {'after ops/s':>12} {'change':>8} {'p99 ms':>9}")
+    for key in sorted(before.keys() & after.keys()):
+        old_ops, _, _ = before[key]
+        new_ops, _, new_p99 = after[key]
+        change = new_ops / old_ops - 1.0 if old_ops else 0.0
+        marker = ""
+        if change < -args.threshold:
+            regressions += 1
+            marker = "  <- slower"
+        print(f"{key:<48} {old_ops:>12.1f} {new_ops:>12.1f} {change:>+8.1%} {new_p99:>9.3f}{marker}")
+    for key in sorted(before.keys() ^ after.keys()):
+        print(f"{key:<48} only in {'before' if key in before else 'after'}")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,110 @@
+"""pytest-benchmark suite over the checked-in corpus.
+
+Run it explicitly (it is not part of the test run) and keep the JSON to
+compare releases with benchmarks/compare.py or pytest-benchmark compare:
+
+    pytest benchmarks/suite.py --benchmark-json=after.json
+"""
+
+import os
+import statistics
+import sys
+from concurrent.futures import ThreadPoolExecutor
+from pathlib import Path
+
+import pytest
+
+pytest.importorskip("pytest_benchmark")
+
+import pylunasvg  # noqa: E402
+
+ROOT = Path(__file__).resolve().parent
+CORPUS = {
+    "tiger": ROOT.parent / "examples" / "tiger.svg",
+    "qrcode": ROOT / "corpus" / "qrcode.svg",
+    "text": ROOT / "corpus" / "text.svg",
+    "gradients": ROOT / "corpus" / "gradients.svg",
+}
+SIZES = [64, 256, 1024]
+
+
+def peak_rss_bytes():
+    try:
+        import resource
+    except ImportError:
+        return None
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return peak if sys.platform == "darwin" else peak * 1024
+
+
+def summarize(benchmark):
+    samples = sorted(benchmark.stats.stats.data)
+    if samples:
+        benchmark.extra_info["p50_ms"] = statistics.median(samples) * 1e3
+        benchmark.extra_info["p99_ms"] = samples[min(len(samples) - 1, int(0.99 * len(samples)))] * 1e3
+    benchmark.extra_info["peak_rss_bytes"] = peak_rss_bytes()
+
+
+@pytest.fixture
+def record(benchmark):
+    """Run the benchmark, then attach p50/p99 latency and peak RSS."""
+
+    def run(*args, **kwargs):
+        result = benchmark(*args, **kwargs)
+        summarize(benchmark)
+        return result
+
+    return run
+
+
+@pytest.fixture(params=sorted(CORPUS))
+def source(request):
+    return CORPUS[request.param].read_bytes()
+
+
+def test_parse(record, source):
+    record(pylunasvg.Document.load_from_data, source)
+
+
+def test_layout(benchmark, source):
+    # Every round lays out a freshly parsed document; parsing is not timed.
+    def setup():
+        return (pylunasvg.Document.load_from_data(source),), {}
+
+    benchmark.pedantic(lambda document: document.update_layout(), setup=setup, rounds=50, warmup_rounds=1)
+    summarize(benchmark)
+
+
+@pytest.mark.parametrize("size", SIZES)
+def test_render(record, source, size):
+    document = pylunasvg.Document.load_from_data(source)
+    document.update_layout()
+    record(document.render_to_bitmap, size, size)
+
+
+@pytest.mark.parametrize("size", SIZES)
+def test_convert_rgba(record, source, size):
+    bitmap = pylunasvg.Document.load_from_data(source).render_to_bitmap(size, size)
+    out = bytearray(size * size * 4)
+    record(bitmap.convert, pylunasvg.PixelFormat.RGBA, out)
+
+
+@pytest.mark.parametrize("size", SIZES)
+@pytest.mark.parametrize("level", [1, 6])
+def test_png_encode(record, source, size, level):
+    bitmap = pylunasvg.Document.load_from_data(source).render_to_bitmap(size, size)
+    record(bitmap.write_to_png_data, level)
+
+
+@pytest.mark.parametrize("threads", sorted({1, min(os.cpu_count() or 1, 8)}))
+def test_threaded_render(record, threads):
+    # Compare the two rows to see how rendering scales with cores; the GIL is
+    # released while parsing, rendering and encoding.
+    data = CORPUS["tiger"].read_bytes()
+    jobs = [data] * 16
+
+    def render(source):
+        return pylunasvg.Document.load_from_data(source).render_to_bitmap(256, 256).write_to_png_data()
+
+    with ThreadPoolExecutor(max_workers=threads) as executor:
+        record(lambda: list(executor.map(render, jobs)))
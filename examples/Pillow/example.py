@@ -1,4 +1,4 @@
-import SvgImagePlugin  # noqa: F401
+import pylunasvg_pillow  # noqa: F401
 from PIL import Image
 
 
@@ -132,6 +132,10 @@ class CMakeBuild(build_ext):
         else:
             self.warn(f'Type stub file {pyi_file} not found')
 
+        plugin_file = Path('src') / 'pylunasvg_pillow.py'
+        shutil.copy(plugin_file, extdir / 'pylunasvg_pillow.py')
+        self.announce(f'Copied {plugin_file} to {extdir / "pylunasvg_pillow.py"}')
+
 
 setup(
     name="pylunasvg",
@@ -143,7 +147,7 @@ setup(
     ext_modules=[CMakeExtension("pylunasvg")],
     cmdclass={"build_ext": CMakeBuild},
     zip_safe=False,
-    extras_require={"test": ["pytest>=6.0"]},
+    extras_require={"test": ["pytest>=6.0"], "pillow": ["Pillow>=10.1"]},
     python_requires=">=3.9",
     package_data={"": ["*.pyi"]},
 )
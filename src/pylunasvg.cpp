@@ -1,611 +1,7375 @@
 #include <lunasvg.h>
 #include <pybind11/pybind11.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PYLUNASVG_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PYLUNASVG_TARGET_AVX2
+#else
+#define PYLUNASVG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PYLUNASVG_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace py = pybind11;
 
-struct PyBitmap
+// lunasvg keeps registered font faces in a process-wide cache that is not
+// synchronized. Registration takes this lock exclusively; parsing, layout and
+// rendering take it shared so text layout never sees a half-inserted face.
+static std::shared_mutex &font_registry_mutex()
 {
-private:
-    std::shared_ptr<lunasvg::Bitmap> bitmap;
+    static std::shared_mutex mutex;
+    return mutex;
+}
+
+// Acquires a document mutex while holding the GIL. The GIL is only dropped
+// while waiting, so uncontended calls stay cheap and a thread blocked on a
+// busy document does not stall the rest of the interpreter.
+static std::unique_lock<std::mutex> lock_document(std::mutex &mutex)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        py::gil_scoped_release release;
+        lock.lock();
+    }
+    return lock;
+}
+
+// Whether the interpreter is shutting down. Worker threads are detached and
+// may still be running then; they must not take the GIL, since
+// PyGILState_Ensure() hangs or ends the thread during finalization. They
+// drop their Python references without it instead, leaking the objects.
+static bool python_finalizing()
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    return Py_IsFinalizing();
+#else
+    return _Py_IsFinalizing();
+#endif
+}
+
+// Phases timed by the opt-in statistics of pylunasvg.enable_stats().
+enum class StatsPhase
+{
+    Parse,
+    StyleSheet,
+    Layout,
+    Rasterize,
+    Convert,
+    PngEncode,
+    Count
+};
 
+// Process-wide counters behind pylunasvg.get_stats(). Every update is a
+// relaxed atomic add, so threads never wait on each other; while disabled,
+// timers skip the clock entirely. Live object counts are always kept.
+class Stats
+{
 public:
-    PyBitmap(const std::shared_ptr<lunasvg::Bitmap> &bmp) : bitmap(bmp) {}
-    PyBitmap(int width, int height)
-        : bitmap(std::make_shared<lunasvg::Bitmap>(width, height))
+    static Stats &instance()
     {
-        if (bitmap->isNull())
-        {
-            throw std::runtime_error("Failed to create bitmap: out of memory");
-        }
+        // Intentionally leaked: objects counted here may outlive static
+        // destruction at exit.
+        static Stats *stats = new Stats();
+        return *stats;
     }
 
-    static PyBitmap create_for_data(py::buffer data, int width, int height, int stride)
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+    void set_enabled(bool enabled) { on.store(enabled, std::memory_order_relaxed); }
+
+    void add_time(StatsPhase phase, uint64_t nanoseconds)
+    {
+        auto &counter = phases[static_cast<size_t>(phase)];
+        counter.calls.fetch_add(1, std::memory_order_relaxed);
+        counter.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    void add_bitmap(const lunasvg::Bitmap &bitmap)
     {
-        py::buffer_info info = data.request(true);
-        if (height * stride > info.size)
+        if (enabled() && !bitmap.isNull())
         {
-            throw std::runtime_error("Buffer is not long enough");
+            bitmaps_allocated.fetch_add(1, std::memory_order_relaxed);
+            bitmap_bytes.fetch_add(static_cast<uint64_t>(bitmap.stride()) * bitmap.height(), std::memory_order_relaxed);
         }
+    }
 
-        auto bitmap = std::make_shared<lunasvg::Bitmap>(
-            static_cast<uint8_t *>(info.ptr), width, height, stride);
-        if (bitmap->isNull())
+    void reset()
+    {
+        for (auto &counter : phases)
         {
-            throw std::runtime_error("Failed to create bitmap from data");
+            counter.calls.store(0, std::memory_order_relaxed);
+            counter.nanoseconds.store(0, std::memory_order_relaxed);
         }
-
-        return PyBitmap(bitmap);
+        bitmaps_allocated.store(0, std::memory_order_relaxed);
+        bitmap_bytes.store(0, std::memory_order_relaxed);
     }
 
-    std::shared_ptr<lunasvg::Bitmap> get_bitmap() const { return bitmap; }
-
-    py::object __repr__(void)
+    struct PhaseCounter
     {
-        return py::str("<Bitmap width=" + std::to_string(bitmap->width()) + " height=" + std::to_string(bitmap->height()) + ">");
-    }
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> nanoseconds{0};
+    };
 
-    py::object get_data(void) const
+    std::array<PhaseCounter, static_cast<size_t>(StatsPhase::Count)> phases;
+    std::atomic<uint64_t> bitmaps_allocated{0};
+    std::atomic<uint64_t> bitmap_bytes{0};
+    std::atomic<int64_t> live_documents{0};
+    std::atomic<int64_t> live_bitmaps{0};
+
+private:
+    std::atomic<bool> on{false};
+};
+
+// Adds the lifetime of a scope to a phase while statistics are enabled.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(StatsPhase phase) : phase(phase), active(Stats::instance().enabled())
     {
-        if (!bitmap)
+        if (active)
         {
-            throw std::runtime_error("Bitmap is null.");
+            start = std::chrono::steady_clock::now();
         }
-        return py::bytes(reinterpret_cast<const char *>(bitmap->data()), bitmap->width() * bitmap->height() * 4);
     }
 
-    py::int_ get_width(void) const
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+    ~PhaseTimer()
     {
-        return bitmap->width();
+        if (active)
+        {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            Stats::instance().add_time(phase, static_cast<uint64_t>(elapsed.count()));
+        }
     }
 
-    py::int_ get_height(void) const
+private:
+    StatsPhase phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Member that counts the live instances of the object holding it.
+class LiveCounter
+{
+public:
+    explicit LiveCounter(std::atomic<int64_t> &count) : count(&count) { count.fetch_add(1, std::memory_order_relaxed); }
+    LiveCounter(const LiveCounter &other) : count(other.count) { count->fetch_add(1, std::memory_order_relaxed); }
+    LiveCounter &operator=(const LiveCounter &) { return *this; }
+    ~LiveCounter() { count->fetch_sub(1, std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> *count;
+};
+
+// Process-wide pool of native worker threads used by the batch APIs. Work is
+// handed out through a shared atomic cursor: idle threads keep claiming the
+// next unprocessed item, which balances uneven inputs the way work stealing
+// would without per-thread queues. The calling thread always takes part, so
+// a batch completes even when every worker is busy (or, after fork(), gone).
+class WorkerPool
+{
+public:
+    static WorkerPool &instance()
     {
-        return bitmap->height();
+        // Intentionally leaked: detached workers may still be parked on the
+        // condition variable while static destructors run at exit.
+        static WorkerPool *pool = new WorkerPool();
+        return *pool;
     }
 
-    py::int_ get_stride() const
+    static size_t concurrency()
     {
-        return bitmap->stride();
+        return std::max(1u, std::thread::hardware_concurrency());
     }
 
-    py::object convert_to_rgba(void) const
+    void submit(std::function<void()> task)
     {
-        if (!bitmap)
         {
-            throw std::runtime_error("Bitmap is null.");
+            std::lock_guard<std::mutex> lock(mutex);
+            while (workers < concurrency())
+            {
+                std::thread(&WorkerPool::worker_loop, this).detach();
+                ++workers;
+            }
+            tasks.push_back(std::move(task));
         }
-        bitmap->convertToRGBA();
-        return py::none();
+        wakeup.notify_one();
     }
 
-    py::object write_to_png(const py::object &pyfilename) const
+    // Calls fn(index) for every index in [0, count) on up to `threads`
+    // threads (0 selects one per core) and rethrows the first exception.
+    template <typename Fn>
+    void parallel_for(size_t count, size_t threads, Fn &&fn)
     {
-        if (pyfilename.is_none())
+        if (threads == 0)
         {
-            throw std::invalid_argument("Filename cannot be None.");
+            threads = concurrency();
         }
-        std::string filename = py::str(pyfilename).cast<std::string>();
-        if (!bitmap->writeToPng(filename))
+        threads = std::min(threads, count);
+        if (threads <= 1)
         {
-            throw std::runtime_error("Failed to write PNG file: " + filename);
+            for (size_t index = 0; index < count; ++index)
+            {
+                fn(index);
+            }
+            return;
         }
-        return py::none();
-    }
 
-    py::object write_to_png_data(void) const
-    {
-        std::vector<uint8_t> png_data;
-        png_data.reserve(bitmap->width() * bitmap->height() * 4);
-
-        auto callback = [](void *closure, void *data, int size)
+        struct Batch
+        {
+            std::atomic<size_t> next{0};
+            std::mutex mutex;
+            std::condition_variable done;
+            size_t active = 0;
+            bool closed = false;
+            std::exception_ptr error;
+        };
+        auto batch = std::make_shared<Batch>();
+        auto run = [batch, count, &fn]()
         {
-            auto *output_vector = static_cast<std::vector<uint8_t> *>(closure);
-            const auto *bytes = static_cast<const uint8_t *>(data);
-            output_vector->assign(bytes, bytes + size);
+            size_t index;
+            while ((index = batch->next.fetch_add(1)) < count)
+            {
+                try
+                {
+                    fn(index);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (!batch->error)
+                    {
+                        batch->error = std::current_exception();
+                    }
+                    batch->next = count;
+                }
+            }
         };
 
-        if (!bitmap->writeToPng(callback, &png_data))
+        for (size_t helper = 1; helper < threads; ++helper)
         {
-            throw std::runtime_error("Failed to encode bitmap as PNG data.");
+            submit([batch, run]()
+                   {
+                       {
+                           std::lock_guard<std::mutex> lock(batch->mutex);
+                           if (batch->closed)
+                           {
+                               return;
+                           }
+                           ++batch->active;
+                       }
+                       run();
+                       std::lock_guard<std::mutex> lock(batch->mutex);
+                       if (--batch->active == 0)
+                       {
+                           batch->done.notify_all();
+                       }
+                   });
         }
+        run();
 
-        return py::bytes(reinterpret_cast<const char *>(png_data.data()), png_data.size());
+        // Helpers that have not started yet must not touch `fn` once we
+        // return, so close the batch before waiting for the running ones.
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->closed = true;
+        batch->done.wait(lock, [&batch]
+                         { return batch->active == 0; });
+        if (batch->error)
+        {
+            std::rethrow_exception(batch->error);
+        }
     }
 
-    py::object clear(uint32_t color = 0)
+private:
+    WorkerPool()
     {
-        bitmap->clear(color);
-        return py::none();
+#ifndef _WIN32
+        pthread_atfork([]
+                       { instance().mutex.lock(); },
+                       []
+                       { instance().mutex.unlock(); },
+                       []
+                       {
+                           // Only the forking thread survives in the child.
+                           auto &pool = instance();
+                           pool.workers = 0;
+                           pool.tasks.clear();
+                           pool.mutex.unlock();
+                       });
+#endif
     }
-};
 
-struct PyMatrix
-{
-private:
-    std::shared_ptr<lunasvg::Matrix> matrix;
+    void worker_loop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this]
+                            { return !tasks.empty(); });
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
 
-public:
-    PyMatrix() : matrix(std::make_shared<lunasvg::Matrix>()) {}
-    PyMatrix(float a, float b, float c, float d, float e, float f)
-        : matrix(std::make_shared<lunasvg::Matrix>(a, b, c, d, e, f)) {}
-    PyMatrix(const std::shared_ptr<lunasvg::Matrix> &m) : matrix(m) {}
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<std::function<void()>> tasks;
+    size_t workers = 0;
+};
 
-    py::object __repr__(void)
+// Renders a whole document the way Document.render_to_bitmap does, where a
+// zero width or height selects the document's intrinsic size.
+static lunasvg::Bitmap render_document_to_bitmap(const lunasvg::Document &document, int width, int height, uint32_t background_color)
+{
+    if (width == 0)
     {
-        return py::str("<Matrix [" + std::to_string(matrix->a) + " " + std::to_string(matrix->b) + " " + std::to_string(matrix->c) + " " + std::to_string(matrix->d) + " " + std::to_string(matrix->e) + " " + std::to_string(matrix->f) + "]>");
+        width = static_cast<int>(document.width());
     }
-
-    PyMatrix multiply(const PyMatrix &other)
+    if (height == 0)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->multiply(*other.matrix);
-        return PyMatrix(result);
+        height = static_cast<int>(document.height());
     }
+    PhaseTimer timer(StatsPhase::Rasterize);
+    auto bitmap = document.renderToBitmap(width, height, background_color);
+    Stats::instance().add_bitmap(bitmap);
+    return bitmap;
+}
 
-    PyMatrix translate(float tx, float ty)
+// Opens a file named by a UTF-8 path.
+static std::FILE *open_file(const std::string &filename, const char *mode)
+{
+#ifdef _WIN32
+    int length = MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, nullptr, 0);
+    if (length <= 0)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->translate(tx, ty);
-        return PyMatrix(result);
+        return nullptr;
     }
+    std::wstring wide_filename(static_cast<size_t>(length), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, &wide_filename[0], length);
+    std::wstring wide_mode(mode, mode + std::strlen(mode));
+    return _wfopen(wide_filename.c_str(), wide_mode.c_str());
+#else
+    return std::fopen(filename.c_str(), mode);
+#endif
+}
 
-    PyMatrix scale(float sx, float sy)
+#ifdef _WIN32
+// Converts a UTF-8 path for the wide Windows API; empty when it is invalid.
+static std::wstring widen_path(const std::string &path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    if (length <= 0)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->scale(sx, sy);
-        return PyMatrix(result);
+        return std::wstring();
     }
+    std::wstring wide(static_cast<size_t>(length), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide[0], length);
+    return wide;
+}
+#endif
 
-    PyMatrix rotate(float angle, float cx = 0.0f, float cy = 0.0f)
+// Renames `source` over `target` in one step, so that readers of `target`
+// see either the old file or the new one.
+static bool replace_file(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+    return MoveFileExW(widen_path(source).c_str(), widen_path(target).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(source.c_str(), target.c_str()) == 0;
+#endif
+}
+
+static void remove_file(const std::string &filename)
+{
+#ifdef _WIN32
+    DeleteFileW(widen_path(filename).c_str());
+#else
+    std::remove(filename.c_str());
+#endif
+}
+
+static bool read_file(const std::string &filename, std::string &data)
+{
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(open_file(filename, "rb"), std::fclose);
+    if (!file)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->rotate(angle, cx, cy);
-        return PyMatrix(result);
+        return false;
     }
-
-    PyMatrix shear(float shx, float shy)
+    char buffer[65536];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file.get())) > 0)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->shear(shx, shy);
-        return PyMatrix(result);
+        data.append(buffer, count);
     }
+    return !std::ferror(file.get());
+}
 
-    PyMatrix invert()
+// Resolves an output size the way lunasvg::Document::renderToBitmap does
+// (a negative dimension follows the aspect ratio of the other one, and zero
+// selects the intrinsic size as in Document.render_to_bitmap) and computes
+// the matrix that maps the document onto it.
+static bool resolve_render_size(const lunasvg::Document &document, int &width, int &height, lunasvg::Matrix &matrix)
+{
+    const float intrinsic_width = document.width();
+    const float intrinsic_height = document.height();
+    if (intrinsic_width <= 0.f || intrinsic_height <= 0.f)
     {
-        auto result = std::make_shared<lunasvg::Matrix>(*matrix);
-        result->invert();
-        return PyMatrix(result);
+        return false;
     }
-
-    PyMatrix inverse() const
+    if (width == 0)
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(matrix->inverse()));
+        width = static_cast<int>(intrinsic_width);
     }
-
-    void reset()
+    if (height == 0)
     {
-        matrix->reset();
+        height = static_cast<int>(intrinsic_height);
     }
-
-    static PyMatrix translated(float tx, float ty)
+    if (width < 0 && height < 0)
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(lunasvg::Matrix::translated(tx, ty)));
+        width = static_cast<int>(std::ceil(intrinsic_width));
+        height = static_cast<int>(std::ceil(intrinsic_height));
     }
-
-    static PyMatrix scaled(float sx, float sy)
+    else if (height < 0)
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(lunasvg::Matrix::scaled(sx, sy)));
+        height = static_cast<int>(std::ceil(width * intrinsic_height / intrinsic_width));
     }
-
-    static PyMatrix rotated(float angle, float cx = 0.0f, float cy = 0.0f)
+    else if (width < 0)
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(lunasvg::Matrix::rotated(angle, cx, cy)));
+        width = static_cast<int>(std::ceil(height * intrinsic_width / intrinsic_height));
     }
+    matrix = lunasvg::Matrix(width / intrinsic_width, 0, 0, height / intrinsic_height, 0, 0);
+    return width > 0 && height > 0;
+}
 
-    static PyMatrix sheared(float shx, float shy)
+// Resolves an element's output size the way lunasvg::Element::renderToBitmap
+// does and computes the matrix that maps its bounding box onto it.
+static bool resolve_element_render_size(const lunasvg::Element &element, int &width, int &height, lunasvg::Matrix &matrix)
+{
+    const lunasvg::Box box = element.getLocalBoundingBox();
+    if (box.w <= 0.f || box.h <= 0.f)
+    {
+        return false;
+    }
+    if (width <= 0 && height <= 0)
+    {
+        width = static_cast<int>(std::ceil(box.w));
+        height = static_cast<int>(std::ceil(box.h));
+    }
+    else if (height <= 0)
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(lunasvg::Matrix::sheared(shx, shy)));
+        height = static_cast<int>(std::ceil(width * box.h / box.w));
     }
+    else if (width <= 0)
+    {
+        width = static_cast<int>(std::ceil(height * box.w / box.h));
+    }
+    const float scale_x = width / box.w;
+    const float scale_y = height / box.h;
+    matrix = lunasvg::Matrix(scale_x, 0, 0, scale_y, -box.x * scale_x, -box.y * scale_y);
+    return width > 0 && height > 0;
+}
+
+// Resource limits for untrusted input, checked while loading and rendering.
+// Zero disables a limit, and the checks behind disabled limits are skipped
+// entirely.
+struct PyLimits
+{
+    size_t max_input_bytes = 0;
+    size_t max_elements = 0;
+    size_t max_depth = 0;
+    size_t max_use_expansion = 0; // Element instances added by <use>
+    uint64_t max_pixels = 0;
+    double max_render_time = 0.0; // Seconds
+};
+
+// Raised when untrusted input exceeds one of its PyLimits.
+class LimitExceeded : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
 
-    float get_a() const { return matrix->a; }
-    float get_b() const { return matrix->b; }
-    float get_c() const { return matrix->c; }
-    float get_d() const { return matrix->d; }
-    float get_e() const { return matrix->e; }
-    float get_f() const { return matrix->f; }
+// Applies the output limits of a PyLimits to one call, which may rasterize
+// several bitmaps. check_size() rejects an output before it is allocated and
+// check() throws once the call has rendered for longer than max_render_time.
+// Iterators carry their budget from batch to batch through `spent`.
+class RenderBudget
+{
+public:
+    explicit RenderBudget(const PyLimits &limits, double spent = 0.0)
+        : max_pixels(limits.max_pixels), max_render_time(limits.max_render_time), spent(spent), start(std::chrono::steady_clock::now()) {}
 
-    void set_a(float value) { matrix->a = value; }
-    void set_b(float value) { matrix->b = value; }
-    void set_c(float value) { matrix->c = value; }
-    void set_d(float value) { matrix->d = value; }
-    void set_e(float value) { matrix->e = value; }
-    void set_f(float value) { matrix->f = value; }
+    bool timed() const { return max_render_time > 0.0; }
 
-    std::shared_ptr<lunasvg::Matrix> get_matrix() const { return matrix; }
+    void check_size(int width, int height) const
+    {
+        if (max_pixels && static_cast<uint64_t>(std::max(width, 0)) * static_cast<uint64_t>(std::max(height, 0)) > max_pixels)
+        {
+            throw LimitExceeded("Output pixel limit exceeded.");
+        }
+    }
 
-    PyMatrix operator*(const PyMatrix &other) const
+    void check() const
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(*matrix * *other.matrix));
+        if (timed() && elapsed() >= max_render_time)
+        {
+            throw LimitExceeded("Render time limit exceeded.");
+        }
     }
 
-    PyMatrix &operator*=(const PyMatrix &other)
+    // Seconds rendered so far, including the time spent before this call.
+    double elapsed() const
     {
-        *matrix *= *other.matrix;
-        return *this;
+        return spent + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 
-    PyMatrix operator~() const
+private:
+    uint64_t max_pixels;
+    double max_render_time;
+    double spent;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Renders a laid-out document or element into `bitmap` one band of rows at a
+// time, calling check() before each band so that a long render can be
+// stopped by throwing from it.
+template <typename Target, typename Check>
+static void render_in_bands(const Target &target, lunasvg::Bitmap &bitmap, const lunasvg::Matrix &matrix, Check check)
+{
+    constexpr int MinBandHeight = 128;
+    constexpr int MaxBands = 16;
+    const int height = bitmap.height();
+    const int band_height = std::max(MinBandHeight, (height + MaxBands - 1) / MaxBands);
+    for (int y = 0; y < height; y += band_height)
     {
-        return inverse();
+        check();
+        lunasvg::Bitmap band(bitmap.data() + static_cast<size_t>(y) * bitmap.stride(), bitmap.width(), std::min(band_height, height - y), bitmap.stride());
+        PhaseTimer timer(StatsPhase::Rasterize);
+        target.render(band, lunasvg::Matrix(matrix.a, matrix.b, matrix.c, matrix.d, matrix.e, matrix.f - y));
     }
+}
 
-    py::ssize_t __len__() const
+// Renders into `bitmap` within `budget`: in bands when it has a time limit,
+// in a single pass otherwise.
+template <typename Target>
+static void render_with_budget(const Target &target, lunasvg::Bitmap &bitmap, const lunasvg::Matrix &matrix, const RenderBudget &budget)
+{
+    if (budget.timed())
     {
-        return 6;
+        render_in_bands(target, bitmap, matrix, [&budget]
+                        { budget.check(); });
+        return;
     }
+    PhaseTimer timer(StatsPhase::Rasterize);
+    target.render(bitmap, matrix);
+}
 
-    py::float_ __getitem__(py::ssize_t index) const
+// Renders a laid-out document or element at a size resolved by
+// resolve_render_size() or resolve_element_render_size(), within `budget`.
+template <typename Target>
+static lunasvg::Bitmap render_resolved(const Target &target, int width, int height, const lunasvg::Matrix &matrix, uint32_t background_color, const RenderBudget &budget)
+{
+    budget.check_size(width, height);
+    lunasvg::Bitmap bitmap(width, height);
+    if (bitmap.isNull())
     {
-        switch (index)
+        return bitmap;
+    }
+    Stats::instance().add_bitmap(bitmap);
+    bitmap.clear(background_color);
+    render_with_budget(target, bitmap, matrix, budget);
+    return bitmap;
+}
+
+// Returns a bitmap viewing the width x height pixels of `owner` that start
+// at (x, y). The view keeps `owner` alive.
+static std::shared_ptr<lunasvg::Bitmap> make_bitmap_view(const std::shared_ptr<lunasvg::Bitmap> &owner, int x, int y, int width, int height)
+{
+    uint8_t *data = owner->data() + static_cast<size_t>(y) * owner->stride() + static_cast<size_t>(x) * 4;
+    return std::shared_ptr<lunasvg::Bitmap>(new lunasvg::Bitmap(data, width, height, owner->stride()), [owner](lunasvg::Bitmap *view)
+                                            { delete view; });
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+    static const auto table = []
+    {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t n = 0; n < 256; ++n)
         {
-        case 0:
-            return matrix->a;
-        case 1:
-            return matrix->b;
-        case 2:
-            return matrix->c;
-        case 3:
-            return matrix->d;
-        case 4:
-            return matrix->e;
-        case 5:
-            return matrix->f;
-        default:
-            throw py::index_error("Matrix index out of range");
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
         }
+        return entries;
+    }();
+    crc = ~crc;
+    while (size--)
+    {
+        crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
     }
+    return ~crc;
+}
+
+// Row filter applied by the PNG encoder. AUTO picks NONE for level 0, UP
+// for level 1 and ADAPTIVE (the per-row heuristic stb and libpng use)
+// above that.
+enum class PngFilter
+{
+    AUTO,
+    NONE,
+    SUB,
+    UP,
+    AVERAGE,
+    PAETH,
+    ADAPTIVE,
 };
 
-struct PyBox
+struct PngOptions
 {
-private:
-    std::shared_ptr<lunasvg::Box> box;
+    int level = 6; // 0 stores, 1 is the fast mode, 9 compresses hardest
+    PngFilter filter = PngFilter::AUTO;
+};
 
+// PNG encoder for images produced a band of rows at a time. Each row is
+// filtered and fed to a fixed-Huffman deflate with hash-chain matching (the
+// scheme of the stb encoder lunasvg uses); compressed data is emitted as
+// IDAT chunks as it is produced, so the encoder only ever holds the 32 KiB
+// deflate window, a chunk of input and two rows.
+class PngStreamEncoder
+{
 public:
-    PyBox() : box(std::make_shared<lunasvg::Box>()) {}
-    PyBox(float x, float y, float w, float h) : box(std::make_shared<lunasvg::Box>(x, y, w, h)) {}
-    PyBox(const std::shared_ptr<lunasvg::Box> &b) : box(b) {}
+    using Sink = std::function<bool(const uint8_t *data, size_t size)>;
 
-    py::object __repr__(void)
+    PngStreamEncoder(Sink sink, int width, int height, const PngOptions &options = PngOptions())
+        : sink(std::move(sink)), width(width), height(height),
+          level(std::max(0, std::min(9, options.level))),
+          previous_row(static_cast<size_t>(width) * 4, 0),
+          candidate_row(static_cast<size_t>(width) * 4 + 1),
+          best_row(static_cast<size_t>(width) * 4 + 1)
     {
-        return py::str("<Box [x=" + std::to_string(box->x) + ", y=" + std::to_string(box->y) + ", width=" + std::to_string(box->w) + ", height=" + std::to_string(box->h) + "]>");
+        filter = options.filter;
+        if (filter == PngFilter::AUTO)
+        {
+            filter = level == 0 ? PngFilter::NONE : level == 1 ? PngFilter::UP : PngFilter::ADAPTIVE;
+        }
+        static const int chain_lengths[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+        max_chain = chain_lengths[level];
+        if (level > 0)
+        {
+            head.assign(HashSize, -1);
+            chain.assign(WindowSize, -1);
+        }
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        write(signature, sizeof(signature));
+        uint8_t header[13];
+        store_be32(header, static_cast<uint32_t>(width));
+        store_be32(header + 4, static_cast<uint32_t>(height));
+        header[8] = 8;  // bit depth
+        header[9] = 6;  // RGBA
+        header[10] = 0; // deflate
+        header[11] = 0; // adaptive filtering
+        header[12] = 0; // no interlace
+        write_chunk("IHDR", header, sizeof(header));
+        output.push_back(0x78);
+        output.push_back(level == 0 ? 0x01 : level == 1 ? 0x5E : level < 7 ? 0x9C : 0xDA);
     }
 
-    PyBox transform(const PyMatrix &matrix)
+    // Appends one row of straight-alpha RGBA pixels.
+    bool write_row(const uint8_t *row)
     {
-        auto result = std::make_shared<lunasvg::Box>(*box);
-        result->transform(*matrix.get_matrix());
-        return PyBox(result);
+        const size_t size = static_cast<size_t>(width) * 4;
+        if (filter == PngFilter::ADAPTIVE)
+        {
+            size_t best_cost = std::numeric_limits<size_t>::max();
+            for (int type = 0; type < 5; ++type)
+            {
+                const size_t cost = filter_row(type, row, candidate_row.data());
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_row.swap(candidate_row);
+                }
+            }
+        }
+        else
+        {
+            filter_row(static_cast<int>(filter) - static_cast<int>(PngFilter::NONE), row, best_row.data());
+        }
+        std::copy_n(row, size, previous_row.begin());
+        deflate(best_row.data(), best_row.size());
+        return ok;
     }
 
-    PyBox transformed(const PyMatrix &matrix) const
+    // Flushes the compressed stream and writes the trailing chunks.
+    bool finish()
     {
-        return PyBox(std::make_shared<lunasvg::Box>(box->transformed(*matrix.get_matrix())));
+        compress_pending(true);
+        if (bit_count > 0)
+        {
+            output.push_back(static_cast<uint8_t>(bit_buffer));
+            bit_buffer = 0;
+            bit_count = 0;
+        }
+        uint8_t checksum[4];
+        store_be32(checksum, (adler_b << 16) | adler_a);
+        output.insert(output.end(), checksum, checksum + 4);
+        flush_output();
+        write_chunk("IEND", nullptr, 0);
+        return ok;
     }
 
-    float get_x() const { return box->x; }
-    float get_y() const { return box->y; }
-    float get_w() const { return box->w; }
-    float get_h() const { return box->h; }
-
-    void set_x(float value) { box->x = value; }
-    void set_y(float value) { box->y = value; }
-    void set_w(float value) { box->w = value; }
-    void set_h(float value) { box->h = value; }
+private:
+    static constexpr size_t WindowSize = 32768;
+    static constexpr size_t HashSize = 1 << 15;
+    static constexpr size_t BlockSize = 1 << 17;
+    static constexpr size_t OutputChunkSize = 1 << 16;
 
-    std::shared_ptr<lunasvg::Box> get_box() const { return box; }
+    static void store_be32(uint8_t *data, uint32_t value)
+    {
+        data[0] = static_cast<uint8_t>(value >> 24);
+        data[1] = static_cast<uint8_t>(value >> 16);
+        data[2] = static_cast<uint8_t>(value >> 8);
+        data[3] = static_cast<uint8_t>(value);
+    }
 
-    py::ssize_t __len__() const
+    static uint8_t paeth(int a, int b, int c)
     {
-        return 4;
+        const int p = a + b - c;
+        const int pa = std::abs(p - a);
+        const int pb = std::abs(p - b);
+        const int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+        {
+            return static_cast<uint8_t>(a);
+        }
+        return static_cast<uint8_t>(pb <= pc ? b : c);
     }
 
-    py::float_ __getitem__(py::ssize_t index) const
+    // Writes `row` filtered with PNG filter `type` to `out` (filter byte
+    // first) and returns the sum of absolute signed residuals, the cost the
+    // adaptive strategy minimizes. Each filter has its own loop so the
+    // compiler can vectorize the simple ones.
+    size_t filter_row(int type, const uint8_t *row, uint8_t *out) const
     {
-        switch (index)
+        const size_t size = static_cast<size_t>(width) * 4;
+        const uint8_t *above = previous_row.data();
+        uint8_t *residuals = out + 1;
+        out[0] = static_cast<uint8_t>(type);
+        switch (type)
         {
         case 0:
-            return box->x;
+            std::copy_n(row, size, residuals);
+            break;
         case 1:
-            return box->y;
+            std::copy_n(row, 4, residuals);
+            for (size_t i = 4; i < size; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - row[i - 4]);
+            }
+            break;
         case 2:
-            return box->w;
+            for (size_t i = 0; i < size; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - above[i]);
+            }
+            break;
         case 3:
-            return box->h;
+            for (size_t i = 0; i < 4; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - (above[i] >> 1));
+            }
+            for (size_t i = 4; i < size; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - ((row[i - 4] + above[i]) >> 1));
+            }
+            break;
         default:
-            throw py::index_error("Box index out of range");
+            for (size_t i = 0; i < 4; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - above[i]);
+            }
+            for (size_t i = 4; i < size; ++i)
+            {
+                residuals[i] = static_cast<uint8_t>(row[i] - paeth(row[i - 4], above[i], above[i - 4]));
+            }
+            break;
         }
+        if (filter != PngFilter::ADAPTIVE)
+        {
+            return 0;
+        }
+        size_t cost = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            cost += static_cast<size_t>(std::abs(static_cast<int8_t>(residuals[i])));
+        }
+        return cost;
     }
-};
-
-struct PyDocument;
 
-struct PyElement
+    bool write(const uint8_t *data, size_t size)
+    {
+        if (ok && size > 0 && !sink(data, size))
+        {
+            ok = false;
+        }
+        return ok;
+    }
+
+    void write_chunk(const char *type, const uint8_t *data, size_t size)
+    {
+        uint8_t header[8];
+        store_be32(header, static_cast<uint32_t>(size));
+        std::memcpy(header + 4, type, 4);
+        uint32_t crc = crc32_update(0, header + 4, 4);
+        crc = crc32_update(crc, data, size);
+        uint8_t trailer[4];
+        store_be32(trailer, crc);
+        write(header, sizeof(header));
+        write(data, size);
+        write(trailer, sizeof(trailer));
+    }
+
+    void flush_output()
+    {
+        if (!output.empty())
+        {
+            write_chunk("IDAT", output.data(), output.size());
+            output.clear();
+        }
+    }
+
+    void put_bits(uint32_t value, int count)
+    {
+        bit_buffer |= static_cast<uint64_t>(value) << bit_count;
+        bit_count += count;
+        while (bit_count >= 8)
+        {
+            output.push_back(static_cast<uint8_t>(bit_buffer));
+            bit_buffer >>= 8;
+            bit_count -= 8;
+        }
+    }
+
+    // Huffman codes are stored most significant bit first.
+    void put_code(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i)
+        {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put_bits(reversed, length);
+    }
+
+    void put_symbol(int symbol)
+    {
+        if (symbol <= 143)
+        {
+            put_code(0x30 + symbol, 8);
+        }
+        else if (symbol <= 255)
+        {
+            put_code(0x190 + symbol - 144, 9);
+        }
+        else if (symbol <= 279)
+        {
+            put_code(symbol - 256, 7);
+        }
+        else
+        {
+            put_code(0xC0 + symbol - 280, 8);
+        }
+    }
+
+    void put_match(int length, int distance)
+    {
+        static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int code = 28;
+        while (length_base[code] > length)
+        {
+            --code;
+        }
+        put_symbol(257 + code);
+        put_bits(length - length_base[code], length_extra[code]);
+
+        code = 29;
+        while (distance_base[code] > distance)
+        {
+            --code;
+        }
+        put_code(code, 5);
+        put_bits(distance - distance_base[code], distance_extra[code]);
+    }
+
+    const uint8_t *at(std::int64_t position) const
+    {
+        return window.data() + (position - window_start);
+    }
+
+    static uint32_t hash(const uint8_t *data)
+    {
+        const uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+        return (value * 2654435761u) >> (32 - 15);
+    }
+
+    void insert(std::int64_t position)
+    {
+        const uint32_t h = hash(at(position));
+        chain[position & (WindowSize - 1)] = head[h];
+        head[h] = position;
+    }
+
+    // Finds the longest earlier match for the bytes at `position`, then
+    // adds `position` to the hash chains. Returns the match length (0 when
+    // there is none of at least 3 bytes).
+    int find_match(std::int64_t position, std::int64_t end, std::int64_t &distance)
+    {
+        if (end - position < 3)
+        {
+            return 0;
+        }
+        const uint8_t *current = at(position);
+        const int limit = static_cast<int>(std::min<std::int64_t>(258, end - position));
+        const int nice_length = level <= 3 ? std::min(limit, 32) : limit;
+        int best_length = 0;
+        std::int64_t candidate = head[hash(current)];
+        for (int steps = 0; steps < max_chain && candidate >= window_start && candidate < position && position - candidate <= static_cast<std::int64_t>(WindowSize); ++steps)
+        {
+            const uint8_t *previous = at(candidate);
+            if (previous[best_length] == current[best_length])
+            {
+                int length = 0;
+                while (length < limit && previous[length] == current[length])
+                {
+                    ++length;
+                }
+                if (length > best_length)
+                {
+                    best_length = length;
+                    distance = position - candidate;
+                    if (length >= nice_length)
+                    {
+                        break;
+                    }
+                }
+            }
+            candidate = chain[candidate & (WindowSize - 1)];
+        }
+        insert(position);
+        return best_length >= 3 ? best_length : 0;
+    }
+
+    void deflate(const uint8_t *data, size_t size)
+    {
+        uint32_t a = adler_a;
+        uint32_t b = adler_b;
+        for (size_t i = 0; i < size; ++i)
+        {
+            a += data[i];
+            b += a;
+            if ((i & 4095) == 4095)
+            {
+                a %= 65521;
+                b %= 65521;
+            }
+        }
+        adler_a = a % 65521;
+        adler_b = b % 65521;
+
+        window.insert(window.end(), data, data + size);
+        if (window_start + static_cast<std::int64_t>(window.size()) - pending_start >= static_cast<std::int64_t>(BlockSize))
+        {
+            compress_pending(false);
+        }
+    }
+
+    void store_pending(bool final)
+    {
+        const std::int64_t end = window_start + static_cast<std::int64_t>(window.size());
+        std::int64_t position = pending_start;
+        do
+        {
+            const auto length = static_cast<uint32_t>(std::min<std::int64_t>(65535, end - position));
+            put_bits(final && position + length == end ? 1 : 0, 1);
+            put_bits(0, 2);
+            if (bit_count > 0)
+            {
+                put_bits(0, 8 - bit_count);
+            }
+            put_bits(length, 16);
+            put_bits(~length & 0xFFFF, 16);
+            output.insert(output.end(), at(position), at(position) + length);
+            position += length;
+            if (output.size() >= OutputChunkSize)
+            {
+                flush_output();
+            }
+        } while (position < end);
+    }
+
+    // Compresses everything buffered since the last block into one
+    // fixed-Huffman block (stored blocks at level 0), then trims the window
+    // to the last 32 KiB.
+    void compress_pending(bool final)
+    {
+        const std::int64_t end = window_start + static_cast<std::int64_t>(window.size());
+        if (level == 0)
+        {
+            store_pending(final);
+        }
+        else
+        {
+            put_bits(final ? 1 : 0, 1);
+            put_bits(1, 2);
+
+            // From level 4 on, matching is lazy: a match is only taken if
+            // the next position does not start a longer one.
+            const bool lazy = level >= 4;
+            std::int64_t position = pending_start;
+            int deferred_length = 0;
+            std::int64_t deferred_distance = 0;
+            while (position < end)
+            {
+                std::int64_t distance = 0;
+                const int length = find_match(position, end, distance);
+                if (deferred_length > 0)
+                {
+                    if (length > deferred_length)
+                    {
+                        put_symbol(*at(position - 1));
+                        deferred_length = length;
+                        deferred_distance = distance;
+                        ++position;
+                        continue;
+                    }
+                    put_match(deferred_length, static_cast<int>(deferred_distance));
+                    const std::int64_t match_end = position - 1 + deferred_length;
+                    for (std::int64_t next = position + 1; next < match_end && end - next >= 3; ++next)
+                    {
+                        insert(next);
+                    }
+                    position = match_end;
+                    deferred_length = 0;
+                }
+                else if (lazy && length > 0 && length < 258)
+                {
+                    deferred_length = length;
+                    deferred_distance = distance;
+                    ++position;
+                }
+                else if (length > 0)
+                {
+                    put_match(length, static_cast<int>(distance));
+                    if (level > 1)
+                    {
+                        for (std::int64_t next = position + 1; next < position + length && end - next >= 3; ++next)
+                        {
+                            insert(next);
+                        }
+                    }
+                    position += length;
+                }
+                else
+                {
+                    put_symbol(*at(position));
+                    ++position;
+                }
+                if (output.size() >= OutputChunkSize)
+                {
+                    flush_output();
+                }
+            }
+            if (deferred_length > 0)
+            {
+                put_match(deferred_length, static_cast<int>(deferred_distance));
+            }
+            put_symbol(256);
+        }
+        pending_start = end;
+
+        if (window.size() > WindowSize)
+        {
+            const size_t drop = window.size() - WindowSize;
+            window.erase(window.begin(), window.begin() + drop);
+            window_start += static_cast<std::int64_t>(drop);
+        }
+    }
+
+    Sink sink;
+    int width;
+    int height;
+    int level;
+    PngFilter filter;
+    int max_chain;
+    bool ok = true;
+    std::vector<uint8_t> previous_row;
+    std::vector<uint8_t> candidate_row;
+    std::vector<uint8_t> best_row;
+
+    std::vector<uint8_t> window;
+    std::int64_t window_start = 0;
+    std::int64_t pending_start = 0;
+    std::vector<std::int64_t> head;
+    std::vector<std::int64_t> chain;
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+
+    uint64_t bit_buffer = 0;
+    int bit_count = 0;
+    std::vector<uint8_t> output;
+};
+
+// Bytes of an SVG source. Documents keep their source for Document.clone()
+// and the template cache keys on it, so it must not change once created.
+class SourceData
+{
+public:
+    virtual ~SourceData() = default;
+
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+    std::string_view view() const { return std::string_view(bytes, length); }
+
+protected:
+    const char *bytes = nullptr;
+    size_t length = 0;
+};
+
+using DocumentSource = std::shared_ptr<const SourceData>;
+
+class StringSource : public SourceData
 {
+public:
+    explicit StringSource(std::string data) : storage(std::move(data))
+    {
+        bytes = storage.data();
+        length = storage.size();
+    }
+
 private:
-    std::shared_ptr<lunasvg::Element> element;
-    PyDocument *owner_document_ref; // Non-owning reference to the owner document
+    std::string storage;
+};
 
+// Borrows the bytes of an immutable Python object (bytes, str or a
+// read-only buffer) and keeps the object alive. The reference may be
+// dropped on any thread, so the destructor takes the GIL.
+class ObjectSource : public SourceData
+{
 public:
-    PyElement(std::shared_ptr<lunasvg::Element> elem, PyDocument *doc)
-        : element(elem), owner_document_ref(doc) {}
+    ObjectSource(py::object owner, const char *data, size_t size, const Py_buffer *view = nullptr)
+        : owner(std::move(owner)), has_view(view != nullptr)
+    {
+        if (view)
+        {
+            this->view = *view;
+        }
+        bytes = data;
+        length = size;
+    }
 
-    py::object __repr__(void)
+    ~ObjectSource() override
     {
-        return py::str("<Element>");
+        if (python_finalizing())
+        {
+            owner.release();
+            return;
+        }
+        py::gil_scoped_acquire gil;
+        if (has_view)
+        {
+            PyBuffer_Release(&view);
+        }
+        owner = py::object();
+    }
+
+private:
+    py::object owner;
+    Py_buffer view{};
+    bool has_view;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile : public SourceData
+{
+public:
+    static std::shared_ptr<MappedFile> open(const std::string &filename)
+    {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+        int length = MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, nullptr, 0);
+        if (length <= 0)
+        {
+            return nullptr;
+        }
+        std::wstring wide_filename(static_cast<size_t>(length), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, filename.c_str(), -1, &wide_filename[0], length);
+        HANDLE handle = CreateFileW(wide_filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(handle, &size) && size.QuadPart > 0)
+        {
+            mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(handle);
+        if (!mapping)
+        {
+            return nullptr;
+        }
+        void *address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!address)
+        {
+            return nullptr;
+        }
+        file->length = static_cast<size_t>(size.QuadPart);
+#else
+        int descriptor = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0)
+        {
+            return nullptr;
+        }
+        struct stat status;
+        void *address = MAP_FAILED;
+        if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+        {
+            address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        }
+        ::close(descriptor);
+        if (address == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        file->length = static_cast<size_t>(status.st_size);
+#endif
+        file->bytes = static_cast<const char *>(address);
+        return file;
+    }
+
+    ~MappedFile() override
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+#else
+        munmap(const_cast<char *>(bytes), length);
+#endif
+    }
+
+private:
+    MappedFile() = default;
+};
+
+// Reads a whole file into memory of its own. Returns null when the file
+// cannot be read.
+static DocumentSource read_file_source(const std::string &filename)
+{
+    std::string data;
+    if (!read_file(filename, data))
+    {
+        return nullptr;
+    }
+    return std::make_shared<StringSource>(std::move(data));
+}
+
+// Maps a file, falling back to reading it for files that cannot be mapped
+// (pipes, empty files). Returns null when the file cannot be read.
+static DocumentSource load_file_source(const std::string &filename)
+{
+    if (auto file = MappedFile::open(filename))
+    {
+        return file;
+    }
+    return read_file_source(filename);
+}
+
+// Family and style of a TrueType or OpenType font (the first face of a
+// collection), read from its name table and its OS/2 or head table.
+struct FontStyle
+{
+    std::string family;
+    bool bold = false;
+    bool italic = false;
+};
+
+static void append_utf8(std::string &output, uint32_t codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        output += static_cast<char>(codepoint);
+    }
+    else if (codepoint < 0x800)
+    {
+        output += static_cast<char>(0xC0 | (codepoint >> 6));
+        output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint < 0x10000)
+    {
+        output += static_cast<char>(0xE0 | (codepoint >> 12));
+        output += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+        output += static_cast<char>(0xF0 | (codepoint >> 18));
+        output += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+        output += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+}
+
+static bool read_font_style(const char *data, size_t length, FontStyle &style)
+{
+    const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+    const auto u16 = [bytes, length](size_t at) -> uint32_t
+    { return at + 2 <= length ? (bytes[at] << 8) | bytes[at + 1] : 0; };
+    const auto u32 = [&u16](size_t at) -> uint32_t
+    { return (u16(at) << 16) | u16(at + 2); };
+
+    size_t font = 0;
+    if (length >= 16 && std::memcmp(data, "ttcf", 4) == 0)
+    {
+        font = u32(12);
+    }
+    if (font + 12 > length)
+    {
+        return false;
+    }
+    size_t name = 0, os2 = 0, head = 0;
+    size_t name_length = 0, os2_length = 0, head_length = 0;
+    const size_t tables = u16(font + 4);
+    for (size_t index = 0; index < tables; ++index)
+    {
+        const size_t record = font + 12 + index * 16;
+        if (record + 16 > length)
+        {
+            return false;
+        }
+        const size_t offset = u32(record + 8);
+        const size_t size = u32(record + 12);
+        if (offset > length || size > length - offset)
+        {
+            continue;
+        }
+        if (std::memcmp(data + record, "name", 4) == 0)
+        {
+            name = offset;
+            name_length = size;
+        }
+        else if (std::memcmp(data + record, "OS/2", 4) == 0)
+        {
+            os2 = offset;
+            os2_length = size;
+        }
+        else if (std::memcmp(data + record, "head", 4) == 0)
+        {
+            head = offset;
+            head_length = size;
+        }
+    }
+    if (name_length < 6)
+    {
+        return false;
+    }
+
+    // The legacy family name (ID 1) groups at most a regular, bold, italic
+    // and bold italic face, which is the model lunasvg matches fonts with.
+    // Windows English names are preferred, then other Unicode names, then
+    // Macintosh Roman.
+    const size_t strings = name + u16(name + 4);
+    const size_t count = u16(name + 2);
+    int best = 0;
+    for (size_t index = 0; index < count; ++index)
+    {
+        const size_t record = name + 6 + index * 12;
+        if (record + 12 > name + name_length)
+        {
+            break;
+        }
+        const uint32_t platform = u16(record);
+        const uint32_t encoding = u16(record + 2);
+        const uint32_t language = u16(record + 4);
+        const size_t size = u16(record + 8);
+        const size_t start = strings + u16(record + 10);
+        if (u16(record + 6) != 1 || start + size > length)
+        {
+            continue;
+        }
+        int score = 0;
+        if (platform == 3 && (encoding == 1 || encoding == 10))
+        {
+            score = language == 0x409 ? 4 : 3;
+        }
+        else if (platform == 0)
+        {
+            score = 2;
+        }
+        else if (platform == 1 && encoding == 0)
+        {
+            score = 1;
+        }
+        if (score <= best)
+        {
+            continue;
+        }
+        std::string family;
+        if (platform == 1)
+        {
+            for (size_t at = start; at < start + size; ++at)
+            {
+                append_utf8(family, bytes[at]);
+            }
+        }
+        else
+        {
+            for (size_t at = start; at + 1 < start + size; at += 2)
+            {
+                uint32_t unit = u16(at);
+                if (unit >= 0xD800 && unit < 0xDC00 && at + 3 < start + size)
+                {
+                    const uint32_t low = u16(at + 2);
+                    if (low >= 0xDC00 && low < 0xE000)
+                    {
+                        unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                        at += 2;
+                    }
+                }
+                append_utf8(family, unit);
+            }
+        }
+        if (!family.empty())
+        {
+            style.family = std::move(family);
+            best = score;
+        }
+    }
+    if (style.family.empty())
+    {
+        return false;
+    }
+    if (os2_length >= 64)
+    {
+        const uint32_t selection = u16(os2 + 62);
+        style.italic = (selection & 0x01) != 0;
+        style.bold = (selection & 0x20) != 0;
+    }
+    else if (head_length >= 46)
+    {
+        const uint32_t mac_style = u16(head + 44);
+        style.bold = (mac_style & 0x01) != 0;
+        style.italic = (mac_style & 0x02) != 0;
+    }
+    return true;
+}
+
+// Font faces registered through the binding. lunasvg keeps a pointer to the
+// font data rather than a copy, so each face holds a reference to the bytes
+// behind it (a private copy, or the mapping of a snapshot), released by
+// lunasvg's destroy callback. Font files are read rather than mapped: a
+// mapped file that is truncated or rewritten in place would change under
+// lunasvg or fault, while snapshots are only ever replaced by rename.
+// Accessed under font_registry_mutex(): taken exclusively to add faces and
+// shared to list them.
+class FontCache
+{
+public:
+    struct Face
+    {
+        std::string family;
+        bool bold;
+        bool italic;
+        DocumentSource owner;
+        const char *data;
+        size_t length;
+    };
+
+    enum class AddResult
+    {
+        Added,
+        Duplicate,
+        Invalid
+    };
+
+    static FontCache &instance()
+    {
+        // Intentionally leaked: lunasvg may use the faces until exit.
+        static FontCache *cache = new FontCache();
+        return *cache;
+    }
+
+    // Registers `length` bytes at `data`, which `owner` keeps alive. A face
+    // with the same family, style and bytes as a registered one is skipped.
+    AddResult add(const std::string &family, bool bold, bool italic, const DocumentSource &owner, const char *data, size_t length)
+    {
+        const std::string_view bytes(data, length);
+        auto range = index.equal_range(std::make_tuple(family, bold, italic));
+        for (auto entry = range.first; entry != range.second; ++entry)
+        {
+            const Face &face = faces[entry->second];
+            if (std::string_view(face.data, face.length) == bytes)
+            {
+                return AddResult::Duplicate;
+            }
+        }
+        // lunasvg calls the destroy callback itself when the data is not a
+        // usable font.
+        auto *closure = new DocumentSource(owner);
+        const auto destroy = [](void *reference)
+        { delete static_cast<DocumentSource *>(reference); };
+        if (!lunasvg_add_font_face_from_data(family.c_str(), bold, italic, const_cast<char *>(data), length, destroy, closure))
+        {
+            return AddResult::Invalid;
+        }
+        index.emplace(std::make_tuple(family, bold, italic), faces.size());
+        faces.push_back({family, bold, italic, owner, data, length});
+        return AddResult::Added;
+    }
+
+    const std::vector<Face> &get_faces() const { return faces; }
+
+private:
+    std::vector<Face> faces;
+    std::multimap<std::tuple<std::string, bool, bool>, size_t> index;
+};
+
+// Snapshot files hold the faces of the font cache so that other processes
+// can map them instead of loading every font again. They are written to a
+// temporary file that is then renamed over the target, so a process that
+// maps the old snapshot keeps its contents. The layout, in little
+// endian, is a header (the magic, then the face count as uint32), one record
+// per face (family length as uint32, style flags as uint32 with 1 for bold
+// and 2 for italic, data offset and length as uint64, then the UTF-8 family
+// name), and the font data, each face aligned to 8 bytes.
+static const char FontSnapshotMagic[8] = {'P', 'L', 'S', 'V', 'G', 'F', 'N', 'T'};
+
+static void write_font_snapshot(const std::string &filename, const std::vector<FontCache::Face> &faces)
+{
+    std::string header(FontSnapshotMagic, sizeof(FontSnapshotMagic));
+    const auto put = [&header](uint64_t value, int size)
+    {
+        for (int byte = 0; byte < size; ++byte)
+        {
+            header += static_cast<char>((value >> (byte * 8)) & 0xFF);
+        }
+    };
+    const auto align = [](uint64_t offset)
+    { return (offset + 7) & ~static_cast<uint64_t>(7); };
+
+    uint64_t offset = sizeof(FontSnapshotMagic) + 4;
+    for (const auto &face : faces)
+    {
+        offset += 24 + face.family.size();
+    }
+    put(faces.size(), 4);
+    for (const auto &face : faces)
+    {
+        offset = align(offset);
+        put(face.family.size(), 4);
+        put((face.bold ? 1 : 0) | (face.italic ? 2 : 0), 4);
+        put(offset, 8);
+        put(face.length, 8);
+        header += face.family;
+        offset += face.length;
+    }
+
+    static std::atomic<unsigned> serial{0};
+#ifdef _WIN32
+    const unsigned long process = GetCurrentProcessId();
+#else
+    const long process = static_cast<long>(getpid());
+#endif
+    const std::string temporary = filename + "." + std::to_string(process) + "." + std::to_string(serial++) + ".tmp";
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(open_file(temporary, "wb"), std::fclose);
+    bool success = file && std::fwrite(header.data(), 1, header.size(), file.get()) == header.size();
+    uint64_t position = header.size();
+    for (const auto &face : faces)
+    {
+        const char padding[8] = {};
+        const size_t pad = static_cast<size_t>(align(position) - position);
+        success = success && std::fwrite(padding, 1, pad, file.get()) == pad && std::fwrite(face.data, 1, face.length, file.get()) == face.length;
+        position = align(position) + face.length;
+    }
+    success = success && std::fflush(file.get()) == 0;
+#ifdef _WIN32
+    success = success && FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file.get()))));
+#else
+    success = success && fsync(fileno(file.get())) == 0;
+#endif
+    success = (file && std::fclose(file.release()) == 0) && success;
+    if (!success || !replace_file(temporary, filename))
+    {
+        remove_file(temporary);
+        throw std::runtime_error("Failed to write font snapshot: " + filename);
+    }
+}
+
+// Reads the faces of a snapshot file. Their data points into the mapping.
+static std::vector<FontCache::Face> read_font_snapshot(const std::string &filename)
+{
+    auto file = MappedFile::open(filename);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open font snapshot: " + filename);
+    }
+    const auto *bytes = reinterpret_cast<const uint8_t *>(file->data());
+    const size_t length = file->size();
+    const auto get = [bytes, length](size_t at, int size)
+    {
+        uint64_t value = 0;
+        for (int byte = size - 1; byte >= 0; --byte)
+        {
+            value = (value << 8) | bytes[at + byte];
+        }
+        return value;
+    };
+    const auto invalid = [&filename]()
+    { return std::runtime_error("Invalid font snapshot: " + filename); };
+
+    if (length < sizeof(FontSnapshotMagic) + 4 || std::memcmp(bytes, FontSnapshotMagic, sizeof(FontSnapshotMagic)) != 0)
+    {
+        throw invalid();
+    }
+    const uint64_t count = get(sizeof(FontSnapshotMagic), 4);
+    size_t position = sizeof(FontSnapshotMagic) + 4;
+    std::vector<FontCache::Face> faces;
+    for (uint64_t index = 0; index < count; ++index)
+    {
+        if (length - position < 24)
+        {
+            throw invalid();
+        }
+        const uint64_t family_length = get(position, 4);
+        const uint64_t flags = get(position + 4, 4);
+        const uint64_t offset = get(position + 8, 8);
+        const uint64_t size = get(position + 16, 8);
+        position += 24;
+        if (family_length > length - position || offset > length || size > length - offset)
+        {
+            throw invalid();
+        }
+        faces.push_back({std::string(file->data() + position, family_length), (flags & 1) != 0, (flags & 2) != 0, file, file->data() + offset, static_cast<size_t>(size)});
+        position += family_length;
+    }
+    return faces;
+}
+
+// Wraps SVG source text held by a str or bytes-like object. Immutable
+// objects are used in place; writable buffers, whose contents could change
+// under a retained source, are copied once.
+static DocumentSource source_from_object(const py::object &pydata)
+{
+    if (pydata.is_none())
+    {
+        throw std::invalid_argument("Data cannot be None.");
+    }
+    DocumentSource source;
+    if (PyBytes_Check(pydata.ptr()))
+    {
+        source = std::make_shared<ObjectSource>(pydata, PyBytes_AS_STRING(pydata.ptr()), static_cast<size_t>(PyBytes_GET_SIZE(pydata.ptr())));
+    }
+    else if (PyUnicode_Check(pydata.ptr()))
+    {
+        Py_ssize_t size;
+        const char *data = PyUnicode_AsUTF8AndSize(pydata.ptr(), &size);
+        if (!data)
+        {
+            throw py::error_already_set();
+        }
+        source = std::make_shared<ObjectSource>(pydata, data, static_cast<size_t>(size));
+    }
+    else if (PyObject_CheckBuffer(pydata.ptr()))
+    {
+        Py_buffer view;
+        if (PyObject_GetBuffer(pydata.ptr(), &view, PyBUF_SIMPLE) != 0)
+        {
+            throw py::error_already_set();
+        }
+        if (view.readonly)
+        {
+            source = std::make_shared<ObjectSource>(pydata, static_cast<const char *>(view.buf), static_cast<size_t>(view.len), &view);
+        }
+        else
+        {
+            std::string data(static_cast<const char *>(view.buf), static_cast<size_t>(view.len));
+            PyBuffer_Release(&view);
+            source = std::make_shared<StringSource>(std::move(data));
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("Data must be a string or a bytes-like object.");
+    }
+    if (source->size() == 0)
+    {
+        throw std::invalid_argument("Data cannot be empty.");
+    }
+    return source;
+}
+
+// Pixel layouts produced by Bitmap.convert(). lunasvg renders premultiplied
+// ARGB32 words; every conversion below reads that and writes packed rows.
+enum class PixelFormat
+{
+    RGBA,
+    RGBA_PREMULTIPLIED,
+    BGRA,
+    BGRA_PREMULTIPLIED,
+    RGB,
+    BGR,
+    GRAY,
+    ALPHA,
+};
+
+static int pixel_format_size(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGB:
+    case PixelFormat::BGR:
+        return 3;
+    case PixelFormat::GRAY:
+    case PixelFormat::ALPHA:
+        return 1;
+    default:
+        return 4;
+    }
+}
+
+// Converts `count` pixels; `background` (0xRRGGBBAA, alpha ignored) is what
+// the opaque layouts are flattened onto. Four-byte layouts may run in place.
+// Rows are bytes with no alignment guarantee, since they may come from a
+// buffer handed in from Python such as a bytearray slice.
+using ConvertRowFunc = void (*)(const uint8_t *src, uint8_t *dst, int count, uint32_t background);
+
+static inline uint32_t load_pixel(const uint8_t *data)
+{
+    uint32_t pixel;
+    std::memcpy(&pixel, data, sizeof(pixel));
+    return pixel;
+}
+
+static inline void store_pixel(uint8_t *data, uint32_t pixel)
+{
+    std::memcpy(data, &pixel, sizeof(pixel));
+}
+
+static inline uint32_t div255(uint32_t value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+template <PixelFormat Format>
+static void convert_row_scalar(const uint8_t *src, uint8_t *dst, int count, uint32_t background)
+{
+    const uint32_t background_r = background >> 24;
+    const uint32_t background_g = (background >> 16) & 0xFF;
+    const uint32_t background_b = (background >> 8) & 0xFF;
+    for (int x = 0; x < count; ++x)
+    {
+        const uint32_t pixel = load_pixel(src + x * 4);
+        const uint32_t a = pixel >> 24;
+        uint32_t r = (pixel >> 16) & 0xFF;
+        uint32_t g = (pixel >> 8) & 0xFF;
+        uint32_t b = pixel & 0xFF;
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::BGRA)
+        {
+            // Same rounding as lunasvg::Bitmap::convertToRGBA().
+            if (a != 0)
+            {
+                r = (r * 255) / a;
+                g = (g * 255) / a;
+                b = (b * 255) / a;
+            }
+        }
+        else if (Format == PixelFormat::RGB || Format == PixelFormat::BGR || Format == PixelFormat::GRAY)
+        {
+            r += div255(background_r * (255 - a));
+            g += div255(background_g * (255 - a));
+            b += div255(background_b * (255 - a));
+        }
+
+        switch (Format)
+        {
+        case PixelFormat::RGBA:
+        case PixelFormat::RGBA_PREMULTIPLIED:
+            store_pixel(dst + x * 4, (a << 24) | (b << 16) | (g << 8) | r);
+            break;
+        case PixelFormat::BGRA:
+        case PixelFormat::BGRA_PREMULTIPLIED:
+            store_pixel(dst + x * 4, (a << 24) | (r << 16) | (g << 8) | b);
+            break;
+        case PixelFormat::RGB:
+            dst[x * 3 + 0] = static_cast<uint8_t>(r);
+            dst[x * 3 + 1] = static_cast<uint8_t>(g);
+            dst[x * 3 + 2] = static_cast<uint8_t>(b);
+            break;
+        case PixelFormat::BGR:
+            dst[x * 3 + 0] = static_cast<uint8_t>(b);
+            dst[x * 3 + 1] = static_cast<uint8_t>(g);
+            dst[x * 3 + 2] = static_cast<uint8_t>(r);
+            break;
+        case PixelFormat::GRAY:
+            dst[x] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+            break;
+        case PixelFormat::ALPHA:
+            dst[x] = static_cast<uint8_t>(a);
+            break;
+        }
+    }
+}
+
+#ifdef PYLUNASVG_SSE2
+// The x86 kernels work on whole ARGB32 words. Unpremultiplying divides in
+// single precision and truncates, which is exact for c * 255 / a with
+// c, a <= 255, so the results match the scalar integer division bit for bit.
+static inline __m128i swap_red_blue_sse2(__m128i pixels)
+{
+    const __m128i alpha_green = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m128i red_blue = _mm_andnot_si128(alpha_green, pixels);
+    const __m128i swapped = _mm_or_si128(_mm_srli_epi32(red_blue, 16), _mm_slli_epi32(_mm_and_si128(red_blue, _mm_set1_epi32(0xFF)), 16));
+    return _mm_or_si128(_mm_and_si128(pixels, alpha_green), swapped);
+}
+
+static inline __m128i unpremultiply_sse2(__m128i pixels)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128i a = _mm_srli_epi32(pixels, 24);
+    const __m128 alpha = _mm_cvtepi32_ps(a);
+    const __m128i r = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask)), scale), alpha));
+    const __m128i g = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask)), scale), alpha));
+    const __m128i b = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(pixels, mask)), scale), alpha));
+    const __m128i result = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+    // Fully transparent pixels are passed through untouched.
+    const __m128i transparent = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+    return _mm_or_si128(_mm_and_si128(transparent, pixels), _mm_andnot_si128(transparent, result));
+}
+
+template <PixelFormat Format>
+static void convert_row_sse2(const uint8_t *src, uint8_t *dst, int count, uint32_t background)
+{
+    int x = 0;
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4));
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::BGRA)
+        {
+            pixels = unpremultiply_sse2(pixels);
+        }
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::RGBA_PREMULTIPLIED)
+        {
+            pixels = swap_red_blue_sse2(pixels);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), pixels);
+    }
+    convert_row_scalar<Format>(src + x * 4, dst + x * 4, count - x, background);
+}
+
+PYLUNASVG_TARGET_AVX2 static inline __m256i swap_red_blue_avx2(__m256i pixels)
+{
+    const __m256i alpha_green = _mm256_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m256i red_blue = _mm256_andnot_si256(alpha_green, pixels);
+    const __m256i swapped = _mm256_or_si256(_mm256_srli_epi32(red_blue, 16), _mm256_slli_epi32(_mm256_and_si256(red_blue, _mm256_set1_epi32(0xFF)), 16));
+    return _mm256_or_si256(_mm256_and_si256(pixels, alpha_green), swapped);
+}
+
+PYLUNASVG_TARGET_AVX2 static inline __m256i unpremultiply_avx2(__m256i pixels)
+{
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256i a = _mm256_srli_epi32(pixels, 24);
+    const __m256 alpha = _mm256_cvtepi32_ps(a);
+    const __m256i r = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask)), scale), alpha));
+    const __m256i g = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask)), scale), alpha));
+    const __m256i b = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(pixels, mask)), scale), alpha));
+    const __m256i result = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(a, 24), _mm256_slli_epi32(r, 16)), _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+    const __m256i transparent = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+    return _mm256_blendv_epi8(result, pixels, transparent);
+}
+
+template <PixelFormat Format>
+PYLUNASVG_TARGET_AVX2 static void convert_row_avx2(const uint8_t *src, uint8_t *dst, int count, uint32_t background)
+{
+    int x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 4));
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::BGRA)
+        {
+            pixels = unpremultiply_avx2(pixels);
+        }
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::RGBA_PREMULTIPLIED)
+        {
+            pixels = swap_red_blue_avx2(pixels);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x * 4), pixels);
+    }
+    convert_row_sse2<Format>(src + x * 4, dst + x * 4, count - x, background);
+}
+
+static bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef PYLUNASVG_NEON
+// NEON loads sixteen pixels deinterleaved into B, G, R and A planes, which
+// also makes the packed three- and one-byte layouts cheap to store.
+static inline uint8x8_t unpremultiply_half_neon(uint8x8_t channel, uint8x8_t alpha)
+{
+    const uint16x8_t c16 = vmovl_u8(channel);
+    const uint16x8_t a16 = vmovl_u8(alpha);
+    const float32x4_t scale = vdupq_n_f32(255.0f);
+    const float32x4_t c_lo = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(c16))), scale);
+    const float32x4_t c_hi = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(c16))), scale);
+    const uint32x4_t q_lo = vcvtq_u32_f32(vdivq_f32(c_lo, vcvtq_f32_u32(vmovl_u16(vget_low_u16(a16)))));
+    const uint32x4_t q_hi = vcvtq_u32_f32(vdivq_f32(c_hi, vcvtq_f32_u32(vmovl_u16(vget_high_u16(a16)))));
+    const uint8x8_t result = vqmovn_u16(vcombine_u16(vmovn_u32(q_lo), vmovn_u32(q_hi)));
+    return vbsl_u8(vceq_u8(alpha, vdup_n_u8(0)), channel, result);
+}
+
+static inline uint8x16_t unpremultiply_neon(uint8x16_t channel, uint8x16_t alpha)
+{
+    return vcombine_u8(unpremultiply_half_neon(vget_low_u8(channel), vget_low_u8(alpha)),
+                       unpremultiply_half_neon(vget_high_u8(channel), vget_high_u8(alpha)));
+}
+
+static inline uint8x8_t div255_neon(uint16x8_t value)
+{
+    value = vaddq_u16(value, vdupq_n_u16(128));
+    return vshrn_n_u16(vaddq_u16(value, vshrq_n_u16(value, 8)), 8);
+}
+
+static inline uint8x16_t flatten_neon(uint8x16_t channel, uint8x16_t inverse_alpha, uint8_t background)
+{
+    const uint8x8_t color = vdup_n_u8(background);
+    const uint8x8_t lo = div255_neon(vmull_u8(vget_low_u8(inverse_alpha), color));
+    const uint8x8_t hi = div255_neon(vmull_u8(vget_high_u8(inverse_alpha), color));
+    return vqaddq_u8(channel, vcombine_u8(lo, hi));
+}
+
+template <PixelFormat Format>
+static void convert_row_neon(const uint8_t *src, uint8_t *dst, int count, uint32_t background)
+{
+    const int size = pixel_format_size(Format);
+    int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        const uint8x16x4_t pixels = vld4q_u8(src + x * 4);
+        uint8x16_t b = pixels.val[0];
+        uint8x16_t g = pixels.val[1];
+        uint8x16_t r = pixels.val[2];
+        const uint8x16_t a = pixels.val[3];
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::BGRA)
+        {
+            r = unpremultiply_neon(r, a);
+            g = unpremultiply_neon(g, a);
+            b = unpremultiply_neon(b, a);
+        }
+        else if (Format == PixelFormat::RGB || Format == PixelFormat::BGR || Format == PixelFormat::GRAY)
+        {
+            const uint8x16_t inverse_alpha = vmvnq_u8(a);
+            r = flatten_neon(r, inverse_alpha, static_cast<uint8_t>(background >> 24));
+            g = flatten_neon(g, inverse_alpha, static_cast<uint8_t>(background >> 16));
+            b = flatten_neon(b, inverse_alpha, static_cast<uint8_t>(background >> 8));
+        }
+
+        uint8_t *out = dst + x * size;
+        if (Format == PixelFormat::RGBA || Format == PixelFormat::RGBA_PREMULTIPLIED)
+        {
+            vst4q_u8(out, uint8x16x4_t{{r, g, b, a}});
+        }
+        else if (Format == PixelFormat::BGRA || Format == PixelFormat::BGRA_PREMULTIPLIED)
+        {
+            vst4q_u8(out, uint8x16x4_t{{b, g, r, a}});
+        }
+        else if (Format == PixelFormat::RGB)
+        {
+            vst3q_u8(out, uint8x16x3_t{{r, g, b}});
+        }
+        else if (Format == PixelFormat::BGR)
+        {
+            vst3q_u8(out, uint8x16x3_t{{b, g, r}});
+        }
+        else if (Format == PixelFormat::GRAY)
+        {
+            uint16x8_t lo = vmull_u8(vget_low_u8(r), vdup_n_u8(77));
+            lo = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(150));
+            lo = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(29));
+            uint16x8_t hi = vmull_u8(vget_high_u8(r), vdup_n_u8(77));
+            hi = vmlal_u8(hi, vget_high_u8(g), vdup_n_u8(150));
+            hi = vmlal_u8(hi, vget_high_u8(b), vdup_n_u8(29));
+            vst1q_u8(out, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+        }
+        else
+        {
+            vst1q_u8(out, a);
+        }
+    }
+    convert_row_scalar<Format>(src + x * 4, dst + x * size, count - x, background);
+}
+#endif
+
+template <PixelFormat Format>
+static ConvertRowFunc select_convert_row()
+{
+#if defined(PYLUNASVG_NEON)
+    return &convert_row_neon<Format>;
+#elif defined(PYLUNASVG_SSE2)
+    if (pixel_format_size(Format) == 4)
+    {
+        static const bool avx2 = cpu_supports_avx2();
+        return avx2 ? &convert_row_avx2<Format> : &convert_row_sse2<Format>;
+    }
+    return &convert_row_scalar<Format>;
+#else
+    return &convert_row_scalar<Format>;
+#endif
+}
+
+static ConvertRowFunc convert_row_function(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGBA:
+        return select_convert_row<PixelFormat::RGBA>();
+    case PixelFormat::RGBA_PREMULTIPLIED:
+        return select_convert_row<PixelFormat::RGBA_PREMULTIPLIED>();
+    case PixelFormat::BGRA:
+        return select_convert_row<PixelFormat::BGRA>();
+    case PixelFormat::BGRA_PREMULTIPLIED:
+        return select_convert_row<PixelFormat::BGRA_PREMULTIPLIED>();
+    case PixelFormat::RGB:
+        return select_convert_row<PixelFormat::RGB>();
+    case PixelFormat::BGR:
+        return select_convert_row<PixelFormat::BGR>();
+    case PixelFormat::GRAY:
+        return select_convert_row<PixelFormat::GRAY>();
+    case PixelFormat::ALPHA:
+        return select_convert_row<PixelFormat::ALPHA>();
+    }
+    throw std::invalid_argument("Unknown pixel format.");
+}
+
+// Converts a premultiplied ARGB32 image into `format`; the source and the
+// destination may be the same memory for the four-byte layouts.
+static void convert_pixels(const uint8_t *src, int src_stride, uint8_t *dst, size_t dst_stride, int width, int height, PixelFormat format, uint32_t background)
+{
+    PhaseTimer timer(StatsPhase::Convert);
+    const auto convert_row = convert_row_function(format);
+    for (int y = 0; y < height; ++y)
+    {
+        convert_row(src + static_cast<size_t>(y) * src_stride, dst + y * dst_stride, width, background);
+    }
+}
+
+// Box-filters two rows of 2 * count premultiplied pixels into count pixels.
+// Averaging premultiplied channels is exact for coverage, so edges stay
+// clean at the lower resolution.
+static void downsample_row(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int count)
+{
+    int x = 0;
+#if defined(PYLUNASVG_NEON)
+    for (; x + 8 <= count; x += 8)
+    {
+        const uint8x16x4_t top = vld4q_u8(row0 + x * 8);
+        const uint8x16x4_t bottom = vld4q_u8(row1 + x * 8);
+        uint8x8x4_t result;
+        for (int channel = 0; channel < 4; ++channel)
+        {
+            const uint16x8_t sum = vpadalq_u8(vpaddlq_u8(top.val[channel]), bottom.val[channel]);
+            result.val[channel] = vrshrn_n_u16(sum, 2);
+        }
+        vst4_u8(dst + x * 4, result);
+    }
+#elif defined(PYLUNASVG_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi16(2);
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i sums[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            const __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8 + half * 16));
+            const __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8 + half * 16));
+            // Pixels 0 and 1, then 2 and 3, widened to 16 bits per channel.
+            const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+            const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+            const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), _mm_packus_epi16(sums[0], sums[1]));
+    }
+#endif
+    for (; x < count; ++x)
+    {
+        const uint32_t p0 = load_pixel(row0 + x * 8), p1 = load_pixel(row0 + x * 8 + 4);
+        const uint32_t p2 = load_pixel(row1 + x * 8), p3 = load_pixel(row1 + x * 8 + 4);
+        uint32_t pixel = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            const uint32_t sum = ((p0 >> shift) & 0xFF) + ((p1 >> shift) & 0xFF) + ((p2 >> shift) & 0xFF) + ((p3 >> shift) & 0xFF);
+            pixel |= ((sum + 2) >> 2) << shift;
+        }
+        store_pixel(dst + x * 4, pixel);
+    }
+}
+
+// Halves a bitmap with even dimensions.
+static lunasvg::Bitmap downsample_bitmap(const lunasvg::Bitmap &source)
+{
+    lunasvg::Bitmap result(source.width() / 2, source.height() / 2);
+    if (result.isNull())
+    {
+        return result;
+    }
+    Stats::instance().add_bitmap(result);
+    PhaseTimer timer(StatsPhase::Rasterize);
+    for (int y = 0; y < result.height(); ++y)
+    {
+        const uint8_t *row = source.data() + static_cast<size_t>(y) * 2 * source.stride();
+        downsample_row(row, row + source.stride(), result.data() + static_cast<size_t>(y) * result.stride(), result.width());
+    }
+    return result;
+}
+
+// Renders a laid-out document at several sizes on the worker pool. With
+// `downsample`, a size whose double is also requested is downsampled from it
+// instead of being rasterized again, so each chain of halvings costs one
+// render. Every size is checked against `budget` before anything is
+// rendered.
+static std::vector<lunasvg::Bitmap> render_document_at_sizes(const lunasvg::Document &document, const std::vector<std::pair<int, int>> &sizes, uint32_t background_color, size_t threads, bool downsample, const RenderBudget &budget)
+{
+    std::vector<std::pair<int, int>> unique_sizes;
+    std::vector<lunasvg::Matrix> matrices;
+    std::map<std::pair<int, int>, size_t> unique_index;
+    std::vector<size_t> slots(sizes.size());
+    for (size_t index = 0; index < sizes.size(); ++index)
+    {
+        int width = sizes[index].first;
+        int height = sizes[index].second;
+        lunasvg::Matrix matrix;
+        if (!resolve_render_size(document, width, height, matrix))
+        {
+            throw std::runtime_error("Failed to render SVG document to bitmap at index " + std::to_string(index) + ".");
+        }
+        budget.check_size(width, height);
+        auto inserted = unique_index.emplace(std::make_pair(width, height), unique_sizes.size());
+        if (inserted.second)
+        {
+            unique_sizes.emplace_back(width, height);
+            matrices.push_back(matrix);
+        }
+        slots[index] = inserted.first->second;
+    }
+
+    // Every size has at most one half, so the sizes form chains that start
+    // at a size whose double was not requested.
+    constexpr size_t NoHalf = std::numeric_limits<size_t>::max();
+    std::vector<size_t> half(unique_sizes.size(), NoHalf);
+    std::vector<size_t> roots;
+    for (size_t index = 0; index < unique_sizes.size(); ++index)
+    {
+        const auto &size = unique_sizes[index];
+        auto parent = downsample ? unique_index.find(std::make_pair(size.first * 2, size.second * 2)) : unique_index.end();
+        if (parent == unique_index.end())
+        {
+            roots.push_back(index);
+        }
+        else
+        {
+            half[parent->second] = index;
+        }
+    }
+
+    std::vector<lunasvg::Bitmap> rendered(unique_sizes.size());
+    WorkerPool::instance().parallel_for(roots.size(), threads, [&](size_t root)
+                                        {
+        size_t index = roots[root];
+        budget.check();
+        rendered[index] = render_resolved(document, unique_sizes[index].first, unique_sizes[index].second, matrices[index], background_color, budget);
+        while (!rendered[index].isNull() && half[index] != NoHalf)
+        {
+            budget.check();
+            rendered[half[index]] = downsample_bitmap(rendered[index]);
+            index = half[index];
+        } });
+
+    std::vector<lunasvg::Bitmap> results(sizes.size());
+    std::vector<bool> used(unique_sizes.size(), false);
+    for (size_t index = 0; index < sizes.size(); ++index)
+    {
+        const auto &source = rendered[slots[index]];
+        if (source.isNull())
+        {
+            throw std::runtime_error("Failed to render SVG document to bitmap at index " + std::to_string(index) + ".");
+        }
+        if (!used[slots[index]])
+        {
+            used[slots[index]] = true;
+            results[index] = source;
+            continue;
+        }
+        // A repeated size gets its own pixels, since bitmaps are mutable.
+        lunasvg::Bitmap copy(source.width(), source.height());
+        if (copy.isNull())
+        {
+            throw std::runtime_error("Failed to create bitmap: out of memory");
+        }
+        Stats::instance().add_bitmap(copy);
+        std::memcpy(copy.data(), source.data(), static_cast<size_t>(source.stride()) * source.height());
+        results[index] = std::move(copy);
+    }
+    return results;
+}
+
+// Checks that a buffer holds C-contiguous 8-bit or 32-bit integers.
+static void check_integer_buffer(const py::buffer_info &info)
+{
+    std::string format = info.format;
+    if (!format.empty() && std::strchr("@=<>!", format[0]))
+    {
+        format.erase(0, 1);
+    }
+    const bool bytes = info.itemsize == 1 && (format == "B" || format == "b" || format == "c");
+    const bool words = info.itemsize == 4 && (format == "I" || format == "i" || format == "L" || format == "l");
+    if (!bytes && !words)
+    {
+        throw py::type_error("Buffer must contain 8-bit or 32-bit integers.");
+    }
+    py::ssize_t expected_stride = info.itemsize;
+    for (py::ssize_t dim = info.ndim - 1; dim >= 0; --dim)
+    {
+        if (info.shape[dim] != 1 && info.strides[dim] != expected_stride)
+        {
+            throw std::invalid_argument("Buffer must be C-contiguous.");
+        }
+        expected_stride *= info.shape[dim];
+    }
+}
+
+// Encodes a bitmap as PNG, converting one row at a time to straight RGBA.
+static bool encode_png(const lunasvg::Bitmap &bitmap, const PngOptions &options, const PngStreamEncoder::Sink &sink)
+{
+    if (bitmap.isNull())
+    {
+        return false;
+    }
+    PhaseTimer timer(StatsPhase::PngEncode);
+    PngStreamEncoder encoder(sink, bitmap.width(), bitmap.height(), options);
+    const auto convert_row = convert_row_function(PixelFormat::RGBA);
+    std::vector<uint8_t> row(static_cast<size_t>(bitmap.width()) * 4);
+    for (int y = 0; y < bitmap.height(); ++y)
+    {
+        convert_row(bitmap.data() + static_cast<size_t>(y) * bitmap.stride(), row.data(), bitmap.width(), 0);
+        if (!encoder.write_row(row.data()))
+        {
+            return false;
+        }
+    }
+    return encoder.finish();
+}
+
+static bool encode_png(const lunasvg::Bitmap &bitmap, std::vector<uint8_t> &png_data, const PngOptions &options = PngOptions())
+{
+    return encode_png(bitmap, options, [&png_data](const uint8_t *data, size_t size)
+                      {
+        png_data.insert(png_data.end(), data, data + size);
+        return true; });
+}
+
+// Encodes bitmaps as PNG in parallel on the worker pool.
+static void encode_pngs(const std::vector<lunasvg::Bitmap> &bitmaps, std::vector<std::vector<uint8_t>> &png_data, size_t threads)
+{
+    png_data.resize(bitmaps.size());
+    WorkerPool::instance().parallel_for(bitmaps.size(), threads, [&](size_t index)
+                                        {
+        if (!encode_png(bitmaps[index], png_data[index]))
+        {
+            throw std::runtime_error("Failed to encode bitmap as PNG data at index " + std::to_string(index) + ".");
+        } });
+}
+
+// Packs PNG images into an ICO file, which Windows Vista and later read
+// natively. Sizes above 256 cannot be stored.
+static std::vector<uint8_t> pack_ico(const std::vector<lunasvg::Bitmap> &images, const std::vector<std::vector<uint8_t>> &png_data)
+{
+    std::vector<uint8_t> ico;
+    const auto put16 = [&ico](uint32_t value)
+    {
+        ico.push_back(static_cast<uint8_t>(value));
+        ico.push_back(static_cast<uint8_t>(value >> 8));
+    };
+    const auto put32 = [&put16](uint32_t value)
+    {
+        put16(value & 0xFFFF);
+        put16(value >> 16);
+    };
+
+    put16(0); // Reserved
+    put16(1); // Icon
+    put16(static_cast<uint32_t>(images.size()));
+    size_t offset = 6 + 16 * images.size();
+    for (size_t index = 0; index < images.size(); ++index)
+    {
+        // A zero byte means 256 pixels.
+        ico.push_back(static_cast<uint8_t>(images[index].width() & 0xFF));
+        ico.push_back(static_cast<uint8_t>(images[index].height() & 0xFF));
+        ico.push_back(0); // No palette
+        ico.push_back(0); // Reserved
+        put16(1);         // Color planes
+        put16(32);        // Bits per pixel
+        put32(static_cast<uint32_t>(png_data[index].size()));
+        put32(static_cast<uint32_t>(offset));
+        offset += png_data[index].size();
+    }
+    for (const auto &png : png_data)
+    {
+        ico.insert(ico.end(), png.begin(), png.end());
+    }
+    return ico;
+}
+
+// Encodes a bitmap into a Python file-like object. Encoding runs without
+// the GIL; output is collected into blocks that are handed to write() with
+// the GIL held.
+static bool encode_png_to_file_object(const lunasvg::Bitmap &bitmap, const PngOptions &options, const py::object &file)
+{
+    constexpr size_t BlockSize = 1 << 16;
+    py::object write = file.attr("write");
+    std::vector<uint8_t> block;
+    auto flush = [&write, &block]()
+    {
+        py::gil_scoped_acquire gil;
+        size_t offset = 0;
+        while (offset < block.size())
+        {
+            py::object written = write(py::bytes(reinterpret_cast<const char *>(block.data() + offset), block.size() - offset));
+            if (!py::isinstance<py::int_>(written))
+            {
+                break;
+            }
+            // Raw streams may accept fewer bytes than offered.
+            const auto count = written.cast<size_t>();
+            if (count == 0)
+            {
+                throw std::runtime_error("Failed to write PNG data: write() returned 0.");
+            }
+            offset += count;
+        }
+        block.clear();
+        return true;
+    };
+
+    py::gil_scoped_release release;
+    block.reserve(BlockSize);
+    const bool success = encode_png(bitmap, options, [&block, &flush](const uint8_t *data, size_t size)
+                                    {
+        block.insert(block.end(), data, data + size);
+        return block.size() < BlockSize || flush(); });
+    return success && flush();
+}
+
+// Requests a writable view of an output buffer that can hold `size` bytes.
+static py::buffer_info request_output_buffer(const py::object &out, size_t size)
+{
+    if (!PyObject_CheckBuffer(out.ptr()))
+    {
+        throw py::type_error("Output must support the buffer protocol.");
+    }
+    py::buffer_info info = py::reinterpret_borrow<py::buffer>(out).request(true);
+    check_integer_buffer(info);
+    if (static_cast<size_t>(info.size * info.itemsize) < size)
+    {
+        throw std::runtime_error("Buffer is not long enough");
+    }
+    return info;
+}
+
+// Requests a writable view of a caller-supplied pixel buffer and checks that
+// it can back a width x height ARGB32 bitmap with the given stride.
+static py::buffer_info request_pixel_buffer(const py::buffer &data, int width, int height, int stride)
+{
+    if (width <= 0 || height <= 0)
+    {
+        throw std::invalid_argument("Width and height must be positive.");
+    }
+    if (stride < static_cast<std::int64_t>(width) * 4 || stride % 4 != 0)
+    {
+        throw std::invalid_argument("Stride must be a multiple of 4 and at least width * 4.");
+    }
+    if (static_cast<std::int64_t>(height) * stride > std::numeric_limits<int>::max())
+    {
+        throw std::invalid_argument("Bitmap is too large.");
+    }
+
+    py::buffer_info info = data.request(true);
+    check_integer_buffer(info);
+    if (reinterpret_cast<std::uintptr_t>(info.ptr) % 4 != 0)
+    {
+        throw std::invalid_argument("Buffer must be aligned to 4 bytes.");
+    }
+    const auto required = static_cast<std::int64_t>(height - 1) * stride + static_cast<std::int64_t>(width) * 4;
+    if (static_cast<std::int64_t>(info.size) * info.itemsize < required)
+    {
+        throw std::runtime_error("Buffer is not long enough");
+    }
+    return info;
+}
+
+struct PyBitmap
+{
+private:
+    std::shared_ptr<lunasvg::Bitmap> bitmap;
+    LiveCounter live{Stats::instance().live_bitmaps};
+
+public:
+    PyBitmap(const std::shared_ptr<lunasvg::Bitmap> &bmp) : bitmap(bmp) {}
+    PyBitmap(int width, int height)
+        : bitmap(std::make_shared<lunasvg::Bitmap>(width, height))
+    {
+        if (bitmap->isNull())
+        {
+            throw std::runtime_error("Failed to create bitmap: out of memory");
+        }
+        Stats::instance().add_bitmap(*bitmap);
+    }
+
+    static PyBitmap create_for_data(py::buffer data, int width, int height, int stride)
+    {
+        std::unique_ptr<py::buffer_info> view(new py::buffer_info(request_pixel_buffer(data, width, height, stride)));
+        auto bitmap = std::make_unique<lunasvg::Bitmap>(static_cast<uint8_t *>(view->ptr), width, height, stride);
+        if (bitmap->isNull())
+        {
+            throw std::runtime_error("Failed to create bitmap from data");
+        }
+
+        // The buffer view pins the exporting object (and keeps resizable
+        // exporters such as bytearray from reallocating) until the last
+        // reference to the bitmap goes away, possibly on a worker thread.
+        auto *exporter = view.release();
+        return PyBitmap(std::shared_ptr<lunasvg::Bitmap>(bitmap.release(), [exporter](lunasvg::Bitmap *bitmap)
+                                                         {
+            delete bitmap;
+            if (python_finalizing())
+            {
+                return; // The view is leaked rather than released.
+            }
+            py::gil_scoped_acquire gil;
+            delete exporter; }));
+    }
+
+    std::shared_ptr<lunasvg::Bitmap> get_bitmap() const { return bitmap; }
+
+    py::object __repr__(void)
+    {
+        return py::str("<Bitmap width=" + std::to_string(bitmap->width()) + " height=" + std::to_string(bitmap->height()) + ">");
+    }
+
+    py::object get_data(void) const
+    {
+        if (!bitmap)
+        {
+            throw std::runtime_error("Bitmap is null.");
+        }
+        const auto row_size = static_cast<size_t>(bitmap->width()) * 4;
+        const auto stride = static_cast<size_t>(bitmap->stride());
+        if (stride == row_size)
+        {
+            return py::bytes(reinterpret_cast<const char *>(bitmap->data()), row_size * bitmap->height());
+        }
+        // Padded rows: pack them without the padding into a fresh bytes object.
+        py::bytes result(py::reinterpret_steal<py::bytes>(PyBytes_FromStringAndSize(nullptr, row_size * bitmap->height())));
+        if (!result)
+        {
+            throw py::error_already_set();
+        }
+        char *output = PyBytes_AS_STRING(result.ptr());
+        for (int y = 0; y < bitmap->height(); ++y)
+        {
+            std::copy_n(bitmap->data() + y * stride, row_size, output + y * row_size);
+        }
+        return result;
+    }
+
+    // Exposes the pixels as a height x width x 4 uint8 view. The exporting
+    // Python object stays referenced by the view, which in turn keeps the
+    // underlying lunasvg::Bitmap alive for as long as the view exists.
+    py::buffer_info get_buffer_info() const
+    {
+        if (!bitmap)
+        {
+            throw std::runtime_error("Bitmap is null.");
+        }
+        return py::buffer_info(
+            bitmap->data(),
+            sizeof(uint8_t),
+            py::format_descriptor<uint8_t>::format(),
+            3,
+            {static_cast<py::ssize_t>(bitmap->height()), static_cast<py::ssize_t>(bitmap->width()), static_cast<py::ssize_t>(4)},
+            {static_cast<py::ssize_t>(bitmap->stride()), static_cast<py::ssize_t>(4), static_cast<py::ssize_t>(1)});
+    }
+
+    py::int_ get_width(void) const
+    {
+        return bitmap->width();
+    }
+
+    py::int_ get_height(void) const
+    {
+        return bitmap->height();
+    }
+
+    py::int_ get_stride() const
+    {
+        return bitmap->stride();
+    }
+
+    py::object convert_to_rgba(void) const
+    {
+        if (!bitmap)
+        {
+            throw std::runtime_error("Bitmap is null.");
+        }
+        {
+            py::gil_scoped_release release;
+            convert_pixels(bitmap->data(), bitmap->stride(), bitmap->data(), bitmap->stride(), bitmap->width(), bitmap->height(), PixelFormat::RGBA, 0);
+        }
+        return py::none();
+    }
+
+    py::object convert(PixelFormat format, const py::object &out, uint32_t background_color) const
+    {
+        if (!bitmap)
+        {
+            throw std::runtime_error("Bitmap is null.");
+        }
+        const size_t row_size = static_cast<size_t>(bitmap->width()) * pixel_format_size(format);
+        const size_t size = row_size * bitmap->height();
+        py::object result = out;
+        py::buffer_info view;
+        uint8_t *output;
+        if (out.is_none())
+        {
+            result = py::reinterpret_steal<py::object>(PyByteArray_FromStringAndSize(nullptr, static_cast<py::ssize_t>(size)));
+            if (!result)
+            {
+                throw py::error_already_set();
+            }
+            output = reinterpret_cast<uint8_t *>(PyByteArray_AS_STRING(result.ptr()));
+        }
+        else
+        {
+            view = request_output_buffer(out, size);
+            output = static_cast<uint8_t *>(view.ptr);
+        }
+
+        {
+            py::gil_scoped_release release;
+            convert_pixels(bitmap->data(), bitmap->stride(), output, row_size, bitmap->width(), bitmap->height(), format, background_color);
+        }
+        return result;
+    }
+
+    py::object write_to_png(const py::object &target, int level, PngFilter filter) const
+    {
+        if (target.is_none())
+        {
+            throw std::invalid_argument("Filename cannot be None.");
+        }
+        const PngOptions options{level, filter};
+        if (PyByteArray_Check(target.ptr()))
+        {
+            std::vector<uint8_t> png_data;
+            bool success;
+            {
+                py::gil_scoped_release release;
+                success = encode_png(*bitmap, png_data, options);
+            }
+            if (!success)
+            {
+                throw std::runtime_error("Failed to encode bitmap as PNG data.");
+            }
+            const auto offset = PyByteArray_GET_SIZE(target.ptr());
+            if (PyByteArray_Resize(target.ptr(), offset + static_cast<py::ssize_t>(png_data.size())) != 0)
+            {
+                throw py::error_already_set();
+            }
+            std::copy(png_data.begin(), png_data.end(), PyByteArray_AS_STRING(target.ptr()) + offset);
+            return py::none();
+        }
+        if (py::hasattr(target, "write"))
+        {
+            if (!encode_png_to_file_object(*bitmap, options, target))
+            {
+                throw std::runtime_error("Failed to encode bitmap as PNG data.");
+            }
+            return py::none();
+        }
+
+        std::string filename = py::str(target).cast<std::string>();
+        bool success = false;
+        {
+            py::gil_scoped_release release;
+            std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(open_file(filename, "wb"), std::fclose);
+            if (file)
+            {
+                success = encode_png(*bitmap, options, [&file](const uint8_t *data, size_t size)
+                                     { return std::fwrite(data, 1, size, file.get()) == size; }) &&
+                          std::fflush(file.get()) == 0;
+            }
+        }
+        if (!success)
+        {
+            throw std::runtime_error("Failed to write PNG file: " + filename);
+        }
+        return py::none();
+    }
+
+    py::object write_to_png_data(int level, PngFilter filter) const
+    {
+        std::vector<uint8_t> png_data;
+        bool success;
+        {
+            py::gil_scoped_release release;
+            success = encode_png(*bitmap, png_data, PngOptions{level, filter});
+        }
+        if (!success)
+        {
+            throw std::runtime_error("Failed to encode bitmap as PNG data.");
+        }
+
+        return py::bytes(reinterpret_cast<const char *>(png_data.data()), png_data.size());
+    }
+
+    py::object clear(uint32_t color = 0)
+    {
+        bitmap->clear(color);
+        return py::none();
+    }
+};
+
+// Rows of float32 values produced by the batch APIs, exported through the
+// buffer protocol as a rows x columns array (numpy.asarray() wraps it
+// without copying).
+struct PyFloatArray
+{
+private:
+    std::vector<float> values;
+    size_t rows;
+    size_t columns;
+
+public:
+    PyFloatArray(size_t rows, size_t columns) : values(rows * columns), rows(rows), columns(columns) {}
+
+    float *data() { return values.data(); }
+    size_t get_rows() const { return rows; }
+    size_t get_columns() const { return columns; }
+
+    py::object __repr__(void) const
+    {
+        return py::str("<FloatArray rows=" + std::to_string(rows) + " columns=" + std::to_string(columns) + ">");
+    }
+
+    py::ssize_t __len__() const
+    {
+        return static_cast<py::ssize_t>(rows);
+    }
+
+    py::tuple __getitem__(py::ssize_t index) const
+    {
+        if (index < 0)
+        {
+            index += static_cast<py::ssize_t>(rows);
+        }
+        if (index < 0 || index >= static_cast<py::ssize_t>(rows))
+        {
+            throw py::index_error("FloatArray index out of range");
+        }
+        py::tuple row(columns);
+        for (size_t column = 0; column < columns; ++column)
+        {
+            row[column] = py::float_(values[static_cast<size_t>(index) * columns + column]);
+        }
+        return row;
+    }
+
+    py::tuple get_shape() const
+    {
+        return py::make_tuple(rows, columns);
+    }
+
+    py::list tolist() const
+    {
+        py::list result;
+        for (size_t row = 0; row < rows; ++row)
+        {
+            result.append(__getitem__(static_cast<py::ssize_t>(row)));
+        }
+        return result;
+    }
+
+    py::buffer_info get_buffer_info()
+    {
+        return py::buffer_info(
+            values.data(),
+            sizeof(float),
+            py::format_descriptor<float>::format(),
+            2,
+            {static_cast<py::ssize_t>(rows), static_cast<py::ssize_t>(columns)},
+            {static_cast<py::ssize_t>(columns * sizeof(float)), static_cast<py::ssize_t>(sizeof(float))});
+    }
+};
+
+// A C-contiguous float32 or float64 buffer viewed as rows of `columns`
+// values.
+struct FloatRows
+{
+    py::buffer_info info;
+    size_t rows;
+    size_t columns;
+    bool doubles;
+
+    template <typename T>
+    T *row(size_t index) const
+    {
+        return static_cast<T *>(info.ptr) + index * columns;
+    }
+};
+
+static FloatRows request_float_rows(const py::object &object, size_t columns, bool writable)
+{
+    if (!PyObject_CheckBuffer(object.ptr()))
+    {
+        throw py::type_error("Argument must support the buffer protocol.");
+    }
+    FloatRows rows{py::reinterpret_borrow<py::buffer>(object).request(writable), 0, columns, false};
+    const auto &info = rows.info;
+    std::string format = info.format;
+    if (!format.empty() && std::strchr("@=<", format[0]))
+    {
+        format.erase(0, 1);
+    }
+    if (!(info.itemsize == 4 && format == "f") && !(info.itemsize == 8 && format == "d"))
+    {
+        throw py::type_error("Buffer must contain float32 or float64 values.");
+    }
+    rows.doubles = info.itemsize == 8;
+    py::ssize_t expected_stride = info.itemsize;
+    for (py::ssize_t dim = info.ndim - 1; dim >= 0; --dim)
+    {
+        if (info.shape[dim] != 1 && info.strides[dim] != expected_stride)
+        {
+            throw std::invalid_argument("Buffer must be C-contiguous.");
+        }
+        expected_stride *= info.shape[dim];
+    }
+    if (info.size % static_cast<py::ssize_t>(columns) != 0)
+    {
+        throw std::invalid_argument("Buffer size must be a multiple of " + std::to_string(columns) + ".");
+    }
+    rows.rows = static_cast<size_t>(info.size) / columns;
+    return rows;
+}
+
+template <typename T, typename Fn>
+static void map_rows(const FloatRows &source, const FloatRows &target, PyFloatArray *array, size_t columns, Fn &fn)
+{
+    T src[4];
+    T dst[4];
+    for (size_t index = 0; index < source.rows; ++index)
+    {
+        for (size_t column = 0; column < columns; ++column)
+        {
+            src[column] = source.doubles ? static_cast<T>(source.row<double>(index)[column]) : static_cast<T>(source.row<float>(index)[column]);
+        }
+        fn(src, dst);
+        if (array)
+        {
+            std::transform(dst, dst + columns, array->data() + index * columns, [](T value)
+                           { return static_cast<float>(value); });
+        }
+        else if (target.doubles)
+        {
+            std::copy_n(dst, columns, target.row<double>(index));
+        }
+        else
+        {
+            std::transform(dst, dst + columns, target.row<float>(index), [](T value)
+                           { return static_cast<float>(value); });
+        }
+    }
+}
+
+// Applies `fn(src, dst)` to every row of `input`, writing `columns` values
+// per row to `out` (a float32 or float64 buffer with as many values) or to
+// a new FloatArray. `fn` takes float rows, or double rows when either side
+// is float64 so that large coordinates keep their precision. The loop runs
+// without the GIL.
+template <typename Fn>
+static py::object map_float_rows(const py::object &input, const py::object &out, size_t columns, Fn fn)
+{
+    const FloatRows source = request_float_rows(input, columns, false);
+    py::object result = out;
+    PyFloatArray *array = nullptr;
+    FloatRows target{};
+    if (out.is_none())
+    {
+        result = py::cast(PyFloatArray(source.rows, columns));
+        array = result.cast<PyFloatArray *>();
+    }
+    else
+    {
+        target = request_float_rows(out, columns, true);
+        if (target.rows != source.rows)
+        {
+            throw std::invalid_argument("Output must have as many rows as the input.");
+        }
+    }
+
+    py::gil_scoped_release release;
+    if (source.doubles || target.doubles)
+    {
+        map_rows<double>(source, target, array, columns, fn);
+    }
+    else
+    {
+        map_rows<float>(source, target, array, columns, fn);
+    }
+    return result;
+}
+
+// Bounding box of a transformed box, as lunasvg::Box::transformed computes
+// it, in the precision of T.
+template <typename T>
+static void transform_box(const lunasvg::Matrix &m, const T *src, T *dst)
+{
+    const T xs[4] = {src[0], src[0] + src[2], src[0], src[0] + src[2]};
+    const T ys[4] = {src[1], src[1], src[1] + src[3], src[1] + src[3]};
+    T left = std::numeric_limits<T>::max();
+    T top = std::numeric_limits<T>::max();
+    T right = std::numeric_limits<T>::lowest();
+    T bottom = std::numeric_limits<T>::lowest();
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        const T x = xs[corner] * m.a + ys[corner] * m.c + m.e;
+        const T y = xs[corner] * m.b + ys[corner] * m.d + m.f;
+        left = std::min(left, x);
+        top = std::min(top, y);
+        right = std::max(right, x);
+        bottom = std::max(bottom, y);
+    }
+    dst[0] = left;
+    dst[1] = top;
+    dst[2] = right - left;
+    dst[3] = bottom - top;
+}
+
+struct PyMatrix
+{
+private:
+    lunasvg::Matrix matrix;
+
+public:
+    PyMatrix() = default;
+    PyMatrix(float a, float b, float c, float d, float e, float f)
+        : matrix(a, b, c, d, e, f) {}
+    PyMatrix(const lunasvg::Matrix &m) : matrix(m) {}
+
+    py::object __repr__(void)
+    {
+        return py::str("<Matrix [" + std::to_string(matrix.a) + " " + std::to_string(matrix.b) + " " + std::to_string(matrix.c) + " " + std::to_string(matrix.d) + " " + std::to_string(matrix.e) + " " + std::to_string(matrix.f) + "]>");
+    }
+
+    PyMatrix multiply(const PyMatrix &other)
+    {
+        lunasvg::Matrix result(matrix);
+        result.multiply(other.matrix);
+        return PyMatrix(result);
+    }
+
+    PyMatrix translate(float tx, float ty)
+    {
+        lunasvg::Matrix result(matrix);
+        result.translate(tx, ty);
+        return PyMatrix(result);
+    }
+
+    PyMatrix scale(float sx, float sy)
+    {
+        lunasvg::Matrix result(matrix);
+        result.scale(sx, sy);
+        return PyMatrix(result);
+    }
+
+    PyMatrix rotate(float angle, float cx = 0.0f, float cy = 0.0f)
+    {
+        lunasvg::Matrix result(matrix);
+        result.rotate(angle, cx, cy);
+        return PyMatrix(result);
+    }
+
+    PyMatrix shear(float shx, float shy)
+    {
+        lunasvg::Matrix result(matrix);
+        result.shear(shx, shy);
+        return PyMatrix(result);
+    }
+
+    PyMatrix invert()
+    {
+        lunasvg::Matrix result(matrix);
+        result.invert();
+        return PyMatrix(result);
+    }
+
+    PyMatrix inverse() const
+    {
+        return PyMatrix(matrix.inverse());
+    }
+
+    void reset()
+    {
+        matrix.reset();
+    }
+
+    static PyMatrix translated(float tx, float ty)
+    {
+        return PyMatrix(lunasvg::Matrix::translated(tx, ty));
+    }
+
+    static PyMatrix scaled(float sx, float sy)
+    {
+        return PyMatrix(lunasvg::Matrix::scaled(sx, sy));
+    }
+
+    static PyMatrix rotated(float angle, float cx = 0.0f, float cy = 0.0f)
+    {
+        return PyMatrix(lunasvg::Matrix::rotated(angle, cx, cy));
+    }
+
+    static PyMatrix sheared(float shx, float shy)
+    {
+        return PyMatrix(lunasvg::Matrix::sheared(shx, shy));
+    }
+
+    // Multiplies the matrices in order, the same as chaining `*`.
+    static PyMatrix compose(const py::iterable &matrices)
+    {
+        lunasvg::Matrix result;
+        for (auto item : matrices)
+        {
+            result = result * item.cast<PyMatrix>().matrix;
+        }
+        return PyMatrix(result);
+    }
+
+    py::object map_points(const py::object &points, const py::object &out) const
+    {
+        const lunasvg::Matrix m = matrix;
+        return map_float_rows(points, out, 2, [&m](const auto *src, auto *dst)
+                              {
+            dst[0] = src[0] * m.a + src[1] * m.c + m.e;
+            dst[1] = src[0] * m.b + src[1] * m.d + m.f; });
+    }
+
+    py::object map_boxes(const py::object &boxes, const py::object &out) const
+    {
+        const lunasvg::Matrix m = matrix;
+        return map_float_rows(boxes, out, 4, [&m](const auto *src, auto *dst)
+                              { transform_box(m, src, dst); });
+    }
+
+    float get_a() const { return matrix.a; }
+    float get_b() const { return matrix.b; }
+    float get_c() const { return matrix.c; }
+    float get_d() const { return matrix.d; }
+    float get_e() const { return matrix.e; }
+    float get_f() const { return matrix.f; }
+
+    void set_a(float value) { matrix.a = value; }
+    void set_b(float value) { matrix.b = value; }
+    void set_c(float value) { matrix.c = value; }
+    void set_d(float value) { matrix.d = value; }
+    void set_e(float value) { matrix.e = value; }
+    void set_f(float value) { matrix.f = value; }
+
+    const lunasvg::Matrix &get_matrix() const { return matrix; }
+
+    PyMatrix operator*(const PyMatrix &other) const
+    {
+        return PyMatrix(matrix * other.matrix);
+    }
+
+    PyMatrix &operator*=(const PyMatrix &other)
+    {
+        matrix *= other.matrix;
+        return *this;
+    }
+
+    PyMatrix operator~() const
+    {
+        return inverse();
+    }
+
+    py::ssize_t __len__() const
+    {
+        return 6;
+    }
+
+    py::float_ __getitem__(py::ssize_t index) const
+    {
+        switch (index)
+        {
+        case 0:
+            return matrix.a;
+        case 1:
+            return matrix.b;
+        case 2:
+            return matrix.c;
+        case 3:
+            return matrix.d;
+        case 4:
+            return matrix.e;
+        case 5:
+            return matrix.f;
+        default:
+            throw py::index_error("Matrix index out of range");
+        }
+    }
+};
+
+struct PyBox
+{
+private:
+    lunasvg::Box box;
+
+public:
+    PyBox() = default;
+    PyBox(float x, float y, float w, float h) : box(x, y, w, h) {}
+    PyBox(const lunasvg::Box &b) : box(b) {}
+
+    py::object __repr__(void)
+    {
+        return py::str("<Box [x=" + std::to_string(box.x) + ", y=" + std::to_string(box.y) + ", width=" + std::to_string(box.w) + ", height=" + std::to_string(box.h) + "]>");
+    }
+
+    PyBox transform(const PyMatrix &matrix)
+    {
+        lunasvg::Box result(box);
+        result.transform(matrix.get_matrix());
+        return PyBox(result);
+    }
+
+    PyBox transformed(const PyMatrix &matrix) const
+    {
+        return PyBox(box.transformed(matrix.get_matrix()));
+    }
+
+    float get_x() const { return box.x; }
+    float get_y() const { return box.y; }
+    float get_w() const { return box.w; }
+    float get_h() const { return box.h; }
+
+    void set_x(float value) { box.x = value; }
+    void set_y(float value) { box.y = value; }
+    void set_w(float value) { box.w = value; }
+    void set_h(float value) { box.h = value; }
+
+    const lunasvg::Box &get_box() const { return box; }
+
+    py::ssize_t __len__() const
+    {
+        return 4;
+    }
+
+    py::float_ __getitem__(py::ssize_t index) const
+    {
+        switch (index)
+        {
+        case 0:
+            return box.x;
+        case 1:
+            return box.y;
+        case 2:
+            return box.w;
+        case 3:
+            return box.h;
+        default:
+            throw py::index_error("Box index out of range");
+        }
+    }
+};
+
+// Device-space pixel rectangle [x0, x1) x [y0, y1).
+struct DamageRect
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Records which parts of a document changed since the last
+// Document.render_damaged() call. Tracking starts with the first such call,
+// so documents that are only ever fully rendered pay nothing for it. Every
+// access happens under the document mutex.
+class DamageTracker
+{
+public:
+    // Called before `element` is mutated: its current painted box is the
+    // area the old geometry covered. The new box is read once, at render
+    // time. Before the first frame nothing is looked up.
+    void record(const lunasvg::Element &element)
+    {
+        if (!enabled || full)
+        {
+            return;
+        }
+        if (std::find(elements.begin(), elements.end(), element) != elements.end())
+        {
+            return;
+        }
+        // An element without geometry of its own (a gradient stop, <defs>
+        // or <symbol> content) changes what other elements paint.
+        lunasvg::Box box;
+        if (elements.size() >= MaxElements || !painted_box(element, box) || (box.w <= 0.f && box.h <= 0.f))
+        {
+            invalidate();
+            return;
+        }
+        boxes.push_back(box);
+        elements.push_back(element);
+    }
+
+    void invalidate()
+    {
+        full = true;
+        boxes.clear();
+        elements.clear();
+    }
+
+    // Returns the non-overlapping rectangles of `target` that must be
+    // repainted for a render with `matrix`, and starts a new frame. The
+    // whole target is damaged on the first call and whenever the target or
+    // the matrix differ from the previous frame.
+    std::vector<DamageRect> collect(lunasvg::Document &document, const lunasvg::Bitmap &target, const lunasvg::Matrix &matrix, float margin)
+    {
+        const bool same_frame = enabled && target.data() == last_data && target.width() == last_width && target.height() == last_height && target.stride() == last_stride && matrix.a == last_matrix.a && matrix.b == last_matrix.b && matrix.c == last_matrix.c && matrix.d == last_matrix.d && matrix.e == last_matrix.e && matrix.f == last_matrix.f;
+        if (same_frame && !full)
+        {
+            {
+                PhaseTimer timer(StatsPhase::Layout);
+                document.updateLayout();
+            }
+            for (const auto &element : elements)
+            {
+                lunasvg::Box box;
+                if (!painted_box(element, box))
+                {
+                    full = true;
+                    break;
+                }
+                boxes.push_back(box);
+            }
+        }
+        std::vector<DamageRect> rects;
+        if (full || !same_frame)
+        {
+            rects.push_back({0, 0, target.width(), target.height()});
+        }
+        else
+        {
+            for (const auto &box : boxes)
+            {
+                if (box.w <= 0.f && box.h <= 0.f)
+                {
+                    continue;
+                }
+                const auto device = box.transformed(matrix);
+                DamageRect rect;
+                rect.x0 = std::max(0, static_cast<int>(std::floor(device.x - margin)));
+                rect.y0 = std::max(0, static_cast<int>(std::floor(device.y - margin)));
+                rect.x1 = std::min(target.width(), static_cast<int>(std::ceil(device.x + device.w + margin)));
+                rect.y1 = std::min(target.height(), static_cast<int>(std::ceil(device.y + device.h + margin)));
+                if (rect.x0 < rect.x1 && rect.y0 < rect.y1)
+                {
+                    rects.push_back(rect);
+                }
+            }
+            merge(rects);
+        }
+
+        enabled = true;
+        full = false;
+        boxes.clear();
+        elements.clear();
+        find_use_targets(document);
+        last_data = target.data();
+        last_width = target.width();
+        last_height = target.height();
+        last_stride = target.stride();
+        last_matrix = matrix;
+        return rects;
+    }
+
+private:
+    static constexpr size_t MaxElements = 256;
+    static constexpr size_t MaxRects = 16;
+
+    // Parses a number in user units, optionally followed by "px".
+    static bool parse_user_length(const std::string &value, double &number)
+    {
+        const char *begin = value.c_str();
+        char *end = nullptr;
+        number = std::strtod(begin, &end);
+        if (end == begin || !std::isfinite(number))
+        {
+            return false;
+        }
+        std::string_view rest(end);
+        while (!rest.empty() && std::isspace(static_cast<unsigned char>(rest.back())))
+        {
+            rest.remove_suffix(1);
+        }
+        return rest.empty() || rest == "px";
+    }
+
+    // Remembers the ids that <use> elements refer to, since changing such an
+    // element also changes every place it is instantiated.
+    void find_use_targets(const lunasvg::Document &document)
+    {
+        use_targets.clear();
+        for (const auto &use : document.querySelectorAll("use"))
+        {
+            const std::string &href = use.hasAttribute("href") ? use.getAttribute("href") : use.getAttribute("xlink:href");
+            if (href.size() > 1 && href[0] == '#')
+            {
+                use_targets.insert(href.substr(1));
+            }
+        }
+    }
+
+    // The inherited properties that make an element paint outside its
+    // bounding box.
+    struct OutlineStyle
+    {
+        static constexpr size_t Count = 6;
+        static constexpr size_t FirstMarker = 3;
+        static constexpr std::array<const char *, Count> Names = {"stroke", "stroke-width", "stroke-miterlimit", "marker-start", "marker-mid", "marker-end"};
+        std::array<std::string, Count> values;
+
+        void inherit(const lunasvg::Element &element)
+        {
+            for (size_t index = 0; index < Count; ++index)
+            {
+                const std::string &value = element.getAttribute(Names[index]);
+                if (!value.empty() && value != "inherit")
+                {
+                    values[index] = value;
+                }
+            }
+        }
+    };
+
+    bool is_use_target(const lunasvg::Element &element) const
+    {
+        return !use_targets.empty() && use_targets.count(element.getAttribute("id"));
+    }
+
+    // Adds how far the strokes of `element` and its descendants reach past
+    // their fill, in document units, to `extent`. Fails when one of them
+    // has markers or a stroke width that is not a plain number.
+    static bool outline_extent(const lunasvg::Element &element, OutlineStyle style, double &extent)
+    {
+        style.inherit(element);
+        for (size_t index = OutlineStyle::FirstMarker; index < OutlineStyle::Count; ++index)
+        {
+            if (!style.values[index].empty() && style.values[index] != "none")
+            {
+                return false;
+            }
+        }
+        if (!style.values[0].empty() && style.values[0] != "none")
+        {
+            double width = 1.0;
+            double miter = 4.0;
+            if ((!style.values[1].empty() && !parse_user_length(style.values[1], width)) || (!style.values[2].empty() && !parse_user_length(style.values[2], miter)))
+            {
+                return false;
+            }
+            // Miter joins reach furthest from the outline, up to miter
+            // limit half widths; square caps reach sqrt(2) half widths.
+            const lunasvg::Matrix matrix = element.getGlobalMatrix();
+            const double scale = std::max(std::hypot(matrix.a, matrix.b), std::hypot(matrix.c, matrix.d));
+            extent = std::max(extent, std::abs(width) / 2.0 * std::max(miter, std::sqrt(2.0)) * scale);
+        }
+        for (const auto &child : element.children())
+        {
+            if (child.isElement() && !outline_extent(child.toElement(), style, extent))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Computes the area `element` paints in document space: its global
+    // bounding box, which covers the fill only, grown by the strokes of the
+    // element and its descendants. The box is empty for an element without
+    // geometry. Fails for elements that also paint elsewhere: those inside
+    // a <use> target, and those outline_extent() cannot bound.
+    bool painted_box(const lunasvg::Element &element, lunasvg::Box &box) const
+    {
+        box = element.getGlobalBoundingBox();
+        if (box.w <= 0.f && box.h <= 0.f)
+        {
+            return true;
+        }
+        std::vector<lunasvg::Element> ancestors;
+        for (auto node = element.parentElement(); !node.isNull(); node = node.parentElement())
+        {
+            ancestors.push_back(node);
+        }
+        OutlineStyle style;
+        for (auto ancestor = ancestors.rbegin(); ancestor != ancestors.rend(); ++ancestor)
+        {
+            if (is_use_target(*ancestor))
+            {
+                return false;
+            }
+            style.inherit(*ancestor);
+        }
+        double extent = 0.0;
+        if (is_use_target(element) || !outline_extent(element, style, extent))
+        {
+            return false;
+        }
+        const float grow = static_cast<float>(extent);
+        box = lunasvg::Box(box.x - grow, box.y - grow, box.w + 2.f * grow, box.h + 2.f * grow);
+        return true;
+    }
+
+    // Merges overlapping rectangles until none overlap, so they can be
+    // repainted independently; falls back to their union when too many
+    // separate rectangles remain.
+    static void merge(std::vector<DamageRect> &rects)
+    {
+        bool merged = true;
+        while (merged)
+        {
+            merged = false;
+            for (size_t i = 0; i < rects.size() && !merged; ++i)
+            {
+                for (size_t j = i + 1; j < rects.size(); ++j)
+                {
+                    auto &a = rects[i];
+                    const auto &b = rects[j];
+                    if (a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1)
+                    {
+                        a = {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+                        rects.erase(rects.begin() + j);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+        if (rects.size() > MaxRects)
+        {
+            DamageRect bounds = rects.front();
+            for (const auto &rect : rects)
+            {
+                bounds = {std::min(bounds.x0, rect.x0), std::min(bounds.y0, rect.y0), std::max(bounds.x1, rect.x1), std::max(bounds.y1, rect.y1)};
+            }
+            rects.assign(1, bounds);
+        }
+    }
+
+    bool enabled = false;
+    bool full = true;
+    std::vector<lunasvg::Box> boxes;
+    std::vector<lunasvg::Element> elements;
+    std::unordered_set<std::string> use_targets; // Ids referenced by <use> elements
+    const uint8_t *last_data = nullptr;
+    int last_width = 0;
+    int last_height = 0;
+    int last_stride = 0;
+    lunasvg::Matrix last_matrix;
+};
+
+// lunasvg::Element is a handle around a single node pointer and only
+// exposes equality; its bytes serve as a key for ordered lookups.
+static std::uintptr_t element_key(const lunasvg::Element &element)
+{
+    static_assert(sizeof(lunasvg::Element) == sizeof(std::uintptr_t), "lunasvg::Element is expected to wrap a single node pointer");
+    std::uintptr_t key;
+    std::memcpy(&key, &element, sizeof(key));
+    return key;
+}
+
+// Child indices leading from the document element to `element`. Two parses
+// of the same source produce the same tree, so a path found in one document
+// addresses the matching element of the other.
+static std::vector<size_t> element_path(const lunasvg::Element &element)
+{
+    std::vector<size_t> path;
+    lunasvg::Element current = element;
+    for (auto parent = current.parentElement(); !parent.isNull(); parent = current.parentElement())
+    {
+        const auto children = parent.children();
+        const auto position = std::find(children.begin(), children.end(), current);
+        path.push_back(static_cast<size_t>(std::distance(children.begin(), position)));
+        current = parent;
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+static lunasvg::Element element_at_path(const lunasvg::Document &document, const std::vector<size_t> &path)
+{
+    lunasvg::Element element = document.documentElement();
+    for (size_t index : path)
+    {
+        const auto children = element.children();
+        if (index >= children.size())
+        {
+            return lunasvg::Element();
+        }
+        const auto &child = *std::next(children.begin(), static_cast<std::ptrdiff_t>(index));
+        if (!child.isElement())
+        {
+            return lunasvg::Element();
+        }
+        element = child.toElement();
+    }
+    return element;
+}
+
+// Changes made to a document since it was parsed: the latest value of every
+// attribute set through the binding, with the value it had before, and the
+// style sheets applied in order. Document.clone() replays it onto a fresh
+// parse; documents from the template cache are rolled back with it before
+// they are reused. Attributes are only tracked for documents loaded to be
+// cloned or cached; other journals merely note that an attribute changed,
+// which keeps set_attribute cheap, and can then no longer be replayed.
+// Accessed under the document mutex.
+class MutationJournal
+{
+public:
+    explicit MutationJournal(bool track_attributes = true)
+        : track_attributes(track_attributes) {}
+
+    bool tracks_attributes() const { return track_attributes; }
+
+    void record_attribute(const lunasvg::Element &element, const std::string &name, const std::string &value)
+    {
+        if (!track_attributes)
+        {
+            untracked = true;
+            reversible = false;
+            return;
+        }
+        auto key = std::make_pair(element_key(element), name);
+        auto found = index.find(key);
+        if (found != index.end())
+        {
+            attributes[found->second].value = value;
+            return;
+        }
+        const bool existed = element.hasAttribute(name);
+        index.emplace(std::move(key), attributes.size());
+        attributes.push_back({element, name, value, existed ? element.getAttribute(name) : std::string()});
+        reversible = reversible && existed;
+    }
+
+    void record_style_sheet(const std::string &content)
+    {
+        style_sheets.push_back(content);
+        reversible = false;
+    }
+
+    // Applies the recorded changes to `target`, a fresh parse of the source
+    // this journal's document was parsed from, recording them in `journal`.
+    void replay(lunasvg::Document &target, MutationJournal &journal) const
+    {
+        if (untracked)
+        {
+            throw std::runtime_error("Document cannot be cloned: its attributes were changed, but it was not loaded with cloneable=True.");
+        }
+        for (const auto &style_sheet : style_sheets)
+        {
+            journal.record_style_sheet(style_sheet);
+            target.applyStyleSheet(style_sheet);
+        }
+        if (attributes.empty())
+        {
+            return;
+        }
+        const auto matches = match_elements(target);
+        for (const auto &attribute : attributes)
+        {
+            auto element = matches.at(element_key(attribute.element));
+            journal.record_attribute(element, attribute.name, attribute.value);
+            element.setAttribute(attribute.name, attribute.value);
+        }
+    }
+
+    // Restores every recorded attribute. Fails when a change cannot be
+    // undone: an attribute that did not exist before, or a style sheet.
+    bool undo()
+    {
+        if (!reversible)
+        {
+            return false;
+        }
+        for (auto attribute = attributes.rbegin(); attribute != attributes.rend(); ++attribute)
+        {
+            attribute->element.setAttribute(attribute->name, attribute->old_value);
+        }
+        attributes.clear();
+        index.clear();
+        return true;
+    }
+
+private:
+    struct Attribute
+    {
+        lunasvg::Element element;
+        std::string name;
+        std::string value;
+        std::string old_value;
+    };
+
+    // Maps the key of every recorded element to the matching element of
+    // `target`. Both trees are walked once, only down the branches that lead
+    // to recorded elements, so changes share the walk instead of each
+    // searching its own path.
+    std::unordered_map<std::uintptr_t, lunasvg::Element> match_elements(const lunasvg::Document &target) const
+    {
+        std::unordered_set<std::uintptr_t> branches;
+        lunasvg::Element root;
+        for (const auto &attribute : attributes)
+        {
+            for (auto node = attribute.element; !node.isNull() && branches.insert(element_key(node)).second; node = node.parentElement())
+            {
+                root = node;
+            }
+        }
+        std::unordered_map<std::uintptr_t, lunasvg::Element> matches;
+        std::vector<std::pair<lunasvg::Element, lunasvg::Element>> pending{{root, target.documentElement()}};
+        while (!pending.empty())
+        {
+            const auto pair = pending.back();
+            pending.pop_back();
+            matches.emplace(element_key(pair.first), pair.second);
+            const auto children = pair.first.children();
+            const auto copies = pair.second.children();
+            if (children.size() != copies.size())
+            {
+                throw std::runtime_error("Failed to clone document: element not found.");
+            }
+            for (auto child = children.begin(), copy = copies.begin(); child != children.end(); ++child, ++copy)
+            {
+                if (child->isElement() && branches.count(element_key(child->toElement())))
+                {
+                    if (!copy->isElement())
+                    {
+                        throw std::runtime_error("Failed to clone document: element not found.");
+                    }
+                    pending.emplace_back(child->toElement(), copy->toElement());
+                }
+            }
+        }
+        if (matches.size() != branches.size())
+        {
+            throw std::runtime_error("Failed to clone document: element not found.");
+        }
+        return matches;
+    }
+
+    std::vector<Attribute> attributes;
+    std::map<std::pair<std::uintptr_t, std::string>, size_t> index;
+    std::vector<std::string> style_sheets;
+    bool track_attributes;
+    bool untracked = false; // An attribute changed without being tracked
+    bool reversible = true;
+};
+
+// Keyframed values of one attribute for Document.render_frames(). Two
+// values that differ only in their numbers, such as "translate(10, 20)" and
+// "translate(30, 40)", are interpolated number by number; hex colors are
+// interpolated as rgb(). Other values switch at the next keyframe.
+class AttributeTrack
+{
+public:
+    AttributeTrack(std::string name, std::vector<std::pair<double, std::string>> values)
+        : attribute(std::move(name))
+    {
+        std::stable_sort(values.begin(), values.end(), [](const auto &a, const auto &b)
+                         { return a.first < b.first; });
+        for (auto &value : values)
+        {
+            Keyframe keyframe;
+            keyframe.time = value.first;
+            keyframe.value = std::move(value.second);
+            tokenize(keyframe);
+            keyframes.push_back(std::move(keyframe));
+        }
+    }
+
+    const std::string &name() const { return attribute; }
+    double end_time() const { return keyframes.empty() ? 0.0 : keyframes.back().time; }
+
+    std::string value_at(double time) const
+    {
+        if (time <= keyframes.front().time)
+        {
+            return keyframes.front().value;
+        }
+        if (time >= keyframes.back().time)
+        {
+            return keyframes.back().value;
+        }
+        const auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](double t, const Keyframe &keyframe)
+                                           { return t < keyframe.time; });
+        const Keyframe &to = *next;
+        const Keyframe &from = *std::prev(next);
+        if (time == from.time || from.shape != to.shape)
+        {
+            return from.value;
+        }
+        const double t = (time - from.time) / (to.time - from.time);
+        std::string result = from.text[0];
+        for (size_t index = 0; index < from.numbers.size(); ++index)
+        {
+            result += format_number(from.numbers[index] + (to.numbers[index] - from.numbers[index]) * t);
+            result += from.text[index + 1];
+        }
+        return result;
+    }
+
+private:
+    // A value is text[0] number[0] text[1] ... number[n - 1] text[n]. The
+    // shape is the text without separators, so "10,20" matches "10 20".
+    struct Keyframe
+    {
+        double time;
+        std::string value;
+        std::vector<std::string> text;
+        std::vector<double> numbers;
+        std::string shape;
+    };
+
+    static void finish_shape(Keyframe &keyframe)
+    {
+        for (const auto &text : keyframe.text)
+        {
+            for (char ch : text)
+            {
+                if (ch != ',' && !std::isspace(static_cast<unsigned char>(ch)))
+                {
+                    keyframe.shape += ch;
+                }
+            }
+            keyframe.shape += '\0';
+        }
+    }
+
+    static bool is_hex_color(const std::string &value, size_t start, size_t &end)
+    {
+        end = start + 1;
+        while (end < value.size() && std::isxdigit(static_cast<unsigned char>(value[end])))
+        {
+            ++end;
+        }
+        const size_t digits = end - start - 1;
+        return digits == 3 || digits == 6;
+    }
+
+    static void tokenize(Keyframe &keyframe)
+    {
+        const std::string &value = keyframe.value;
+        std::string text;
+        size_t index = 0;
+        while (index < value.size() && std::isspace(static_cast<unsigned char>(value[index])))
+        {
+            text += value[index++];
+        }
+        size_t end;
+        if (index < value.size() && value[index] == '#' && is_hex_color(value, index, end) && value.find_first_not_of(" \t\r\n", end) == std::string::npos)
+        {
+            const bool short_form = end - index == 4;
+            keyframe.text.push_back(text + "rgb(");
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                const std::string digits = short_form ? std::string(2, value[index + 1 + channel]) : value.substr(index + 1 + channel * 2, 2);
+                keyframe.numbers.push_back(static_cast<double>(std::stoi(digits, nullptr, 16)));
+                keyframe.text.push_back(channel < 2 ? "," : ")");
+            }
+            finish_shape(keyframe);
+            return;
+        }
+
+        const auto digit = [&value](size_t at)
+        { return at < value.size() && std::isdigit(static_cast<unsigned char>(value[at])); };
+        while (index < value.size())
+        {
+            const char ch = value[index];
+            if (ch == '#')
+            {
+                // A fragment reference such as url(#shape2) is plain text.
+                text += value[index++];
+                while (index < value.size() && (std::isalnum(static_cast<unsigned char>(value[index])) || value[index] == '-' || value[index] == '_'))
+                {
+                    text += value[index++];
+                }
+                continue;
+            }
+            size_t end = index;
+            if (value[end] == '+' || value[end] == '-')
+            {
+                ++end;
+            }
+            const bool number = digit(end) || (end < value.size() && value[end] == '.' && digit(end + 1));
+            if (!number)
+            {
+                text += value[index++];
+                continue;
+            }
+            while (digit(end))
+            {
+                ++end;
+            }
+            if (end < value.size() && value[end] == '.' && digit(end + 1))
+            {
+                ++end;
+                while (digit(end))
+                {
+                    ++end;
+                }
+            }
+            if (end < value.size() && (value[end] == 'e' || value[end] == 'E'))
+            {
+                size_t exponent = end + 1;
+                if (exponent < value.size() && (value[exponent] == '+' || value[exponent] == '-'))
+                {
+                    ++exponent;
+                }
+                if (digit(exponent))
+                {
+                    end = exponent;
+                    while (digit(end))
+                    {
+                        ++end;
+                    }
+                }
+            }
+            keyframe.text.push_back(std::move(text));
+            keyframe.numbers.push_back(std::strtod(value.substr(index, end - index).c_str(), nullptr));
+            text.clear();
+            index = end;
+        }
+        keyframe.text.push_back(std::move(text));
+        finish_shape(keyframe);
+    }
+
+    static std::string format_number(double number)
+    {
+        char buffer[64];
+        if (std::fabs(number) < 1e15 && number == std::floor(number))
+        {
+            std::snprintf(buffer, sizeof(buffer), "%.0f", number + 0.0);
+            return buffer;
+        }
+        std::snprintf(buffer, sizeof(buffer), "%.6f", number);
+        std::string result = buffer;
+        result.erase(result.find_last_not_of('0') + 1);
+        if (result.back() == '.')
+        {
+            result.pop_back();
+        }
+        return result;
+    }
+
+    std::string attribute;
+    std::vector<Keyframe> keyframes;
+};
+
+static std::unique_ptr<lunasvg::Document> parse_document(const SourceData &data)
+{
+    PhaseTimer timer(StatsPhase::Parse);
+    std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+    return lunasvg::Document::loadFromData(data.data(), data.size());
+}
+
+// Process-wide LRU cache of SVG templates used by Document.load_cached().
+// Each entry keeps the source text and a few parsed spare documents. A
+// cached document that is dropped has its attribute changes rolled back and
+// becomes a spare again, so a template that is loaded, customized and
+// rendered over and over is parsed only about once per concurrent user.
+class TemplateCache
+{
+public:
+    struct Info
+    {
+        size_t hits;
+        size_t misses;
+        size_t entries;
+        size_t spares;
+        size_t bytes;
+        size_t max_bytes;
+        size_t max_spares;
+    };
+
+    static TemplateCache &instance()
+    {
+        // Intentionally leaked: cached documents may be dropped during exit.
+        static TemplateCache *cache = new TemplateCache();
+        return *cache;
+    }
+
+    // Returns a spare document parsed from `source`, or null when one has
+    // to be parsed. `source` is replaced by the cached source with the same
+    // content, or cached itself when there is none.
+    std::unique_ptr<lunasvg::Document> acquire(DocumentSource &source)
+    {
+        // Sources may hold Python objects whose release takes the GIL, so
+        // nothing is destroyed while the cache is locked.
+        std::list<Entry> evicted;
+        DocumentSource replaced;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(source->view());
+        if (found == index.end())
+        {
+            ++misses;
+            entries.push_front({source, {}});
+            index.emplace(source->view(), entries.begin());
+            bytes += source->size();
+            evict(evicted);
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, found->second);
+        Entry &entry = *found->second;
+        replaced = std::move(source);
+        source = entry.source;
+        if (entry.spares.empty())
+        {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        auto document = std::move(entry.spares.back());
+        entry.spares.pop_back();
+        bytes -= source->size();
+        return document;
+    }
+
+    // Takes back a document that was rolled back to its parsed state. A
+    // rejected document is destroyed with the parameter, after unlocking.
+    void release(const DocumentSource &source, std::unique_ptr<lunasvg::Document> document)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(source->view());
+        if (found == index.end() || found->second->spares.size() >= max_spares || bytes + source->size() > max_bytes)
+        {
+            return;
+        }
+        found->second->spares.push_back(std::move(document));
+        bytes += source->size();
+    }
+
+    Info info()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t spares = 0;
+        for (const auto &entry : entries)
+        {
+            spares += entry.spares.size();
+        }
+        return {hits, misses, entries.size(), spares, bytes, max_bytes, max_spares};
+    }
+
+    void set_limits(size_t new_max_bytes, size_t new_max_spares)
+    {
+        std::list<Entry> evicted;
+        std::vector<std::unique_ptr<lunasvg::Document>> dropped;
+        std::lock_guard<std::mutex> lock(mutex);
+        max_bytes = new_max_bytes;
+        max_spares = new_max_spares;
+        for (auto &entry : entries)
+        {
+            while (entry.spares.size() > max_spares)
+            {
+                dropped.push_back(std::move(entry.spares.back()));
+                entry.spares.pop_back();
+                bytes -= entry.source->size();
+            }
+        }
+        evict(evicted);
+    }
+
+    void clear()
+    {
+        std::list<Entry> removed;
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        removed.swap(entries);
+        bytes = 0;
+        hits = 0;
+        misses = 0;
+    }
+
+private:
+    struct Entry
+    {
+        DocumentSource source;
+        std::vector<std::unique_ptr<lunasvg::Document>> spares;
+    };
+
+    // Moves least recently used entries to `evicted` until the byte limit
+    // holds; the caller destroys them after unlocking.
+    void evict(std::list<Entry> &evicted)
+    {
+        while (bytes > max_bytes && !entries.empty())
+        {
+            Entry &entry = entries.back();
+            bytes -= entry.source->size() * (1 + entry.spares.size());
+            index.erase(entry.source->view());
+            evicted.splice(evicted.begin(), entries, std::prev(entries.end()));
+        }
+    }
+
+    std::mutex mutex;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+    size_t max_bytes = 64 * 1024 * 1024;
+    size_t max_spares = 8;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+// Element children of `element`, skipping text nodes.
+static lunasvg::ElementList child_elements(const lunasvg::Element &element)
+{
+    lunasvg::ElementList elements;
+    for (const auto &child : element.children())
+    {
+        if (child.isElement())
+        {
+            elements.push_back(child.toElement());
+        }
+    }
+    return elements;
+}
+
+// Element names lunasvg keeps in its tree; anything else is dropped while
+// parsing. lunasvg does not expose an element's name, so Element.tag_name is
+// answered from an index built by querying each of these as a type selector.
+static const char *const svg_tag_names[] = {
+    "a", "circle", "clipPath", "defs", "ellipse", "g", "image", "line",
+    "linearGradient", "marker", "mask", "path", "pattern", "polygon", "polyline",
+    "radialGradient", "rect", "stop", "style", "svg", "symbol", "text", "tspan", "use"};
+
+static bool is_tag_name(const std::string &name)
+{
+    if (name.empty())
+    {
+        return false;
+    }
+    for (char ch : name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '-' && ch != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A style sheet compiled once by StyleSheet.compile() and then shared,
+// read-only, by every document it is applied to. lunasvg only accepts CSS
+// text, so compiling strips comments and whitespace and indexes every rule
+// by the tag, ID and classes its selectors require of the element they
+// select. Applying the sheet passes lunasvg only the rules that can match
+// something in the document.
+class CompiledStyleSheet
+{
+public:
+    explicit CompiledStyleSheet(std::string_view css)
+    {
+        const std::string text = strip_comments(css);
+        size_t pos = 0;
+        while (true)
+        {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+            {
+                ++pos;
+            }
+            if (pos >= text.size())
+            {
+                break;
+            }
+            Rule rule;
+            if (text[pos] == '@')
+            {
+                // At-rules are kept as they are, along with their blocks.
+                const size_t end = skip_block(text, pos, true);
+                rule.text = minify(text.substr(pos, end - pos), Syntax::AtRule);
+                rule.always = true;
+                pos = end;
+            }
+            else
+            {
+                const size_t open = find_outside_strings(text, pos, '{');
+                if (open == std::string::npos)
+                {
+                    break;
+                }
+                const size_t end = skip_block(text, open, false);
+                const std::string selectors = minify(text.substr(pos, open - pos), Syntax::Selector);
+                std::string block = minify(text.substr(open, end - open), Syntax::Block);
+                pos = end;
+                if (block.size() >= 2 && block[block.size() - 2] == ';')
+                {
+                    block.erase(block.size() - 2, 1);
+                }
+                if (selectors.empty() || block == "{}")
+                {
+                    continue;
+                }
+                rule.text = selectors + block;
+                rule.always = !analyze(selectors, rule.selectors);
+            }
+            if (!rule.text.empty())
+            {
+                for (const auto &selector : rule.selectors)
+                {
+                    if (!selector.tag.empty())
+                    {
+                        tags.insert(selector.tag);
+                    }
+                    attributes = attributes || !selector.id.empty() || !selector.classes.empty();
+                }
+                minified += rule.text;
+                rules.push_back(std::move(rule));
+            }
+        }
+    }
+
+    const std::string &text() const { return minified; }
+    size_t rule_count() const { return rules.size(); }
+
+    // The rules that may match an element of `document`, in order.
+    std::string relevant_text(const lunasvg::Document &document) const
+    {
+        std::unordered_set<std::string> present_tags;
+        for (const auto &tag : tags)
+        {
+            if (!document.querySelectorAll(tag).empty())
+            {
+                present_tags.insert(tag);
+            }
+        }
+        std::unordered_set<std::string> ids;
+        std::unordered_set<std::string> classes;
+        if (attributes)
+        {
+            for (const auto &element : document.querySelectorAll("*"))
+            {
+                if (element.hasAttribute("id"))
+                {
+                    ids.insert(element.getAttribute("id"));
+                }
+                if (element.hasAttribute("class"))
+                {
+                    const std::string &names = element.getAttribute("class");
+                    size_t start = 0;
+                    while ((start = names.find_first_not_of(" \t\r\n", start)) != std::string::npos)
+                    {
+                        const size_t end = std::min(names.find_first_of(" \t\r\n", start), names.size());
+                        classes.insert(names.substr(start, end - start));
+                        start = end;
+                    }
+                }
+            }
+        }
+
+        std::string result;
+        for (const auto &rule : rules)
+        {
+            const bool relevant = rule.always || std::any_of(rule.selectors.begin(), rule.selectors.end(), [&](const Selector &selector)
+                                                             { return (selector.tag.empty() || present_tags.count(selector.tag)) && (selector.id.empty() || ids.count(selector.id)) &&
+                                                                      std::all_of(selector.classes.begin(), selector.classes.end(), [&](const std::string &name)
+                                                                                  { return classes.count(name) != 0; }); });
+            if (relevant)
+            {
+                result += rule.text;
+            }
+        }
+        return result;
+    }
+
+    // Returns `source` with the sheet added as the last <style> element of
+    // the root, so lunasvg's parser cascades it together with the
+    // document's own styles. Returns null when the end of the root element
+    // cannot be found, such as for a self-closing root.
+    DocumentSource attach(const SourceData &source) const
+    {
+        const std::string_view text = source.view();
+        size_t end = text.size();
+        while (true)
+        {
+            while (end > 0 && std::isspace(static_cast<unsigned char>(text[end - 1])))
+            {
+                --end;
+            }
+            if (end >= 3 && text.substr(end - 3, 3) == "-->")
+            {
+                const size_t comment = text.rfind("<!--", end - 3);
+                if (comment == std::string_view::npos)
+                {
+                    return nullptr;
+                }
+                end = comment;
+                continue;
+            }
+            break;
+        }
+        const size_t close = end > 0 && text[end - 1] == '>' ? text.rfind("</", end - 1) : std::string_view::npos;
+        if (close == std::string_view::npos)
+        {
+            return nullptr;
+        }
+        std::string_view name = text.substr(close + 2, end - 1 - (close + 2));
+        while (!name.empty() && std::isspace(static_cast<unsigned char>(name.back())))
+        {
+            name.remove_suffix(1);
+        }
+        const size_t colon = name.rfind(':');
+        if ((colon == std::string_view::npos ? name : name.substr(colon + 1)) != "svg")
+        {
+            return nullptr;
+        }
+
+        std::string styled;
+        styled.reserve(text.size() + minified.size() + 32);
+        styled.append(text.substr(0, close));
+        if (minified.find_first_of("<&") == std::string::npos)
+        {
+            styled += "<style>" + minified + "</style>";
+        }
+        else
+        {
+            std::string escaped = minified;
+            for (size_t at = 0; (at = escaped.find("]]>", at)) != std::string::npos; at += 15)
+            {
+                escaped.replace(at, 3, "]]]]><![CDATA[>");
+            }
+            styled += "<style><![CDATA[" + escaped + "]]></style>";
+        }
+        styled.append(text.substr(close));
+        return std::make_shared<StringSource>(std::move(styled));
+    }
+
+private:
+    // What an element must have to be selected: the type, ID and classes
+    // of the selector's last compound. Anything else is ignored, which can
+    // only keep a rule that does not match.
+    struct Selector
+    {
+        std::string tag;
+        std::string id;
+        std::vector<std::string> classes;
+    };
+
+    struct Rule
+    {
+        std::string text;
+        bool always = false;
+        std::vector<Selector> selectors;
+    };
+
+    static size_t skip_string(const std::string &text, size_t pos)
+    {
+        const char quote = text[pos++];
+        while (pos < text.size() && text[pos] != quote)
+        {
+            pos += text[pos] == '\\' ? 2 : 1;
+        }
+        return std::min(pos + 1, text.size());
+    }
+
+    static std::string strip_comments(std::string_view css)
+    {
+        const std::string source(css);
+        std::string text;
+        text.reserve(source.size());
+        for (size_t pos = 0; pos < source.size();)
+        {
+            if (source[pos] == '"' || source[pos] == '\'')
+            {
+                const size_t end = skip_string(source, pos);
+                text.append(source, pos, end - pos);
+                pos = end;
+            }
+            else if (source.compare(pos, 2, "/*") == 0)
+            {
+                const size_t end = source.find("*/", pos + 2);
+                pos = end == std::string::npos ? source.size() : end + 2;
+                text += ' ';
+            }
+            else
+            {
+                text += source[pos++];
+            }
+        }
+        return text;
+    }
+
+    static size_t find_outside_strings(const std::string &text, size_t pos, char target)
+    {
+        while (pos < text.size())
+        {
+            if (text[pos] == '"' || text[pos] == '\'')
+            {
+                pos = skip_string(text, pos);
+            }
+            else if (text[pos] == target)
+            {
+                return pos;
+            }
+            else
+            {
+                ++pos;
+            }
+        }
+        return std::string::npos;
+    }
+
+    // Returns the end of the block that starts at or after `pos`, or of the
+    // statement when `statement` is set and a ';' comes before any block.
+    static size_t skip_block(const std::string &text, size_t pos, bool statement)
+    {
+        int depth = 0;
+        while (pos < text.size())
+        {
+            const char ch = text[pos];
+            if (ch == '"' || ch == '\'')
+            {
+                pos = skip_string(text, pos);
+                continue;
+            }
+            ++pos;
+            if (ch == '{')
+            {
+                ++depth;
+            }
+            else if (ch == '}' && --depth <= 0)
+            {
+                return pos;
+            }
+            else if (ch == ';' && depth == 0 && statement)
+            {
+                return pos;
+            }
+        }
+        return pos;
+    }
+
+    enum class Syntax
+    {
+        Selector,
+        Block,
+        AtRule
+    };
+
+    // Collapses whitespace and drops it where it carries no meaning: around
+    // braces, ';' and ',', around ':' in declarations and around the '>',
+    // '+' and '~' combinators in selectors. At-rules, which may nest either,
+    // only have their whitespace collapsed.
+    static std::string minify(const std::string &text, Syntax syntax)
+    {
+        const auto tight = [syntax](char ch)
+        {
+            switch (syntax)
+            {
+            case Syntax::Selector:
+                return ch == ',' || ch == '>' || ch == '+' || ch == '~';
+            case Syntax::Block:
+                return ch == '{' || ch == '}' || ch == ';' || ch == ',' || ch == ':';
+            default:
+                return false;
+            }
+        };
+        std::string result;
+        bool space = false;
+        for (size_t pos = 0; pos < text.size();)
+        {
+            const char ch = text[pos];
+            if (std::isspace(static_cast<unsigned char>(ch)))
+            {
+                space = true;
+                ++pos;
+                continue;
+            }
+            if (space && !result.empty() && !tight(result.back()) && !tight(ch))
+            {
+                result += ' ';
+            }
+            space = false;
+            if (ch == '"' || ch == '\'')
+            {
+                const size_t end = skip_string(text, pos);
+                result.append(text, pos, end - pos);
+                pos = end;
+            }
+            else
+            {
+                result += ch;
+                ++pos;
+            }
+        }
+        return result;
+    }
+
+    static bool is_name_char(char ch)
+    {
+        return std::isalnum(static_cast<unsigned char>(ch)) || ch == '-' || ch == '_' || static_cast<unsigned char>(ch) >= 0x80;
+    }
+
+    // Fills `selectors` from a minified selector list. Returns false when
+    // the list uses syntax that is not analyzed (escapes, namespaces).
+    static bool analyze(const std::string &list, std::vector<Selector> &selectors)
+    {
+        if (list.find_first_of("\\|") != std::string::npos)
+        {
+            return false;
+        }
+        int depth = 0;
+        size_t start = 0;
+        for (size_t pos = 0; pos <= list.size(); ++pos)
+        {
+            const char ch = pos < list.size() ? list[pos] : ',';
+            if (ch == '"' || ch == '\'')
+            {
+                pos = skip_string(list, pos) - 1;
+            }
+            else if (ch == '(' || ch == '[')
+            {
+                ++depth;
+            }
+            else if (ch == ')' || ch == ']')
+            {
+                --depth;
+            }
+            else if (ch == ',' && depth == 0)
+            {
+                selectors.push_back(analyze_compound(last_compound(list.substr(start, pos - start))));
+                start = pos + 1;
+            }
+        }
+        return true;
+    }
+
+    static std::string last_compound(const std::string &selector)
+    {
+        int depth = 0;
+        for (size_t pos = selector.size(); pos > 0; --pos)
+        {
+            const char ch = selector[pos - 1];
+            if (ch == ')' || ch == ']')
+            {
+                ++depth;
+            }
+            else if (ch == '(' || ch == '[')
+            {
+                --depth;
+            }
+            else if (depth == 0 && (ch == ' ' || ch == '>' || ch == '+' || ch == '~'))
+            {
+                return selector.substr(pos);
+            }
+        }
+        return selector;
+    }
+
+    static Selector analyze_compound(const std::string &compound)
+    {
+        Selector selector;
+        size_t pos = 0;
+        const auto name = [&compound, &pos]()
+        {
+            const size_t start = pos;
+            while (pos < compound.size() && is_name_char(compound[pos]))
+            {
+                ++pos;
+            }
+            return compound.substr(start, pos - start);
+        };
+        if (pos < compound.size() && is_name_char(compound[pos]))
+        {
+            selector.tag = name();
+        }
+        while (pos < compound.size())
+        {
+            const char ch = compound[pos++];
+            if (ch == '#')
+            {
+                selector.id = name();
+            }
+            else if (ch == '.')
+            {
+                selector.classes.push_back(name());
+            }
+            else if (ch == '[' || ch == '(')
+            {
+                int depth = 1;
+                while (pos < compound.size() && depth > 0)
+                {
+                    if (compound[pos] == '"' || compound[pos] == '\'')
+                    {
+                        pos = skip_string(compound, pos);
+                        continue;
+                    }
+                    depth += compound[pos] == '[' || compound[pos] == '(' ? 1 : compound[pos] == ']' || compound[pos] == ')' ? -1 : 0;
+                    ++pos;
+                }
+            }
+        }
+        return selector;
+    }
+
+    std::vector<Rule> rules;
+    std::string minified;
+    std::unordered_set<std::string> tags; // Type selectors used by the rules
+    bool attributes = false;              // Whether any rule needs an ID or class
+};
+
+struct PyStyleSheet
+{
+    std::shared_ptr<const CompiledStyleSheet> sheet;
+
+    static PyStyleSheet compile(const py::object &pycss)
+    {
+        if (!py::isinstance<py::str>(pycss))
+        {
+            throw py::type_error("CSS must be a string.");
+        }
+        const std::string css = pycss.cast<std::string>();
+        py::gil_scoped_release release;
+        return PyStyleSheet{std::make_shared<const CompiledStyleSheet>(css)};
+    }
+
+    size_t get_rule_count() const { return sheet->rule_count(); }
+    py::str get_css() const { return py::str(sheet->text()); }
+
+    py::str __repr__() const
+    {
+        return py::str("<StyleSheet rules=" + std::to_string(sheet->rule_count()) + ">");
+    }
+};
+
+// The compiled sheet behind a StyleSheet or CSS string, or null for None.
+static std::shared_ptr<const CompiledStyleSheet> style_sheet_from_object(const py::object &pysheet)
+{
+    if (pysheet.is_none())
+    {
+        return nullptr;
+    }
+    if (py::isinstance<PyStyleSheet>(pysheet))
+    {
+        return pysheet.cast<PyStyleSheet>().sheet;
+    }
+    return PyStyleSheet::compile(pysheet).sheet;
+}
+
+// Global bounding boxes of a document's painted elements, bucketed into a
+// uniform grid of about one element per cell. Elements are kept in document
+// order, which is paint order, so the last match at a point is the topmost.
+// It is a snapshot: changes made to the document after build() are not
+// seen. Accessed under the document mutex.
+class HitIndex
+{
+public:
+    void build(lunasvg::Document &document)
+    {
+        {
+            PhaseTimer timer(StatsPhase::Layout);
+            document.updateLayout();
+        }
+        std::unordered_set<std::uintptr_t> hidden;
+        for (const auto &element : document.querySelectorAll("clipPath *, defs *, marker *, mask *, pattern *, symbol *"))
+        {
+            hidden.insert(element_key(element));
+        }
+        elements.clear();
+        boxes.clear();
+        for (const auto &element : document.querySelectorAll("circle, ellipse, image, line, path, polygon, polyline, rect, text, use"))
+        {
+            if (hidden.count(element_key(element)))
+            {
+                continue;
+            }
+            const auto box = element.getGlobalBoundingBox();
+            if (box.w <= 0.f && box.h <= 0.f)
+            {
+                continue;
+            }
+            elements.push_back(element);
+            boxes.push_back(box);
+        }
+
+        float x0 = 0.f, y0 = 0.f, x1 = 0.f, y1 = 0.f;
+        for (size_t index = 0; index < boxes.size(); ++index)
+        {
+            const auto &box = boxes[index];
+            x0 = index == 0 ? box.x : std::min(x0, box.x);
+            y0 = index == 0 ? box.y : std::min(y0, box.y);
+            x1 = index == 0 ? box.x + box.w : std::max(x1, box.x + box.w);
+            y1 = index == 0 ? box.y + box.h : std::max(y1, box.y + box.h);
+        }
+        const int size = std::clamp(static_cast<int>(std::ceil(std::sqrt(static_cast<double>(boxes.size())))), 1, MaxGridSize);
+        columns = rows = size;
+        origin_x = x0;
+        origin_y = y0;
+        cell_width = std::max((x1 - x0) / columns, 1e-6f);
+        cell_height = std::max((y1 - y0) / rows, 1e-6f);
+
+        // Compressed cell lists: the items of cell i are
+        // cell_items[cell_start[i] .. cell_start[i + 1]), in document order.
+        cell_start.assign(static_cast<size_t>(columns) * rows + 1, 0);
+        for_each_cell_span(boxes, [&](size_t, size_t cell)
+                           { ++cell_start[cell + 1]; });
+        for (size_t cell = 1; cell < cell_start.size(); ++cell)
+        {
+            cell_start[cell] += cell_start[cell - 1];
+        }
+        cell_items.resize(cell_start.back());
+        std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+        for_each_cell_span(boxes, [&](size_t index, size_t cell)
+                           { cell_items[fill[cell]++] = static_cast<uint32_t>(index); });
+    }
+
+    size_t size() const { return elements.size(); }
+    const lunasvg::Element &element(size_t index) const { return elements[index]; }
+
+    // Topmost element whose box contains (x, y) and that `accept` agrees
+    // with, or -1.
+    template <typename Fn>
+    std::ptrdiff_t hit_test(float x, float y, Fn accept) const
+    {
+        if (elements.empty())
+        {
+            return -1;
+        }
+        const int column = cell_column(x);
+        const int row = cell_row(y);
+        if (column < 0 || row < 0)
+        {
+            return -1;
+        }
+        const size_t cell = static_cast<size_t>(row) * columns + column;
+        for (size_t item = cell_start[cell + 1]; item-- > cell_start[cell];)
+        {
+            const auto index = cell_items[item];
+            const auto &box = boxes[index];
+            if (x >= box.x && x <= box.x + box.w && y >= box.y && y <= box.y + box.h && accept(elements[index]))
+            {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    // Indices of the elements whose box intersects `rect`, in document order.
+    std::vector<uint32_t> query(const lunasvg::Box &rect) const
+    {
+        std::vector<uint32_t> result;
+        if (elements.empty())
+        {
+            return result;
+        }
+        const float x1 = rect.x + rect.w;
+        const float y1 = rect.y + rect.h;
+        const int column0 = clamp_cell((rect.x - origin_x) / cell_width, columns);
+        const int column1 = clamp_cell((x1 - origin_x) / cell_width, columns);
+        const int row0 = clamp_cell((rect.y - origin_y) / cell_height, rows);
+        const int row1 = clamp_cell((y1 - origin_y) / cell_height, rows);
+        for (int row = row0; row <= row1; ++row)
+        {
+            for (int column = column0; column <= column1; ++column)
+            {
+                const size_t cell = static_cast<size_t>(row) * columns + column;
+                for (size_t item = cell_start[cell]; item < cell_start[cell + 1]; ++item)
+                {
+                    const auto index = cell_items[item];
+                    const auto &box = boxes[index];
+                    if (box.x <= x1 && rect.x <= box.x + box.w && box.y <= y1 && rect.y <= box.y + box.h)
+                    {
+                        result.push_back(index);
+                    }
+                }
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+private:
+    static constexpr int MaxGridSize = 256;
+
+    static int clamp_cell(float position, int count)
+    {
+        return static_cast<int>(std::clamp(std::floor(position), 0.f, static_cast<float>(count - 1)));
+    }
+
+    int cell_column(float x) const
+    {
+        const float cell = std::floor((x - origin_x) / cell_width);
+        return cell < 0.f || cell > columns ? -1 : std::min(static_cast<int>(cell), columns - 1);
+    }
+
+    int cell_row(float y) const
+    {
+        const float cell = std::floor((y - origin_y) / cell_height);
+        return cell < 0.f || cell > rows ? -1 : std::min(static_cast<int>(cell), rows - 1);
+    }
+
+    template <typename Fn>
+    void for_each_cell_span(const std::vector<lunasvg::Box> &items, Fn fn) const
+    {
+        for (size_t index = 0; index < items.size(); ++index)
+        {
+            const auto &box = items[index];
+            const int column0 = std::clamp(cell_column(box.x), 0, columns - 1);
+            const int row0 = std::clamp(cell_row(box.y), 0, rows - 1);
+            const int column1 = std::max(cell_column(box.x + box.w), column0);
+            const int row1 = std::max(cell_row(box.y + box.h), row0);
+            for (int row = row0; row <= row1; ++row)
+            {
+                for (int column = column0; column <= column1; ++column)
+                {
+                    fn(index, static_cast<size_t>(row) * columns + column);
+                }
+            }
+        }
+    }
+
+    lunasvg::ElementList elements;
+    std::vector<lunasvg::Box> boxes;
+    float origin_x = 0.f;
+    float origin_y = 0.f;
+    float cell_width = 1.f;
+    float cell_height = 1.f;
+    int columns = 1;
+    int rows = 1;
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> cell_items;
+};
+
+// Whether `element`, painted on its own, covers the pixel centred on
+// document point (x, y). Element::render() applies the element's own
+// transform, so the parent's global matrix places it in document space.
+static bool element_covers(const lunasvg::Element &element, float x, float y)
+{
+    lunasvg::Matrix matrix;
+    auto parent = element.parentElement();
+    if (!parent.isNull())
+    {
+        matrix = parent.getGlobalMatrix();
+    }
+    matrix.e += 0.5f - x;
+    matrix.f += 0.5f - y;
+    lunasvg::Bitmap pixel(1, 1);
+    pixel.clear(0);
+    element.render(pixel, matrix);
+    return pixel.data()[3] != 0;
+}
+
+// Thrown by an asynchronous job that stops early because its call was
+// cancelled or ran past its deadline.
+class AsyncInterrupted : public std::runtime_error
+{
+public:
+    explicit AsyncInterrupted(bool timed_out)
+        : std::runtime_error(timed_out ? "Operation timed out." : "Operation cancelled."), timed_out(timed_out) {}
+
+    const bool timed_out;
+};
+
+// Completion side of an awaitable call: a future of the running asyncio loop
+// that a job on the worker pool finishes through call_soon_threadsafe().
+// Cancelling the future (asyncio.wait_for does on timeout) or passing the
+// deadline makes check() throw, which long jobs call between steps. The
+// Python objects are only touched with the GIL held.
+class AsyncCall
+{
+public:
+    explicit AsyncCall(const py::object &timeout) : cancelled(std::make_shared<std::atomic<bool>>(false))
+    {
+        if (!timeout.is_none())
+        {
+            const double seconds = timeout.cast<double>();
+            if (!(seconds >= 0.0))
+            {
+                throw std::invalid_argument("Timeout must be non-negative.");
+            }
+            deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::min(seconds, 1e9)));
+            has_deadline = true;
+        }
+        loop = py::module_::import("asyncio").attr("get_running_loop")();
+        future = loop.attr("create_future")();
+        auto flag = cancelled;
+        future.attr("add_done_callback")(py::cpp_function([flag](const py::object &done)
+                                                          {
+            if (done.attr("cancelled")().cast<bool>())
+            {
+                flag->store(true);
+            } }));
+    }
+
+    AsyncCall(const AsyncCall &) = delete;
+    AsyncCall &operator=(const AsyncCall &) = delete;
+
+    ~AsyncCall()
+    {
+        if (python_finalizing())
+        {
+            future.release();
+            loop.release();
+            return;
+        }
+        py::gil_scoped_acquire gil;
+        future = py::object();
+        loop = py::object();
+    }
+
+    py::object get_future() const { return future; }
+
+    bool stopped() const
+    {
+        return cancelled->load(std::memory_order_relaxed) || (has_deadline && std::chrono::steady_clock::now() >= deadline);
+    }
+
+    void check() const
+    {
+        if (cancelled->load(std::memory_order_relaxed))
+        {
+            throw AsyncInterrupted(false);
+        }
+        if (has_deadline && std::chrono::steady_clock::now() >= deadline)
+        {
+            throw AsyncInterrupted(true);
+        }
+    }
+
+    // Called on a worker thread without the GIL. Nothing is delivered once
+    // the interpreter is shutting down.
+    void finish(const std::function<py::object()> &make_result)
+    {
+        if (python_finalizing())
+        {
+            return;
+        }
+        py::gil_scoped_acquire gil;
+        py::object result;
+        try
+        {
+            result = make_result();
+        }
+        catch (...)
+        {
+            fail_with_gil(std::current_exception());
+            return;
+        }
+        deliver(result, false);
+    }
+
+    // Called on a worker thread without the GIL.
+    void fail(std::exception_ptr exception)
+    {
+        if (python_finalizing())
+        {
+            return;
+        }
+        py::gil_scoped_acquire gil;
+        fail_with_gil(exception);
+    }
+
+private:
+    void fail_with_gil(std::exception_ptr exception)
+    {
+        py::object error;
+        try
+        {
+            std::rethrow_exception(exception);
+        }
+        catch (const AsyncInterrupted &interrupted)
+        {
+            if (!interrupted.timed_out)
+            {
+                return; // The future is already cancelled.
+            }
+            error = py::reinterpret_borrow<py::object>(PyExc_TimeoutError)(interrupted.what());
+        }
+        catch (py::error_already_set &python_error)
+        {
+            error = python_error.value();
+        }
+        catch (const LimitExceeded &exceeded)
+        {
+            error = py::module_::import("pylunasvg").attr("LimitExceeded")(exceeded.what());
+        }
+        catch (const std::invalid_argument &invalid)
+        {
+            error = py::reinterpret_borrow<py::object>(PyExc_ValueError)(invalid.what());
+        }
+        catch (const std::bad_alloc &)
+        {
+            error = py::reinterpret_borrow<py::object>(PyExc_MemoryError)();
+        }
+        catch (const std::exception &other)
+        {
+            error = py::reinterpret_borrow<py::object>(PyExc_RuntimeError)(other.what());
+        }
+        deliver(error, true);
+    }
+
+    void deliver(const py::object &value, bool error)
+    {
+        auto settle = py::cpp_function([error](const py::object &future, const py::object &value)
+                                       {
+            if (!future.attr("done")().cast<bool>())
+            {
+                future.attr(error ? "set_exception" : "set_result")(value);
+            } });
+        try
+        {
+            loop.attr("call_soon_threadsafe")(settle, future, value);
+        }
+        catch (py::error_already_set &)
+        {
+            // The loop is closed, so nobody is waiting for the result.
+        }
+    }
+
+    py::object loop;
+    py::object future;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+    std::chrono::steady_clock::time_point deadline;
+    bool has_deadline = false;
+};
+
+// Runs work(call) on the worker pool and returns the future of the call.
+// `work` runs without the GIL and returns a function that builds the result
+// once the GIL is held again; it must not capture Python objects.
+template <typename Work>
+static py::object run_async(const py::object &timeout, Work work)
+{
+    auto call = std::make_shared<AsyncCall>(timeout);
+    WorkerPool::instance().submit([call, work]()
+                                  {
+        try
+        {
+            call->check();
+            std::function<py::object()> make_result = work(*call);
+            call->finish(make_result);
+        }
+        catch (...)
+        {
+            call->fail(std::current_exception());
+        } });
+    return call->get_future();
+}
+
+// Renders a whole document the way render_document_to_bitmap does, band by
+// band, calling check() before each band so that a long render can be
+// stopped by throwing from it.
+template <typename Check>
+static lunasvg::Bitmap render_document_in_bands(lunasvg::Document &document, int width, int height, uint32_t background_color, Check check)
+{
+    lunasvg::Matrix matrix;
+    if (!resolve_render_size(document, width, height, matrix))
+    {
+        return lunasvg::Bitmap();
+    }
+    lunasvg::Bitmap bitmap(width, height);
+    if (bitmap.isNull())
+    {
+        return bitmap;
+    }
+    Stats::instance().add_bitmap(bitmap);
+    bitmap.clear(background_color);
+    {
+        PhaseTimer timer(StatsPhase::Layout);
+        document.updateLayout();
+    }
+    render_in_bands(document, bitmap, matrix, check);
+    return bitmap;
+}
+
+// Counts the elements of an XML text and tracks their nesting without
+// building a tree, stopping at the first exceeded limit. Markup the scan
+// does not understand can only make it count more, never less.
+static void check_markup_limits(std::string_view text, const PyLimits &limits)
+{
+    size_t elements = 0;
+    size_t depth = 0;
+    size_t pos = 0;
+    auto skip_past = [&](std::string_view end)
+    {
+        const auto found = text.find(end, pos);
+        pos = found == std::string_view::npos ? text.size() : found + end.size();
+    };
+    while ((pos = text.find('<', pos)) != std::string_view::npos && ++pos < text.size())
+    {
+        const char ch = text[pos];
+        if (ch == '/')
+        {
+            depth -= depth > 0;
+            skip_past(">");
+            continue;
+        }
+        if (ch == '?')
+        {
+            skip_past("?>");
+            continue;
+        }
+        if (ch == '!')
+        {
+            if (text.compare(pos, 3, "!--") == 0)
+            {
+                skip_past("-->");
+            }
+            else if (text.compare(pos, 8, "![CDATA[") == 0)
+            {
+                skip_past("]]>");
+            }
+            else
+            {
+                // A DOCTYPE, whose internal subset may contain '>'.
+                int brackets = 0;
+                for (; pos < text.size(); ++pos)
+                {
+                    brackets += (text[pos] == '[') - (text[pos] == ']');
+                    if (text[pos] == '>' && brackets <= 0)
+                    {
+                        ++pos;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        if (limits.max_elements && ++elements > limits.max_elements)
+        {
+            throw LimitExceeded("SVG element limit exceeded.");
+        }
+        char quote = 0;
+        size_t end = pos;
+        for (; end < text.size(); ++end)
+        {
+            const char c = text[end];
+            if (quote)
+            {
+                quote = c == quote ? 0 : quote;
+            }
+            else if (c == '"' || c == '\'')
+            {
+                quote = c;
+            }
+            else if (c == '>')
+            {
+                break;
+            }
+        }
+        const bool self_closing = end < text.size() && text[end - 1] == '/';
+        pos = std::min(end + 1, text.size());
+        if (!self_closing && limits.max_depth && ++depth > limits.max_depth)
+        {
+            throw LimitExceeded("SVG nesting depth limit exceeded.");
+        }
+    }
+}
+
+// Checks the element instances a render would visit once <use> references
+// are expanded. The expanded size of every element is computed once, with
+// an explicit stack so that deep documents cannot overflow the native one;
+// a reference cycle, which lunasvg does not render, counts as empty.
+static void check_use_expansion(const lunasvg::Document &document, size_t limit)
+{
+    std::unordered_set<std::uintptr_t> uses;
+    for (const auto &element : document.querySelectorAll("use"))
+    {
+        uses.insert(element_key(element));
+    }
+    if (uses.empty())
+    {
+        return;
+    }
+    const uint64_t cap = document.querySelectorAll("*").size() + static_cast<uint64_t>(limit) + 1;
+
+    struct Frame
+    {
+        std::uintptr_t key;
+        lunasvg::ElementList children; // Followed by the <use> target, if any
+        size_t next;
+        uint64_t size;
+    };
+    std::unordered_map<std::uintptr_t, uint64_t> sizes;
+    std::unordered_set<std::uintptr_t> active;
+    std::vector<Frame> stack;
+    auto push = [&](const lunasvg::Element &element)
+    {
+        const auto key = element_key(element);
+        auto children = child_elements(element);
+        if (uses.count(key))
+        {
+            std::string href = element.getAttribute("href");
+            if (href.empty())
+            {
+                href = element.getAttribute("xlink:href");
+            }
+            if (href.size() > 1 && href[0] == '#')
+            {
+                auto target = document.getElementById(href.substr(1));
+                if (!target.isNull())
+                {
+                    children.push_back(target);
+                }
+            }
+        }
+        active.insert(key);
+        stack.push_back({key, std::move(children), 0, 1});
+    };
+
+    push(document.documentElement());
+    while (!stack.empty())
+    {
+        auto &frame = stack.back();
+        if (frame.next < frame.children.size())
+        {
+            const auto child = frame.children[frame.next++];
+            const auto key = element_key(child);
+            auto found = sizes.find(key);
+            if (found != sizes.end())
+            {
+                frame.size = std::min(cap, frame.size + found->second);
+            }
+            else if (!active.count(key))
+            {
+                push(child);
+            }
+            continue;
+        }
+        const auto key = frame.key;
+        const auto size = frame.size;
+        if (size >= cap)
+        {
+            throw LimitExceeded("SVG <use> expansion limit exceeded.");
+        }
+        stack.pop_back();
+        active.erase(key);
+        sizes.emplace(key, size);
+        if (!stack.empty())
+        {
+            stack.back().size = std::min(cap, stack.back().size + size);
+        }
+    }
+}
+
+// Parses `data` within `limits`: the size and markup limits are checked
+// before lunasvg allocates anything, the expansion limit on the parsed tree.
+static void check_input_limits(const SourceData &data, const PyLimits &limits)
+{
+    if (limits.max_input_bytes && data.size() > limits.max_input_bytes)
+    {
+        throw LimitExceeded("SVG input size limit exceeded.");
+    }
+    if (limits.max_elements || limits.max_depth)
+    {
+        check_markup_limits(data.view(), limits);
+    }
+}
+
+static std::unique_ptr<lunasvg::Document> parse_document(const SourceData &data, const PyLimits &limits)
+{
+    check_input_limits(data, limits);
+    auto document = parse_document(data);
+    if (document && limits.max_use_expansion)
+    {
+        check_use_expansion(*document, limits.max_use_expansion);
+    }
+    return document;
+}
+
+// Parses `data` within `limits` with `sheet` applied. The sheet is attached
+// to the markup where possible, replacing `data` with the styled source so
+// that clones keep it; otherwise it is applied after parsing and recorded
+// in `journal`. Limits are checked against the original input.
+static std::unique_ptr<lunasvg::Document> parse_document(DocumentSource &data, const PyLimits &limits, const CompiledStyleSheet *sheet, MutationJournal &journal)
+{
+    if (!sheet)
+    {
+        return parse_document(*data, limits);
+    }
+    check_input_limits(*data, limits);
+    std::unique_ptr<lunasvg::Document> document;
+    if (auto styled = sheet->attach(*data))
+    {
+        document = parse_document(*styled);
+        if (document)
+        {
+            data = std::move(styled);
+        }
+    }
+    else
+    {
+        document = parse_document(*data);
+        if (document)
+        {
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            journal.record_style_sheet(sheet->text());
+            PhaseTimer timer(StatsPhase::StyleSheet);
+            document->applyStyleSheet(sheet->text());
+        }
+    }
+    if (document && limits.max_use_expansion)
+    {
+        check_use_expansion(*document, limits.max_use_expansion);
+    }
+    return document;
+}
+
+static void check_output_size(const lunasvg::Document &document, int width, int height, const PyLimits &limits)
+{
+    lunasvg::Matrix matrix;
+    if (limits.max_pixels && resolve_render_size(document, width, height, matrix))
+    {
+        RenderBudget(limits).check_size(width, height);
+    }
+}
+
+// Renders like render_document_to_bitmap within `limits`, band by band. The
+// output size is checked before the bitmap is allocated, and the render
+// stops once its time limit passes. check() is called between bands as well.
+template <typename Check>
+static lunasvg::Bitmap render_document_limited(lunasvg::Document &document, int width, int height, uint32_t background_color, const PyLimits &limits, Check check)
+{
+    check_output_size(document, width, height, limits);
+    const RenderBudget budget(limits);
+    return render_document_in_bands(document, width, height, background_color, [&]()
+                                    {
+        check();
+        budget.check(); });
+}
+
+struct PyDocument;
+
+struct PyElement
+{
+private:
+    std::shared_ptr<lunasvg::Element> element;
+    py::object owner;                           // The owner Document, kept alive by the element
+    std::shared_ptr<std::mutex> document_mutex; // Shared with the owner document
+    std::shared_ptr<DamageTracker> damage;      // Shared with the owner document
+    std::shared_ptr<MutationJournal> journal;   // Shared with the owner document
+
+public:
+    PyElement(std::shared_ptr<lunasvg::Element> elem, py::object owner);
+
+    const lunasvg::Element &get_element() const { return *element; }
+    PyDocument *get_owner_document() const;
+    std::shared_ptr<std::mutex> get_document_mutex() const { return document_mutex; }
+
+    py::object __repr__(void)
+    {
+        return py::str("<Element>");
+    }
+
+    py::object __richcompare__(PyElement *other, int op)
+    {
+        if (op == Py_EQ)
+        {
+            if (*element == *other->element)
+                return py::bool_(true);
+            return py::bool_(false);
+        }
+        else if (op == Py_NE)
+        {
+            if (*element != *other->element)
+                return py::bool_(true);
+            return py::bool_(false);
+        }
+        return py::none();
+    }
+
+    py::bool_ has_attribute(const std::string &name)
+    {
+        auto lock = lock_document(*document_mutex);
+        return py::bool_(element->hasAttribute(name));
+    }
+
+    py::str get_attribute(const std::string &name)
+    {
+        auto lock = lock_document(*document_mutex);
+        return py::str(element->getAttribute(name));
+    }
+
+    py::object set_attribute(const std::string &name, const std::string &value)
+    {
+        auto lock = lock_document(*document_mutex);
+        damage->record(*element);
+        journal->record_attribute(*element, name, value);
+        element->setAttribute(name, value);
+        return py::none();
+    }
+
+    py::object render(PyBitmap &bitmap, py::object pymatrix = py::none());
+    py::object render_to_bitmap(int width = -1, int height = -1, uint32_t background_color = 0);
+
+    PyMatrix get_local_matrix()
+    {
+        auto lock = lock_document(*document_mutex);
+        return PyMatrix(element->getLocalMatrix());
+    }
+
+    PyMatrix get_global_matrix()
+    {
+        auto lock = lock_document(*document_mutex);
+        return PyMatrix(element->getGlobalMatrix());
+    }
+
+    PyBox get_local_bounding_box()
+    {
+        auto lock = lock_document(*document_mutex);
+        return PyBox(element->getLocalBoundingBox());
+    }
+
+    PyBox get_global_bounding_box()
+    {
+        auto lock = lock_document(*document_mutex);
+        return PyBox(element->getGlobalBoundingBox());
+    }
+
+    PyBox get_bounding_box()
+    {
+        auto lock = lock_document(*document_mutex);
+        return PyBox(element->getBoundingBox());
+    }
+
+    py::object parent_element()
+    {
+        auto lock = lock_document(*document_mutex);
+        auto parent = element->parentElement();
+        lock.unlock();
+        if (parent.isNull())
+        {
+            return py::none();
+        }
+        return py::cast(PyElement(std::make_shared<lunasvg::Element>(parent), owner));
+    }
+
+    py::object owner_document()
+    {
+        return owner;
+    }
+
+    py::list children();
+    py::object first_child();
+    py::object next_sibling();
+    py::str tag_name();
+};
+
+// Iterator returned by Document.render_tiles(). Tiles are rendered in batches
+// of `threads` (in parallel on the worker pool) into tile buffers that are
+// reused from batch to batch, so memory use is bounded by the tile size
+// rather than the size of the whole image. The render time limit covers the
+// time spent rendering all batches.
+struct PyTileIterator
+{
+private:
+    struct Tile
+    {
+        int x;
+        int y;
+        std::shared_ptr<lunasvg::Bitmap> bitmap;
+    };
+
+    std::shared_ptr<lunasvg::Document> document;
+    std::shared_ptr<std::mutex> mutex;
+    int width;
+    int height;
+    int tile_size;
+    int columns;
+    size_t tile_count;
+    size_t next_tile = 0;
+    lunasvg::Matrix matrix;
+    uint32_t background_color;
+    size_t threads;
+    bool reuse;
+    PyLimits limits;
+    double render_time = 0.0; // Seconds spent rendering so far
+    std::vector<std::shared_ptr<lunasvg::Bitmap>> buffers;
+    std::deque<Tile> ready;
+
+    void render_batch()
+    {
+        const size_t batch_size = std::min(threads, tile_count - next_tile);
+        std::vector<Tile> batch(batch_size);
+        for (size_t index = 0; index < batch_size; ++index)
+        {
+            const size_t tile = next_tile + index;
+            const int x = static_cast<int>(tile % columns) * tile_size;
+            const int y = static_cast<int>(tile / columns) * tile_size;
+            const int w = std::min(tile_size, width - x);
+            const int h = std::min(tile_size, height - y);
+            std::shared_ptr<lunasvg::Bitmap> bitmap;
+            if (reuse)
+            {
+                if (buffers.size() <= index)
+                {
+                    buffers.push_back(std::make_shared<lunasvg::Bitmap>(tile_size, tile_size));
+                    Stats::instance().add_bitmap(*buffers.back());
+                }
+                bitmap = make_bitmap_view(buffers[index], 0, 0, w, h);
+            }
+            else
+            {
+                bitmap = std::make_shared<lunasvg::Bitmap>(w, h);
+                Stats::instance().add_bitmap(*bitmap);
+            }
+            if (bitmap->isNull())
+            {
+                throw std::runtime_error("Failed to create bitmap: out of memory");
+            }
+            batch[index] = {x, y, bitmap};
+        }
+
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits, render_time);
+            budget.check();
+            {
+                PhaseTimer timer(StatsPhase::Layout);
+                document->updateLayout();
+            }
+            try
+            {
+                WorkerPool::instance().parallel_for(batch_size, threads, [&](size_t index)
+                                                    {
+                    const Tile &tile = batch[index];
+                    budget.check();
+                    tile.bitmap->clear(background_color);
+                    lunasvg::Matrix tile_matrix(matrix.a, 0, 0, matrix.d, -tile.x, -tile.y);
+                    PhaseTimer timer(StatsPhase::Rasterize);
+                    document->render(*tile.bitmap, tile_matrix); });
+            }
+            catch (...)
+            {
+                render_time = budget.elapsed();
+                throw;
+            }
+            render_time = budget.elapsed();
+        }
+        next_tile += batch_size;
+        ready.insert(ready.end(), batch.begin(), batch.end());
+    }
+
+public:
+    PyTileIterator(const std::shared_ptr<lunasvg::Document> &doc, const std::shared_ptr<std::mutex> &mutex, int width, int height, int tile_size, uint32_t background_color, size_t threads, bool reuse, const PyLimits &limits)
+        : document(doc), mutex(mutex), width(width), height(height), tile_size(tile_size), background_color(background_color), threads(threads), reuse(reuse), limits(limits)
+    {
+        if (tile_size <= 0)
+        {
+            throw std::invalid_argument("Tile size must be positive.");
+        }
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            if (!resolve_render_size(*document, this->width, this->height, matrix))
+            {
+                throw std::runtime_error("Failed to render SVG document to tiles.");
+            }
+        }
+        RenderBudget(limits).check_size(this->width, this->height);
+        columns = (this->width + tile_size - 1) / tile_size;
+        const int rows = (this->height + tile_size - 1) / tile_size;
+        tile_count = static_cast<size_t>(columns) * rows;
+        if (this->threads == 0)
+        {
+            this->threads = WorkerPool::concurrency();
+        }
+    }
+
+    py::int_ get_width() const { return width; }
+    py::int_ get_height() const { return height; }
+
+    py::tuple next()
+    {
+        if (ready.empty())
+        {
+            if (next_tile >= tile_count)
+            {
+                throw py::stop_iteration();
+            }
+            render_batch();
+        }
+        Tile tile = ready.front();
+        ready.pop_front();
+        return py::make_tuple(tile.x, tile.y, PyBitmap(tile.bitmap));
+    }
+};
+
+// Iterator returned by Document.render_frames(). Each worker owns a clone of
+// the document; frames are rendered in batches of one frame per clone, in
+// parallel on the worker pool, and yielded in order. As with render_tiles,
+// reused bitmaps are overwritten when the next batch is rendered, and the
+// render time limit covers all batches.
+struct PyFrameIterator
+{
+private:
+    struct Worker
+    {
+        std::unique_ptr<lunasvg::Document> document;
+        std::vector<lunasvg::Element> targets; // One per track
+    };
+
+    std::shared_ptr<std::vector<Worker>> workers;
+    std::shared_ptr<const std::vector<AttributeTrack>> tracks;
+    std::shared_ptr<std::mutex> mutex; // Guards the clones
+    int width;
+    int height;
+    lunasvg::Matrix matrix;
+    uint32_t background_color;
+    double fps;
+    size_t frame_count;
+    size_t next_frame = 0;
+    bool reuse;
+    PyLimits limits;
+    double render_time = 0.0; // Seconds spent rendering so far
+    std::vector<std::shared_ptr<lunasvg::Bitmap>> buffers;
+    std::deque<std::shared_ptr<lunasvg::Bitmap>> ready;
+
+    void render_batch()
+    {
+        const size_t batch_size = std::min(workers->size(), frame_count - next_frame);
+        std::vector<std::shared_ptr<lunasvg::Bitmap>> batch(batch_size);
+        for (size_t index = 0; index < batch_size; ++index)
+        {
+            if (reuse && index < buffers.size())
+            {
+                batch[index] = buffers[index];
+                continue;
+            }
+            batch[index] = std::make_shared<lunasvg::Bitmap>(width, height);
+            if (batch[index]->isNull())
+            {
+                throw std::runtime_error("Failed to create bitmap: out of memory");
+            }
+            Stats::instance().add_bitmap(*batch[index]);
+            if (reuse)
+            {
+                buffers.push_back(batch[index]);
+            }
+        }
+
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits, render_time);
+            try
+            {
+                WorkerPool::instance().parallel_for(batch_size, batch_size, [&](size_t index)
+                                                    {
+                    budget.check();
+                    Worker &worker = (*workers)[index];
+                    const double time = static_cast<double>(next_frame + index) / fps;
+                    for (size_t track = 0; track < tracks->size(); ++track)
+                    {
+                        worker.targets[track].setAttribute((*tracks)[track].name(), (*tracks)[track].value_at(time));
+                    }
+                    {
+                        PhaseTimer timer(StatsPhase::Layout);
+                        worker.document->updateLayout();
+                    }
+                    batch[index]->clear(background_color);
+                    render_with_budget(*worker.document, *batch[index], matrix, budget); });
+            }
+            catch (...)
+            {
+                render_time = budget.elapsed();
+                throw;
+            }
+            render_time = budget.elapsed();
+        }
+        next_frame += batch_size;
+        ready.insert(ready.end(), batch.begin(), batch.end());
+    }
+
+public:
+    PyFrameIterator(std::vector<std::unique_ptr<lunasvg::Document>> clones, const std::vector<std::vector<size_t>> &paths, std::vector<AttributeTrack> animated, int width, int height, const lunasvg::Matrix &matrix, uint32_t background_color, double fps, size_t frame_count, bool reuse, const PyLimits &limits)
+        : workers(std::make_shared<std::vector<Worker>>()), tracks(std::make_shared<const std::vector<AttributeTrack>>(std::move(animated))), mutex(std::make_shared<std::mutex>()),
+          width(width), height(height), matrix(matrix), background_color(background_color), fps(fps), frame_count(frame_count), reuse(reuse), limits(limits)
+    {
+        for (auto &clone : clones)
+        {
+            Worker worker;
+            for (const auto &path : paths)
+            {
+                worker.targets.push_back(element_at_path(*clone, path));
+                if (worker.targets.back().isNull())
+                {
+                    throw std::runtime_error("Failed to clone document: element not found.");
+                }
+            }
+            worker.document = std::move(clone);
+            workers->push_back(std::move(worker));
+        }
+    }
+
+    py::int_ get_width() const { return width; }
+    py::int_ get_height() const { return height; }
+    size_t get_frame_count() const { return frame_count; }
+
+    PyBitmap next()
+    {
+        if (ready.empty())
+        {
+            if (next_frame >= frame_count)
+            {
+                throw py::stop_iteration();
+            }
+            render_batch();
+        }
+        auto bitmap = ready.front();
+        ready.pop_front();
+        return PyBitmap(bitmap);
+    }
+};
+
+struct PyDocument
+{
+private:
+    std::shared_ptr<lunasvg::Document> document;
+    // lunasvg documents are not thread-safe; every access goes through this
+    // mutex, which is shared with the elements handed out by the document.
+    std::shared_ptr<std::mutex> mutex;
+    std::shared_ptr<DamageTracker> damage;
+    std::shared_ptr<MutationJournal> journal;
+    DocumentSource source; // Null when unknown, or released after parsing
+    bool cached = false;
+    // Element name by element_key(), built on the first Element.tag_name
+    // lookup. The binding never adds or removes nodes, so it stays valid.
+    std::unordered_map<std::uintptr_t, const char *> tag_index;
+    std::shared_ptr<HitIndex> hit_index; // Built by build_hit_index()
+    PyLimits limits;                     // Limits the document was loaded with
+    LiveCounter live{Stats::instance().live_documents};
+
+    // Wraps a freshly parsed document. A cached document goes back to the
+    // template cache when its last reference is dropped, provided that the
+    // changes recorded in its journal can be rolled back.
+    static PyDocument wrap(std::unique_ptr<lunasvg::Document> doc, const DocumentSource &source, bool cached, const std::shared_ptr<MutationJournal> &journal, const PyLimits &limits = PyLimits())
+    {
+        std::shared_ptr<lunasvg::Document> shared;
+        if (cached)
+        {
+            shared = std::shared_ptr<lunasvg::Document>(doc.release(), [source, journal](lunasvg::Document *document)
+                                                        {
+                std::unique_ptr<lunasvg::Document> owned(document);
+                if (journal->undo())
+                {
+                    TemplateCache::instance().release(source, std::move(owned));
+                } });
+        }
+        else
+        {
+            shared = std::move(doc);
+        }
+        PyDocument result(shared);
+        result.journal = journal;
+        result.source = source;
+        result.cached = cached;
+        result.limits = limits;
+        return result;
+    }
+
+public:
+    PyDocument(const std::shared_ptr<lunasvg::Document> &doc)
+        : document(doc), mutex(std::make_shared<std::mutex>()), damage(std::make_shared<DamageTracker>()), journal(std::make_shared<MutationJournal>())
+    {
+        if (!document)
+        {
+            throw std::runtime_error("Document is null.");
+        }
+    }
+
+    std::shared_ptr<lunasvg::Document> get_document() const { return document; }
+    std::shared_ptr<std::mutex> get_mutex() const { return mutex; }
+    std::shared_ptr<DamageTracker> get_damage_tracker() const { return damage; }
+    std::shared_ptr<MutationJournal> get_journal() const { return journal; }
+    const PyLimits &get_limits() const { return limits; }
+
+    py::object __repr__(void)
+    {
+        auto lock = lock_document(*mutex);
+        return py::str("<Document width=" + std::to_string(document->width()) + " height=" + std::to_string(document->height()) + ">");
+    }
+
+    // lunasvg copies what it keeps while parsing, so the source (a mapping
+    // of the file, or the caller's buffer) is only held on to when clones
+    // will parse it again.
+    static DocumentSource retained_source(const DocumentSource &source, bool cloneable)
+    {
+        return cloneable ? source : DocumentSource();
+    }
+
+    // Limits passed to a call, or the ones the document was loaded with.
+    static PyLimits limits_from_object(const py::object &pylimits, const PyLimits &fallback = PyLimits())
+    {
+        return pylimits.is_none() ? fallback : pylimits.cast<PyLimits>();
+    }
+
+    static py::object load_from_file(const py::object &pyfilename, const py::object &pylimits, const py::object &pysheet, bool cloneable)
+    {
+        if (pyfilename.is_none())
+        {
+            throw std::invalid_argument("Filename cannot be None.");
+        }
+        std::string filename = py::str(pyfilename).cast<std::string>();
+        const PyLimits limits = limits_from_object(pylimits);
+        const auto sheet = style_sheet_from_object(pysheet);
+        auto journal = std::make_shared<MutationJournal>(cloneable);
+        DocumentSource data;
+        std::unique_ptr<lunasvg::Document> doc;
+        {
+            py::gil_scoped_release release;
+            data = load_file_source(filename);
+            if (data)
+            {
+                doc = parse_document(data, limits, sheet.get(), *journal);
+            }
+        }
+        if (!doc)
+        {
+            throw std::runtime_error("Failed to load SVG file: " + filename);
+        }
+        return py::cast(wrap(std::move(doc), retained_source(data, cloneable), false, journal, limits));
+    }
+
+    static py::object load_from_data(const py::object &pydata, const py::object &pylimits, const py::object &pysheet, bool cloneable)
+    {
+        const PyLimits limits = limits_from_object(pylimits);
+        const auto sheet = style_sheet_from_object(pysheet);
+        auto journal = std::make_shared<MutationJournal>(cloneable);
+        DocumentSource data = source_from_object(pydata);
+        std::unique_ptr<lunasvg::Document> doc;
+        {
+            py::gil_scoped_release release;
+            doc = parse_document(data, limits, sheet.get(), *journal);
+        }
+        if (!doc)
+        {
+            throw std::runtime_error("Failed to load SVG data.");
+        }
+        return py::cast(wrap(std::move(doc), retained_source(data, cloneable), false, journal, limits));
+    }
+
+    static py::object load_async(const py::object &pydata, const py::object &pylimits, const py::object &timeout, const py::object &pysheet, bool cloneable)
+    {
+        const PyLimits limits = limits_from_object(pylimits);
+        const auto sheet = style_sheet_from_object(pysheet);
+        DocumentSource data = source_from_object(pydata);
+        return run_async(timeout, [data, limits, sheet, cloneable](AsyncCall &call) -> std::function<py::object()>
+                         {
+            DocumentSource source = data;
+            auto journal = std::make_shared<MutationJournal>(cloneable);
+            auto doc = std::make_shared<std::unique_ptr<lunasvg::Document>>(parse_document(source, limits, sheet.get(), *journal));
+            if (!*doc)
+            {
+                throw std::runtime_error("Failed to load SVG data.");
+            }
+            call.check();
+            source = retained_source(source, cloneable);
+            return [source, doc, limits, journal]()
+            { return py::cast(wrap(std::move(*doc), source, false, journal, limits)); }; });
+    }
+
+    // A cached template was parsed without limits, so the input limits are
+    // checked against the source again on every load.
+    static py::object load_cached(const py::object &pydata, const py::object &pylimits)
+    {
+        const PyLimits limits = limits_from_object(pylimits);
+        DocumentSource source = source_from_object(pydata);
+        std::unique_ptr<lunasvg::Document> doc;
+        {
+            py::gil_scoped_release release;
+            check_input_limits(*source, limits);
+            doc = TemplateCache::instance().acquire(source);
+            if (!doc)
+            {
+                doc = parse_document(*source);
+            }
+            if (doc && limits.max_use_expansion)
+            {
+                check_use_expansion(*doc, limits.max_use_expansion);
+            }
+        }
+        if (!doc)
+        {
+            throw std::runtime_error("Failed to load SVG data.");
+        }
+        return py::cast(wrap(std::move(doc), source, true, std::make_shared<MutationJournal>(), limits));
+    }
+
+    static py::dict cache_info()
+    {
+        const auto info = TemplateCache::instance().info();
+        py::dict result;
+        result["hits"] = info.hits;
+        result["misses"] = info.misses;
+        result["entries"] = info.entries;
+        result["spares"] = info.spares;
+        result["bytes"] = info.bytes;
+        result["max_bytes"] = info.max_bytes;
+        result["max_spares"] = info.max_spares;
+        return result;
+    }
+
+    static py::object set_cache_limits(size_t max_bytes, size_t max_spares)
+    {
+        {
+            py::gil_scoped_release release;
+            TemplateCache::instance().set_limits(max_bytes, max_spares);
+        }
+        return py::none();
+    }
+
+    static py::object clear_cache()
+    {
+        {
+            py::gil_scoped_release release;
+            TemplateCache::instance().clear();
+        }
+        return py::none();
+    }
+
+    // lunasvg cannot copy a parsed tree, so a clone is a fresh parse of the
+    // retained source (a spare from the template cache when the document
+    // came from there) with this document's changes replayed onto it.
+    py::object clone()
+    {
+        if (!source)
+        {
+            throw std::runtime_error("Document cannot be cloned: its source is not available (load it with cloneable=True).");
+        }
+        auto copy_journal = std::make_shared<MutationJournal>(journal->tracks_attributes());
+        DocumentSource copy_source = source;
+        std::unique_ptr<lunasvg::Document> copy;
+        {
+            py::gil_scoped_release release;
+            if (cached)
+            {
+                copy = TemplateCache::instance().acquire(copy_source);
+            }
+            if (!copy)
+            {
+                copy = parse_document(*source);
+            }
+            if (!copy)
+            {
+                throw std::runtime_error("Failed to clone document.");
+            }
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            journal->replay(*copy, *copy_journal);
+        }
+        return py::cast(wrap(std::move(copy), copy_source, cached, copy_journal, limits));
+    }
+
+    py::object apply_style_sheet(const py::object &pycontent)
+    {
+        if (pycontent.is_none())
+        {
+            throw std::invalid_argument("Content cannot be None.");
+        }
+        if (py::isinstance<PyStyleSheet>(pycontent))
+        {
+            const auto sheet = pycontent.cast<PyStyleSheet>().sheet;
+            {
+                py::gil_scoped_release release;
+                std::lock_guard<std::mutex> lock(*mutex);
+                std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                const std::string content = sheet->relevant_text(*document);
+                damage->invalidate();
+                journal->record_style_sheet(content);
+                PhaseTimer timer(StatsPhase::StyleSheet);
+                document->applyStyleSheet(content);
+            }
+            return py::none();
+        }
+        if (!py::isinstance<py::str>(pycontent))
+        {
+            throw std::invalid_argument("Content must be a string or StyleSheet.");
+        }
+        std::string content = py::str(pycontent).cast<std::string>();
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            damage->invalidate();
+            journal->record_style_sheet(content);
+            PhaseTimer timer(StatsPhase::StyleSheet);
+            document->applyStyleSheet(content);
+        }
+        return py::none();
+    }
+
+    py::object render_to_bitmap(std::int32_t width, std::int32_t height, std::uint32_t background_color, const py::object &pylimits)
+    {
+        if (!document)
+        {
+            throw std::runtime_error("Document is null.");
+        }
+        const PyLimits render_limits = limits_from_object(pylimits, limits);
+        lunasvg::Bitmap bitmap;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            if (render_limits.max_render_time > 0.0)
+            {
+                bitmap = render_document_limited(*document, width, height, background_color, render_limits, [] {});
+            }
+            else
+            {
+                check_output_size(*document, width, height, render_limits);
+                bitmap = render_document_to_bitmap(*document, width, height, background_color);
+            }
+        }
+        if (bitmap.isNull())
+        {
+            throw std::runtime_error("Failed to render SVG document to bitmap.");
+        }
+        return py::cast(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(bitmap))));
+    }
+
+    py::object render_to_bitmap_async(int width, int height, std::uint32_t background_color, const py::object &pylimits, const py::object &timeout)
+    {
+        auto doc = document;
+        auto doc_mutex = mutex;
+        const PyLimits render_limits = limits_from_object(pylimits, limits);
+        return run_async(timeout, [doc, doc_mutex, width, height, background_color, render_limits](AsyncCall &call) -> std::function<py::object()>
+                         {
+            auto bitmap = std::make_shared<lunasvg::Bitmap>();
+            {
+                std::lock_guard<std::mutex> lock(*doc_mutex);
+                std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                *bitmap = render_document_limited(*doc, width, height, background_color, render_limits, [&call]
+                                                  { call.check(); });
+            }
+            if (bitmap->isNull())
+            {
+                throw std::runtime_error("Failed to render SVG document to bitmap.");
+            }
+            return [bitmap]()
+            { return py::cast(PyBitmap(bitmap)); }; });
+    }
+
+    py::object render_to_png_async(int width, int height, std::uint32_t background_color, int level, PngFilter filter, const py::object &pylimits, const py::object &timeout)
+    {
+        auto doc = document;
+        auto doc_mutex = mutex;
+        const PyLimits render_limits = limits_from_object(pylimits, limits);
+        return run_async(timeout, [doc, doc_mutex, width, height, background_color, level, filter, render_limits](AsyncCall &call) -> std::function<py::object()>
+                         {
+            lunasvg::Bitmap bitmap;
+            {
+                std::lock_guard<std::mutex> lock(*doc_mutex);
+                std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                bitmap = render_document_limited(*doc, width, height, background_color, render_limits, [&call]
+                                                 { call.check(); });
+            }
+            if (bitmap.isNull())
+            {
+                throw std::runtime_error("Failed to render SVG document to bitmap.");
+            }
+            auto png_data = std::make_shared<std::vector<uint8_t>>();
+            const bool success = encode_png(bitmap, PngOptions{level, filter}, [&](const uint8_t *data, size_t size)
+                                            {
+                if (call.stopped())
+                {
+                    return false;
+                }
+                png_data->insert(png_data->end(), data, data + size);
+                return true; });
+            if (!success)
+            {
+                call.check();
+                throw std::runtime_error("Failed to encode bitmap as PNG data.");
+            }
+            return [png_data]()
+            { return py::bytes(reinterpret_cast<const char *>(png_data->data()), png_data->size()); }; });
+    }
+
+    py::list render_many(const py::iterable &pysizes, std::uint32_t background_color, size_t threads, bool png, bool downsample)
+    {
+        std::vector<std::pair<int, int>> sizes;
+        for (auto pysize : pysizes)
+        {
+            sizes.push_back(pysize.cast<std::pair<int, int>>());
+        }
+
+        std::vector<lunasvg::Bitmap> bitmaps(sizes.size());
+        std::vector<std::vector<uint8_t>> png_data(sizes.size());
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits);
+            // Once laid out, rendering only reads the document, so all sizes
+            // can be rasterized concurrently while we hold the document lock.
+            {
+                PhaseTimer timer(StatsPhase::Layout);
+                document->updateLayout();
+            }
+            if (downsample)
+            {
+                bitmaps = render_document_at_sizes(*document, sizes, background_color, threads, true, budget);
+                if (png)
+                {
+                    encode_pngs(bitmaps, png_data, threads);
+                }
+            }
+            else
+            {
+                std::vector<lunasvg::Matrix> matrices(sizes.size());
+                for (size_t index = 0; index < sizes.size(); ++index)
+                {
+                    if (!resolve_render_size(*document, sizes[index].first, sizes[index].second, matrices[index]))
+                    {
+                        throw std::runtime_error("Failed to render SVG document to bitmap at index " + std::to_string(index) + ".");
+                    }
+                    budget.check_size(sizes[index].first, sizes[index].second);
+                }
+                WorkerPool::instance().parallel_for(sizes.size(), threads, [&](size_t index)
+                                                    {
+                    budget.check();
+                    auto bitmap = render_resolved(*document, sizes[index].first, sizes[index].second, matrices[index], background_color, budget);
+                    if (bitmap.isNull())
+                    {
+                        throw std::runtime_error("Failed to render SVG document to bitmap at index " + std::to_string(index) + ".");
+                    }
+                    if (png)
+                    {
+                        if (!encode_png(bitmap, png_data[index]))
+                        {
+                            throw std::runtime_error("Failed to encode bitmap as PNG data at index " + std::to_string(index) + ".");
+                        }
+                    }
+                    else
+                    {
+                        bitmaps[index] = std::move(bitmap);
+                    } });
+            }
+        }
+
+        py::list results;
+        for (size_t index = 0; index < sizes.size(); ++index)
+        {
+            if (png)
+            {
+                results.append(py::bytes(reinterpret_cast<const char *>(png_data[index].data()), png_data[index].size()));
+            }
+            else
+            {
+                results.append(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(bitmaps[index]))));
+            }
+        }
+        return results;
+    }
+
+    py::bytes render_to_ico(const py::iterable &pysizes, std::uint32_t background_color, size_t threads, bool downsample)
+    {
+        std::vector<std::pair<int, int>> sizes;
+        for (auto pysize : pysizes)
+        {
+            const auto size = pysize.cast<std::pair<int, int>>();
+            if (size.first < 1 || size.first > 256 || size.second < 1 || size.second > 256)
+            {
+                throw std::invalid_argument("Icon sizes must be between 1 and 256 pixels.");
+            }
+            sizes.push_back(size);
+        }
+        if (sizes.empty() || sizes.size() > 0xFFFF)
+        {
+            throw std::invalid_argument("An icon needs between 1 and 65535 sizes.");
+        }
+
+        std::vector<uint8_t> ico;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            {
+                PhaseTimer timer(StatsPhase::Layout);
+                document->updateLayout();
+            }
+            const auto bitmaps = render_document_at_sizes(*document, sizes, background_color, threads, downsample, RenderBudget(limits));
+            std::vector<std::vector<uint8_t>> png_data;
+            encode_pngs(bitmaps, png_data, threads);
+            ico = pack_ico(bitmaps, png_data);
+        }
+        return py::bytes(reinterpret_cast<const char *>(ico.data()), ico.size());
+    }
+
+    PyTileIterator render_tiles(int width, int height, int tile_size, std::uint32_t background_color, size_t threads, bool reuse)
+    {
+        return PyTileIterator(document, mutex, width, height, tile_size, background_color, threads, reuse, limits);
+    }
+
+    // Frames are rendered on clones, each a fresh parse of the source with
+    // this document's changes replayed, so the document itself is never
+    // touched and its lock is only held while the clones are made.
+    PyFrameIterator render_frames(const py::iterable &keyframes, double fps, int width, int height, std::uint32_t background_color, const py::object &pyduration, size_t threads, bool reuse)
+    {
+        if (!(fps > 0.0) || !std::isfinite(fps))
+        {
+            throw std::invalid_argument("Frame rate must be positive.");
+        }
+        if (!source)
+        {
+            throw std::runtime_error("Document cannot be animated: its source is not available (load it with cloneable=True).");
+        }
+
+        struct Track
+        {
+            lunasvg::Element element;
+            std::string id;
+            std::string name;
+            std::vector<std::pair<double, std::string>> values;
+        };
+
+        std::vector<Track> parsed;
+        double duration = 0.0;
+        for (auto item : keyframes)
+        {
+            if (py::isinstance<py::str>(item))
+            {
+                throw std::invalid_argument("Each track must be a (target, name, keyframes) tuple.");
+            }
+            py::sequence pytrack = item.cast<py::sequence>();
+            if (pytrack.size() != 3)
+            {
+                throw std::invalid_argument("Each track must be a (target, name, keyframes) tuple.");
+            }
+            Track track;
+            py::object target = pytrack[0];
+            if (py::isinstance<py::str>(target))
+            {
+                track.id = target.cast<std::string>();
+            }
+            else if (py::isinstance<PyElement>(target))
+            {
+                PyElement *element = target.cast<PyElement *>();
+                if (element->get_owner_document() != this)
+                {
+                    throw std::invalid_argument("Element does not belong to this document.");
+                }
+                track.element = element->get_element();
+            }
+            else
+            {
+                throw py::type_error("Track targets must be element ids or Element objects.");
+            }
+            track.name = pytrack[1].cast<std::string>();
+            for (auto pykeyframe : pytrack[2].cast<py::iterable>())
+            {
+                py::sequence keyframe = pykeyframe.cast<py::sequence>();
+                if (py::isinstance<py::str>(pykeyframe) || keyframe.size() != 2)
+                {
+                    throw std::invalid_argument("Each keyframe must be a (time, value) tuple.");
+                }
+                const double time = keyframe[0].cast<double>();
+                if (!(time >= 0.0) || !std::isfinite(time))
+                {
+                    throw std::invalid_argument("Keyframe times must be finite and non-negative.");
+                }
+                track.values.emplace_back(time, py::str(keyframe[1]).cast<std::string>());
+                duration = std::max(duration, time);
+            }
+            if (track.values.empty())
+            {
+                throw std::invalid_argument("Each track needs at least one keyframe.");
+            }
+            parsed.push_back(std::move(track));
+        }
+        if (!pyduration.is_none())
+        {
+            duration = pyduration.cast<double>();
+            if (!(duration >= 0.0) || !std::isfinite(duration))
+            {
+                throw std::invalid_argument("Duration must be finite and non-negative.");
+            }
+        }
+        const size_t frame_count = static_cast<size_t>(std::floor(duration * fps + 1e-9)) + 1;
+        if (threads == 0)
+        {
+            threads = WorkerPool::concurrency();
+        }
+        const size_t clone_count = std::min(threads, frame_count);
+
+        std::vector<AttributeTrack> tracks;
+        for (auto &track : parsed)
+        {
+            tracks.emplace_back(std::move(track.name), std::move(track.values));
+        }
+        std::vector<std::vector<size_t>> paths(parsed.size());
+        std::vector<std::unique_ptr<lunasvg::Document>> clones(clone_count);
+        lunasvg::Matrix matrix;
+        std::string missing;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            for (size_t index = 0; index < parsed.size() && missing.empty(); ++index)
+            {
+                auto element = parsed[index].element;
+                if (element.isNull())
+                {
+                    element = document->getElementById(parsed[index].id);
+                    if (element.isNull())
+                    {
+                        missing = parsed[index].id;
+                        break;
+                    }
+                }
+                paths[index] = element_path(element);
+            }
+            if (missing.empty())
+            {
+                if (!resolve_render_size(*document, width, height, matrix))
+                {
+                    throw std::runtime_error("Failed to render SVG document to frames.");
+                }
+                RenderBudget(limits).check_size(width, height);
+                // parse_document() takes the font lock itself, and shared
+                // locks must not be taken twice by one thread.
+                fonts.unlock();
+                WorkerPool::instance().parallel_for(clone_count, threads, [&](size_t index)
+                                                    {
+                    auto clone = parse_document(*source);
+                    if (!clone)
+                    {
+                        throw std::runtime_error("Failed to clone document.");
+                    }
+                    MutationJournal clone_journal;
+                    std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                    journal->replay(*clone, clone_journal);
+                    clones[index] = std::move(clone); });
+            }
+        }
+        if (!missing.empty())
+        {
+            throw std::invalid_argument("Element not found: " + missing);
+        }
+        return PyFrameIterator(std::move(clones), paths, std::move(tracks), width, height, matrix, background_color, fps, frame_count, reuse, limits);
+    }
+
+    // Streams the document into a PNG file one band of `tile_size` rows at a
+    // time, so the full-size bitmap never exists in memory. The tiles of a
+    // band are rendered in parallel.
+    py::object write_to_png(const py::object &pyfilename, int width, int height, std::uint32_t background_color, int tile_size, size_t threads, int level, PngFilter filter)
+    {
+        if (pyfilename.is_none())
+        {
+            throw std::invalid_argument("Filename cannot be None.");
+        }
+        if (tile_size <= 0)
+        {
+            throw std::invalid_argument("Tile size must be positive.");
+        }
+        std::string filename = py::str(pyfilename).cast<std::string>();
+
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            lunasvg::Matrix matrix;
+            if (!resolve_render_size(*document, width, height, matrix))
+            {
+                throw std::runtime_error("Failed to render SVG document to bitmap.");
+            }
+            const RenderBudget budget(limits);
+            budget.check_size(width, height);
+            const int band_height = std::min(tile_size, height);
+            lunasvg::Bitmap band(width, band_height);
+            if (band.isNull())
+            {
+                throw std::runtime_error("Failed to create bitmap: out of memory");
+            }
+            Stats::instance().add_bitmap(band);
+
+            std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(open_file(filename, "wb"), std::fclose);
+            if (!file)
+            {
+                throw std::runtime_error("Failed to write PNG file: " + filename);
+            }
+            PngStreamEncoder encoder([&file](const uint8_t *data, size_t size)
+                                     { return std::fwrite(data, 1, size, file.get()) == size; },
+                                     width, height, PngOptions{level, filter});
+            const auto convert_row = convert_row_function(PixelFormat::RGBA);
+            std::vector<uint8_t> row(static_cast<size_t>(width) * 4);
+            const size_t columns = static_cast<size_t>((width + tile_size - 1) / tile_size);
+
+            {
+                PhaseTimer timer(StatsPhase::Layout);
+                document->updateLayout();
+            }
+            for (int y = 0; y < height; y += band_height)
+            {
+                const int rows = std::min(band_height, height - y);
+                WorkerPool::instance().parallel_for(columns, threads, [&](size_t column)
+                                                    {
+                    const int x = static_cast<int>(column) * tile_size;
+                    budget.check();
+                    lunasvg::Bitmap tile(band.data() + static_cast<size_t>(x) * 4, std::min(tile_size, width - x), rows, band.stride());
+                    tile.clear(background_color);
+                    PhaseTimer timer(StatsPhase::Rasterize);
+                    document->render(tile, lunasvg::Matrix(matrix.a, 0, 0, matrix.d, -x, -y)); });
+                // Conversion and compression interleave row by row here, so
+                // both are counted as PNG encoding.
+                PhaseTimer timer(StatsPhase::PngEncode);
+                for (int r = 0; r < rows; ++r)
+                {
+                    convert_row(band.data() + static_cast<size_t>(r) * band.stride(), row.data(), width, 0);
+                    if (!encoder.write_row(row.data()))
+                    {
+                        throw std::runtime_error("Failed to write PNG file: " + filename);
+                    }
+                }
+            }
+            if (!encoder.finish() || std::fflush(file.get()) != 0)
+            {
+                throw std::runtime_error("Failed to write PNG file: " + filename);
+            }
+        }
+        return py::none();
+    }
+
+    py::float_ get_width() const
+    {
+        auto lock = lock_document(*mutex);
+        return document->width();
+    }
+
+    py::float_ get_height() const
+    {
+        auto lock = lock_document(*mutex);
+        return document->height();
+    }
+
+    PyBox get_bounding_box() const
+    {
+        auto lock = lock_document(*mutex);
+        return PyBox(document->boundingBox());
+    }
+
+    py::object update_layout()
+    {
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            PhaseTimer timer(StatsPhase::Layout);
+            document->updateLayout();
+        }
+        return py::none();
+    }
+
+    py::object render(PyBitmap &bitmap, py::object pymatrix = py::none())
+    {
+        lunasvg::Matrix matrix;
+        if (!pymatrix.is_none())
+        {
+            PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
+            matrix = matrix_obj->get_matrix();
+        }
+
+        auto target = bitmap.get_bitmap();
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits);
+            budget.check_size(target->width(), target->height());
+            render_with_budget(*document, *target, matrix, budget);
+        }
+        return py::none();
+    }
+
+    // Repaints only the areas changed since the previous call, on top of the
+    // previous frame that `bitmap` still holds.
+    py::list render_damaged(PyBitmap &bitmap, py::object pymatrix, std::uint32_t background_color, float margin)
+    {
+        lunasvg::Matrix matrix;
+        if (!pymatrix.is_none())
+        {
+            PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
+            matrix = matrix_obj->get_matrix();
+        }
+
+        auto target = bitmap.get_bitmap();
+        std::vector<DamageRect> rects;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits);
+            budget.check_size(target->width(), target->height());
+            rects = damage->collect(*document, *target, matrix, margin);
+            for (const auto &rect : rects)
+            {
+                lunasvg::Bitmap region(target->data() + static_cast<size_t>(rect.y0) * target->stride() + static_cast<size_t>(rect.x0) * 4, rect.x1 - rect.x0, rect.y1 - rect.y0, target->stride());
+                region.clear(background_color);
+                render_with_budget(*document, region, lunasvg::Matrix(matrix.a, matrix.b, matrix.c, matrix.d, matrix.e - rect.x0, matrix.f - rect.y0), budget);
+            }
+        }
+
+        py::list results;
+        for (const auto &rect : rects)
+        {
+            results.append(PyBox(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0));
+        }
+        return results;
+    }
+
+    py::object invalidate()
+    {
+        auto lock = lock_document(*mutex);
+        damage->invalidate();
+        return py::none();
+    }
+
+    py::object render_into(const py::buffer &data, int width, int height, int stride, py::object pymatrix = py::none())
+    {
+        if (stride == 0)
+        {
+            stride = width * 4;
+        }
+        py::buffer_info view = request_pixel_buffer(data, width, height, stride);
+        lunasvg::Matrix matrix;
+        if (!pymatrix.is_none())
+        {
+            PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
+            matrix = matrix_obj->get_matrix();
+        }
+
+        {
+            py::gil_scoped_release release;
+            lunasvg::Bitmap target(static_cast<uint8_t *>(view.ptr), width, height, stride);
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const RenderBudget budget(limits);
+            budget.check_size(width, height);
+            render_with_budget(*document, target, matrix, budget);
+        }
+        return py::none();
+    }
+
+    // Wraps an element of this document; the element keeps the document
+    // alive.
+    PyElement wrap_element(const lunasvg::Element &element)
+    {
+        return PyElement(std::make_shared<lunasvg::Element>(element), py::cast(this));
+    }
+
+    py::list wrap_elements(const lunasvg::ElementList &elements)
+    {
+        py::object self = py::cast(this);
+        py::list result;
+        for (const auto &element : elements)
+        {
+            result.append(PyElement(std::make_shared<lunasvg::Element>(element), self));
+        }
+        return result;
+    }
+
+    // Name of an element of this document. Called with the document mutex held.
+    std::string element_tag_name(const lunasvg::Element &element)
+    {
+        if (tag_index.empty())
+        {
+            for (const char *name : svg_tag_names)
+            {
+                for (const auto &tagged : document->querySelectorAll(name))
+                {
+                    tag_index.emplace(element_key(tagged), name);
+                }
+            }
+        }
+        auto it = tag_index.find(element_key(element));
+        return it == tag_index.end() ? std::string() : std::string(it->second);
+    }
+
+    py::list query_selector_all(const std::string &selector)
+    {
+        lunasvg::ElementList elements;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            elements = document->querySelectorAll(selector);
+        }
+        return wrap_elements(elements);
+    }
+
+    py::list elements_by_tag(const std::string &name)
+    {
+        if (!is_tag_name(name))
+        {
+            throw std::invalid_argument("Invalid tag name: " + name);
+        }
+        return query_selector_all(name);
+    }
+
+    // Applies many attribute changes under one lock with the GIL released.
+    // Every target is resolved before anything changes, damage is recorded
+    // for all of them while the layout is still valid, and the document is
+    // laid out once at the end instead of once per change.
+    py::object set_attributes(const py::iterable &changes)
+    {
+        struct Change
+        {
+            lunasvg::Element element;
+            std::string id;
+            std::string name;
+            std::string value;
+        };
+
+        std::vector<Change> batch;
+        for (auto item : changes)
+        {
+            if (py::isinstance<py::str>(item))
+            {
+                throw std::invalid_argument("Each change must be a (target, name, value) tuple.");
+            }
+            py::sequence change = item.cast<py::sequence>();
+            if (change.size() != 3)
+            {
+                throw std::invalid_argument("Each change must be a (target, name, value) tuple.");
+            }
+            Change entry;
+            py::object target = change[0];
+            if (py::isinstance<py::str>(target))
+            {
+                entry.id = target.cast<std::string>();
+            }
+            else if (py::isinstance<PyElement>(target))
+            {
+                PyElement *element = target.cast<PyElement *>();
+                if (element->get_owner_document() != this)
+                {
+                    throw std::invalid_argument("Element does not belong to this document.");
+                }
+                entry.element = element->get_element();
+            }
+            else
+            {
+                throw py::type_error("Change targets must be element ids or Element objects.");
+            }
+            entry.name = change[1].cast<std::string>();
+            entry.value = change[2].cast<std::string>();
+            batch.push_back(std::move(entry));
+        }
+
+        std::string missing;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            for (auto &entry : batch)
+            {
+                if (entry.element.isNull())
+                {
+                    entry.element = document->getElementById(entry.id);
+                    if (entry.element.isNull())
+                    {
+                        missing = entry.id;
+                        break;
+                    }
+                }
+            }
+            if (missing.empty())
+            {
+                for (const auto &entry : batch)
+                {
+                    damage->record(entry.element);
+                }
+                for (auto &entry : batch)
+                {
+                    journal->record_attribute(entry.element, entry.name, entry.value);
+                    entry.element.setAttribute(entry.name, entry.value);
+                }
+                PhaseTimer timer(StatsPhase::Layout);
+                document->updateLayout();
+            }
+        }
+        if (!missing.empty())
+        {
+            throw std::invalid_argument("Element not found: " + missing);
+        }
+        return py::none();
+    }
+
+    py::object build_hit_index()
+    {
+        auto index = std::make_shared<HitIndex>();
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            index->build(*document);
+        }
+        hit_index = std::move(index);
+        return py::none();
+    }
+
+    py::object hit_test(float x, float y, bool exact)
+    {
+        if (!hit_index)
+        {
+            build_hit_index();
+        }
+        auto index = hit_index;
+        lunasvg::Element element;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            const auto found = index->hit_test(x, y, [&](const lunasvg::Element &candidate)
+                                               { return !exact || element_covers(candidate, x, y); });
+            if (found >= 0)
+            {
+                element = index->element(static_cast<size_t>(found));
+            }
+        }
+        if (element.isNull())
+        {
+            return py::none();
+        }
+        return py::cast(wrap_element(element));
+    }
+
+    py::list query_rect(const PyBox &box)
+    {
+        if (!hit_index)
+        {
+            build_hit_index();
+        }
+        lunasvg::ElementList elements;
+        for (auto index : hit_index->query(box.get_box()))
+        {
+            elements.push_back(hit_index->element(index));
+        }
+        return wrap_elements(elements);
     }
 
-    py::object __richcompare__(PyElement *other, int op)
+    // Elements named by `targets`: None for every element, a CSS selector,
+    // or an iterable of elements of this document.
+    lunasvg::ElementList resolve_elements(const py::object &targets)
     {
-        if (op == Py_EQ)
+        if (targets.is_none() || py::isinstance<py::str>(targets))
         {
-            if (*element == *other->element)
-                return py::bool_(true);
-            return py::bool_(false);
+            const std::string selector = targets.is_none() ? std::string("*") : targets.cast<std::string>();
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            return document->querySelectorAll(selector);
         }
-        else if (op == Py_NE)
+        lunasvg::ElementList elements;
+        for (auto item : py::iterable(targets))
         {
-            if (*element != *other->element)
-                return py::bool_(true);
-            return py::bool_(false);
+            if (!py::isinstance<PyElement>(item))
+            {
+                throw py::type_error("Targets must be Element objects.");
+            }
+            PyElement *element = item.cast<PyElement *>();
+            if (element->get_owner_document() != this)
+            {
+                throw std::invalid_argument("Element does not belong to this document.");
+            }
+            elements.push_back(element->get_element());
         }
-        return py::none();
+        return elements;
     }
 
-    py::bool_ has_attribute(const std::string &name)
+    // Fills one row of `columns` floats per element in a single pass with
+    // the GIL released. Layout is computed at most once, by the first query.
+    template <typename Fn>
+    py::object element_rows(const py::object &targets, size_t columns, Fn fn)
     {
-        return py::bool_(element->hasAttribute(name));
+        const auto elements = resolve_elements(targets);
+        PyFloatArray result(elements.size(), columns);
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(*mutex);
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            float *row = result.data();
+            for (const auto &element : elements)
+            {
+                fn(element, row);
+                row += columns;
+            }
+        }
+        return py::cast(std::move(result));
     }
 
-    py::str get_attribute(const std::string &name)
+    py::object bounding_boxes(const py::object &targets)
     {
-        return py::str(element->getAttribute(name));
+        return element_rows(targets, 4, [](const lunasvg::Element &element, float *row)
+                            {
+            const auto box = element.getGlobalBoundingBox();
+            row[0] = box.x;
+            row[1] = box.y;
+            row[2] = box.w;
+            row[3] = box.h; });
     }
 
-    py::object set_attribute(const std::string &name, const std::string &value)
+    py::object global_matrices(const py::object &targets)
     {
-        element->setAttribute(name, value);
-        return py::none();
+        return element_rows(targets, 6, [](const lunasvg::Element &element, float *row)
+                            {
+            const auto matrix = element.getGlobalMatrix();
+            row[0] = matrix.a;
+            row[1] = matrix.b;
+            row[2] = matrix.c;
+            row[3] = matrix.d;
+            row[4] = matrix.e;
+            row[5] = matrix.f; });
     }
 
-    py::object render(PyBitmap &bitmap, py::object pymatrix = py::none())
+    py::object get_element_by_id(const std::string &id)
     {
-        lunasvg::Matrix matrix;
-        if (!pymatrix.is_none())
+        auto lock = lock_document(*mutex);
+        auto element = document->getElementById(id);
+        lock.unlock();
+        if (element.isNull())
         {
-            PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
-            matrix = *matrix_obj->get_matrix();
+            return py::none();
         }
-
-        element->render(*(bitmap.get_bitmap()), matrix);
-        return py::none();
+        return py::cast(wrap_element(element));
     }
 
-    py::object render_to_bitmap(int width = -1, int height = -1, uint32_t background_color = 0)
+    py::object document_element()
     {
-        auto bitmap = element->renderToBitmap(width, height, background_color);
-        if (bitmap.isNull())
+        auto lock = lock_document(*mutex);
+        auto element = document->documentElement();
+        lock.unlock();
+        if (element.isNull())
         {
-            throw std::runtime_error("Failed to render element to bitmap");
+            return py::none();
         }
-        return py::cast(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(bitmap))));
+        return py::cast(wrap_element(element));
     }
+};
 
-    PyMatrix get_local_matrix()
-    {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(element->getLocalMatrix()));
-    }
+PyElement::PyElement(std::shared_ptr<lunasvg::Element> elem, py::object owner)
+    : element(std::move(elem)), owner(std::move(owner))
+{
+    const PyDocument *document = get_owner_document();
+    document_mutex = document->get_mutex();
+    damage = document->get_damage_tracker();
+    journal = document->get_journal();
+}
 
-    PyMatrix get_global_matrix()
+PyDocument *PyElement::get_owner_document() const
+{
+    return owner.cast<PyDocument *>();
+}
+
+// Elements render within the limits of their owner document.
+py::object PyElement::render(PyBitmap &bitmap, py::object pymatrix)
+{
+    lunasvg::Matrix matrix;
+    if (!pymatrix.is_none())
     {
-        return PyMatrix(std::make_shared<lunasvg::Matrix>(element->getGlobalMatrix()));
+        PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
+        matrix = matrix_obj->get_matrix();
     }
 
-    PyBox get_local_bounding_box()
+    const PyLimits limits = get_owner_document()->get_limits();
+    auto target = bitmap.get_bitmap();
     {
-        return PyBox(std::make_shared<lunasvg::Box>(element->getLocalBoundingBox()));
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(*document_mutex);
+        std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+        const RenderBudget budget(limits);
+        budget.check_size(target->width(), target->height());
+        render_with_budget(*element, *target, matrix, budget);
     }
+    return py::none();
+}
 
-    PyBox get_global_bounding_box()
+py::object PyElement::render_to_bitmap(int width, int height, uint32_t background_color)
+{
+    const PyLimits limits = get_owner_document()->get_limits();
+    lunasvg::Bitmap bitmap;
     {
-        return PyBox(std::make_shared<lunasvg::Box>(element->getGlobalBoundingBox()));
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(*document_mutex);
+        std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+        lunasvg::Matrix matrix;
+        if (resolve_element_render_size(*element, width, height, matrix))
+        {
+            bitmap = render_resolved(*element, width, height, matrix, background_color, RenderBudget(limits));
+        }
     }
-
-    PyBox get_bounding_box()
+    if (bitmap.isNull())
     {
-        return PyBox(std::make_shared<lunasvg::Box>(element->getBoundingBox()));
+        throw std::runtime_error("Failed to render element to bitmap");
     }
+    return py::cast(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(bitmap))));
+}
 
-    py::object parent_element()
+py::list PyElement::children()
+{
+    auto lock = lock_document(*document_mutex);
+    auto elements = child_elements(*element);
+    lock.unlock();
+    return get_owner_document()->wrap_elements(elements);
+}
+
+py::object PyElement::first_child()
+{
+    auto lock = lock_document(*document_mutex);
+    for (const auto &child : element->children())
     {
-        auto parent = element->parentElement();
-        if (parent.isNull())
+        if (child.isElement())
         {
-            return py::none();
+            auto first = child.toElement();
+            lock.unlock();
+            return py::cast(PyElement(std::make_shared<lunasvg::Element>(first), owner));
         }
-        return py::cast(PyElement(std::make_shared<lunasvg::Element>(parent), owner_document_ref));
     }
+    return py::none();
+}
 
-    py::object owner_document()
+py::object PyElement::next_sibling()
+{
+    auto lock = lock_document(*document_mutex);
+    auto parent = element->parentElement();
+    if (parent.isNull())
+    {
+        return py::none();
+    }
+    const auto siblings = parent.children();
+    auto it = std::find(siblings.begin(), siblings.end(), *element);
+    if (it != siblings.end())
     {
-        if (owner_document_ref)
+        for (++it; it != siblings.end(); ++it)
         {
-            return py::cast(owner_document_ref);
+            if (it->isElement())
+            {
+                auto next = it->toElement();
+                lock.unlock();
+                return py::cast(PyElement(std::make_shared<lunasvg::Element>(next), owner));
+            }
         }
-        return py::none();
     }
-};
+    return py::none();
+}
 
-struct PyDocument
+py::str PyElement::tag_name()
 {
-private:
-    std::shared_ptr<lunasvg::Document> document;
+    auto lock = lock_document(*document_mutex);
+    return py::str(get_owner_document()->element_tag_name(*element));
+}
 
-public:
-    PyDocument(const std::shared_ptr<lunasvg::Document> &doc) : document(doc)
+static py::list render_many(const py::iterable &sources, int width, int height, uint32_t background_color, size_t threads, bool png, const py::object &pylimits)
+{
+    struct Job
     {
-        if (!document)
+        DocumentSource data;
+        std::string filename;
+        lunasvg::Bitmap bitmap;
+        std::vector<uint8_t> png_data;
+    };
+
+    const PyLimits limits = pylimits.is_none() ? PyLimits() : pylimits.cast<PyLimits>();
+    auto path_like = py::module_::import("os").attr("PathLike");
+    std::vector<Job> jobs;
+    for (auto source : sources)
+    {
+        Job job;
+        if (py::isinstance(source, path_like))
         {
-            throw std::runtime_error("Document is null.");
+            job.filename = py::str(source).cast<std::string>();
         }
+        else
+        {
+            job.data = source_from_object(py::reinterpret_borrow<py::object>(source));
+        }
+        jobs.push_back(std::move(job));
     }
 
-    py::object __repr__(void)
     {
-        return py::str("<Document width=" + std::to_string(document->width()) + " height=" + std::to_string(document->height()) + ">");
+        py::gil_scoped_release release;
+        WorkerPool::instance().parallel_for(jobs.size(), threads, [&](size_t index)
+                                            {
+            auto &job = jobs[index];
+            DocumentSource data = job.data ? job.data : load_file_source(job.filename);
+            std::unique_ptr<lunasvg::Document> document;
+            if (data)
+            {
+                document = parse_document(*data, limits);
+            }
+            if (!document)
+            {
+                throw std::runtime_error("Failed to load SVG source at index " + std::to_string(index) + ".");
+            }
+            std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+            if (limits.max_render_time > 0.0)
+            {
+                job.bitmap = render_document_limited(*document, width, height, background_color, limits, [] {});
+            }
+            else
+            {
+                check_output_size(*document, width, height, limits);
+                job.bitmap = render_document_to_bitmap(*document, width, height, background_color);
+            }
+            if (job.bitmap.isNull())
+            {
+                throw std::runtime_error("Failed to render SVG document to bitmap at index " + std::to_string(index) + ".");
+            }
+            fonts.unlock();
+            if (png)
+            {
+                if (!encode_png(job.bitmap, job.png_data))
+                {
+                    throw std::runtime_error("Failed to encode bitmap as PNG data at index " + std::to_string(index) + ".");
+                }
+                job.bitmap = lunasvg::Bitmap();
+            } });
     }
 
-    static py::object load_from_file(const py::object &pyfilename)
+    py::list results;
+    for (auto &job : jobs)
     {
-        if (pyfilename.is_none())
+        if (png)
         {
-            throw std::invalid_argument("Filename cannot be None.");
+            results.append(py::bytes(reinterpret_cast<const char *>(job.png_data.data()), job.png_data.size()));
         }
-        std::string filename = py::str(pyfilename).cast<std::string>();
-        auto doc = lunasvg::Document::loadFromFile(filename);
-        if (!doc)
+        else
         {
-            throw std::runtime_error("Failed to load SVG file: " + filename);
+            results.append(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(job.bitmap))));
         }
-        return py::cast(PyDocument(std::shared_ptr<lunasvg::Document>(std::move(doc))));
     }
+    return results;
+}
+
+// Bottom-left skyline packer used by build_atlas(). The skyline is the upper
+// outline of the rectangles placed so far, kept as segments sorted by x.
+// Each rectangle goes where its top edge ends up lowest, leftmost on ties.
+class SkylinePacker
+{
+public:
+    explicit SkylinePacker(int width)
+        : width(width)
+    {
+        skyline.push_back(Segment{0, 0, width});
+    }
+
+    int get_height() const { return height; }
 
-    static py::object load_from_data(const py::object &pydata)
+    // Places a rect_width x rect_height rectangle and returns its top-left
+    // corner, or false if it is wider than the packer.
+    bool insert(int rect_width, int rect_height, int &x, int &y)
     {
-        if (pydata.is_none())
+        size_t best = skyline.size();
+        int best_top = 0;
+        for (size_t index = 0; index < skyline.size(); ++index)
         {
-            throw std::invalid_argument("Data cannot be None.");
+            int top;
+            if (fits(index, rect_width, top) && (best == skyline.size() || top < best_top))
+            {
+                best = index;
+                best_top = top;
+            }
         }
-        std::string data;
-        if (py::isinstance<py::bytes>(pydata))
+        if (best == skyline.size())
         {
-            data = py::bytes(pydata).cast<std::string>();
+            return false;
         }
-        else if (py::isinstance<py::bytearray>(pydata))
+        x = skyline[best].x;
+        y = best_top;
+        height = std::max(height, y + rect_height);
+
+        // The new segment replaces the part of the skyline it covers.
+        const int right = x + rect_width;
+        size_t end = best;
+        while (end < skyline.size() && skyline[end].x + skyline[end].width <= right)
         {
-            data = py::bytearray(pydata).cast<std::string>();
+            ++end;
         }
-        else if (py::isinstance<py::str>(pydata))
+        if (end < skyline.size() && skyline[end].x < right)
         {
-            data = py::str(pydata).cast<std::string>();
+            skyline[end].width -= right - skyline[end].x;
+            skyline[end].x = right;
         }
-        else
+        skyline.erase(skyline.begin() + best, skyline.begin() + end);
+        skyline.insert(skyline.begin() + best, Segment{x, y + rect_height, rect_width});
+        if (best + 1 < skyline.size() && skyline[best + 1].y == skyline[best].y)
         {
-            throw std::invalid_argument("Data must be bytes, bytearray, or string.");
+            skyline[best].width += skyline[best + 1].width;
+            skyline.erase(skyline.begin() + best + 1);
         }
-        if (data.empty())
+        if (best > 0 && skyline[best - 1].y == skyline[best].y)
         {
-            throw std::invalid_argument("Data cannot be empty.");
+            skyline[best - 1].width += skyline[best].width;
+            skyline.erase(skyline.begin() + best);
         }
-        auto doc = lunasvg::Document::loadFromData(data.c_str(), data.size());
-        if (!doc)
+        return true;
+    }
+
+private:
+    struct Segment
+    {
+        int x;
+        int y;
+        int width;
+    };
+
+    // Whether a rectangle fits at the start of segment `index`, and the y it
+    // would rest at.
+    bool fits(size_t index, int rect_width, int &top) const
+    {
+        if (skyline[index].x + rect_width > width)
         {
-            throw std::runtime_error("Failed to load SVG data.");
+            return false;
         }
-        return py::cast(PyDocument(std::shared_ptr<lunasvg::Document>(std::move(doc))));
+        top = 0;
+        int remaining = rect_width;
+        for (size_t next = index; remaining > 0; ++next)
+        {
+            top = std::max(top, skyline[next].y);
+            remaining -= skyline[next].width;
+        }
+        return true;
     }
 
-    py::object apply_style_sheet(const py::object &pycontent)
+    int width;
+    int height = 0;
+    std::vector<Segment> skyline;
+};
+
+// Renders documents and elements at several sizes into one shared bitmap for
+// pylunasvg.build_atlas(). Every item is laid out and measured first, the
+// slots are packed with a SkylinePacker, and the slots are then rasterized in
+// parallel straight into the atlas through bitmap views, which never overlap.
+static py::tuple build_atlas(const py::iterable &items, const py::iterable &pysizes, int padding, uint32_t background_color, int max_width, size_t threads)
+{
+    struct Source
     {
-        if (pycontent.is_none())
+        std::shared_ptr<lunasvg::Document> document; // Set for a whole document
+        const lunasvg::Element *element = nullptr;   // Set for an element
+        PyLimits limits;                             // Limits of the owner document
+    };
+    struct Slot
+    {
+        size_t source = 0;
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        lunasvg::Matrix matrix;
+    };
+
+    if (padding < 0)
+    {
+        throw std::invalid_argument("Padding cannot be negative.");
+    }
+    if (max_width < 0)
+    {
+        throw std::invalid_argument("Width cannot be negative.");
+    }
+    std::vector<std::pair<int, int>> sizes;
+    for (auto pysize : pysizes)
+    {
+        sizes.push_back(pysize.cast<std::pair<int, int>>());
+    }
+    std::vector<py::object> owners; // Keeps the items alive without the GIL
+    std::vector<Source> sources;
+    std::vector<std::shared_ptr<std::mutex>> mutexes;
+    for (auto item : items)
+    {
+        owners.push_back(py::reinterpret_borrow<py::object>(item));
+        Source source;
+        if (py::isinstance<PyDocument>(item))
         {
-            throw std::invalid_argument("Content cannot be None.");
+            auto *document = item.cast<PyDocument *>();
+            source.document = document->get_document();
+            source.limits = document->get_limits();
+            mutexes.push_back(document->get_mutex());
         }
-        if (!py::isinstance<py::str>(pycontent))
+        else if (py::isinstance<PyElement>(item))
         {
-            throw std::invalid_argument("Content must be a string.");
+            auto *element = item.cast<PyElement *>();
+            source.element = &element->get_element();
+            source.limits = element->get_owner_document()->get_limits();
+            mutexes.push_back(element->get_document_mutex());
         }
-        std::string content = py::str(pycontent).cast<std::string>();
-        document->applyStyleSheet(content);
-        return py::none();
+        else
+        {
+            throw py::type_error("Atlas items must be Document or Element objects.");
+        }
+        sources.push_back(std::move(source));
     }
+    if (sources.empty() || sizes.empty())
+    {
+        throw std::invalid_argument("An atlas needs at least one item and one size.");
+    }
+    // Documents are locked in address order, so concurrent atlases that
+    // share documents cannot deadlock.
+    std::sort(mutexes.begin(), mutexes.end());
+    mutexes.erase(std::unique(mutexes.begin(), mutexes.end()), mutexes.end());
 
-    py::object render_to_bitmap(std::int32_t width, std::int32_t height, std::uint32_t background_color)
+    std::shared_ptr<lunasvg::Bitmap> atlas;
+    std::vector<Slot> slots;
     {
-        if (width == 0)
+        py::gil_scoped_release release;
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (const auto &mutex : mutexes)
         {
-            width = static_cast<std::int32_t>(document->width());
+            locks.emplace_back(*mutex);
         }
-        if (height == 0)
+        std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+        // Each item renders within the limits of its own document.
+        std::vector<RenderBudget> budgets;
+        for (const auto &source : sources)
         {
-            height = static_cast<std::int32_t>(document->height());
+            budgets.emplace_back(source.limits);
         }
-        if (!document)
+
+        // Layout happens here, once per document, so that the parallel
+        // renders below only read the trees.
         {
-            throw std::runtime_error("Document is null.");
+            PhaseTimer timer(StatsPhase::Layout);
+            for (auto &source : sources)
+            {
+                if (source.document)
+                {
+                    source.document->updateLayout();
+                }
+            }
         }
-        auto bitmap = document->renderToBitmap(width, height, background_color);
-        if (bitmap.isNull())
+        uint64_t area = 0;
+        int widest = 0;
+        for (size_t index = 0; index < sources.size(); ++index)
         {
-            throw std::runtime_error("Failed to render SVG document to bitmap.");
+            const auto &source = sources[index];
+            for (const auto &size : sizes)
+            {
+                Slot slot;
+                slot.source = index;
+                slot.width = size.first;
+                slot.height = size.second;
+                const bool resolved = source.document ? resolve_render_size(*source.document, slot.width, slot.height, slot.matrix)
+                                                      : resolve_element_render_size(*source.element, slot.width, slot.height, slot.matrix);
+                if (!resolved)
+                {
+                    throw std::runtime_error("Failed to render atlas item at index " + std::to_string(index) + ".");
+                }
+                budgets[index].check_size(slot.width, slot.height);
+                area += static_cast<uint64_t>(slot.width + padding) * static_cast<uint64_t>(slot.height + padding);
+                widest = std::max(widest, slot.width + padding);
+                slots.push_back(slot);
+            }
         }
-        return py::cast(PyBitmap(std::make_shared<lunasvg::Bitmap>(std::move(bitmap))));
+
+        // Taller slots first, which keeps the skyline flat. Without a
+        // width, the atlas is made roughly square.
+        std::vector<size_t> order(slots.size());
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                         { return slots[a].height != slots[b].height ? slots[a].height > slots[b].height : slots[a].width > slots[b].width; });
+        const int inner_width = max_width > 0 ? max_width - padding : std::max(widest, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(area)))));
+        if (widest > inner_width)
+        {
+            throw std::invalid_argument("An atlas item is wider than the atlas width.");
+        }
+        SkylinePacker packer(inner_width);
+        int used_width = 0;
+        for (size_t index : order)
+        {
+            auto &slot = slots[index];
+            packer.insert(slot.width + padding, slot.height + padding, slot.x, slot.y);
+            slot.x += padding;
+            slot.y += padding;
+            used_width = std::max(used_width, slot.x + slot.width + padding);
+        }
+        const int atlas_height = packer.get_height() + padding;
+        if (static_cast<uint64_t>(used_width) * static_cast<uint64_t>(atlas_height) > static_cast<uint64_t>(std::numeric_limits<int>::max() / 4))
+        {
+            throw std::runtime_error("Failed to create bitmap: atlas too large");
+        }
+        atlas = std::make_shared<lunasvg::Bitmap>(used_width, atlas_height);
+        if (atlas->isNull())
+        {
+            throw std::runtime_error("Failed to create bitmap: out of memory");
+        }
+        Stats::instance().add_bitmap(*atlas);
+        atlas->clear(0);
+
+        WorkerPool::instance().parallel_for(order.size(), threads, [&](size_t rank)
+                                            {
+            const auto &slot = slots[order[rank]];
+            const auto &source = sources[slot.source];
+            const auto &budget = budgets[slot.source];
+            budget.check();
+            lunasvg::Bitmap view(atlas->data() + static_cast<size_t>(slot.y) * atlas->stride() + static_cast<size_t>(slot.x) * 4, slot.width, slot.height, atlas->stride());
+            if (background_color)
+            {
+                view.clear(background_color);
+            }
+            if (source.document)
+            {
+                render_with_budget(*source.document, view, slot.matrix, budget);
+            }
+            else
+            {
+                render_with_budget(*source.element, view, slot.matrix, budget);
+            } });
     }
 
-    py::float_ get_width() const
+    const double atlas_width = atlas->width();
+    const double atlas_height = atlas->height();
+    py::list rects;
+    for (size_t index = 0; index < sources.size(); ++index)
     {
-        return document->width();
+        py::list item_rects;
+        for (size_t size = 0; size < sizes.size(); ++size)
+        {
+            const auto &slot = slots[index * sizes.size() + size];
+            item_rects.append(py::make_tuple(slot.x, slot.y, slot.width, slot.height,
+                                             slot.x / atlas_width, slot.y / atlas_height,
+                                             (slot.x + slot.width) / atlas_width, (slot.y + slot.height) / atlas_height));
+        }
+        rects.append(item_rects);
     }
+    return py::make_tuple(PyBitmap(atlas), rects);
+}
 
-    py::float_ get_height() const
+// Limits are None in Python when disabled, which PyLimits stores as zero.
+template <typename T>
+static T limit_from_object(const py::object &value)
+{
+    if (value.is_none())
     {
-        return document->height();
+        return T();
     }
-
-    PyBox get_bounding_box() const
+    const T limit = value.cast<T>();
+    if (!(limit > T()))
     {
-        return PyBox(std::make_shared<lunasvg::Box>(document->boundingBox()));
+        throw std::invalid_argument("Limits must be positive or None.");
     }
+    return limit;
+}
 
-    py::object update_layout()
+template <typename T>
+static py::object limit_to_object(T limit)
+{
+    return limit > T() ? py::cast(limit) : py::none();
+}
+
+// Loads the fonts of a directory for pylunasvg.add_font_directory(). The
+// directory is listed with os.walk; the files are then mapped and their
+// names read in parallel without the GIL.
+static int add_font_directory(const py::object &pypath, bool recursive, size_t threads)
+{
+    if (pypath.is_none())
     {
-        document->updateLayout();
-        return py::none();
+        throw std::invalid_argument("Path cannot be None.");
     }
-
-    py::object render(PyBitmap &bitmap, py::object pymatrix = py::none())
+    const std::string root = py::str(pypath).cast<std::string>();
+    py::module_ os = py::module_::import("os");
+    if (!os.attr("path").attr("isdir")(root).cast<bool>())
     {
-        lunasvg::Matrix matrix;
-        if (!pymatrix.is_none())
+        throw std::invalid_argument("Not a directory: " + root);
+    }
+    std::vector<std::string> filenames;
+    for (auto entry : py::iterable(os.attr("walk")(root)))
+    {
+        py::tuple walked = entry.cast<py::tuple>();
+        py::list directories = walked[1];
+        directories.attr(recursive ? "sort" : "clear")();
+        for (auto pyname : py::iterable(walked[2]))
         {
-            PyMatrix *matrix_obj = pymatrix.cast<PyMatrix *>();
-            matrix = *matrix_obj->get_matrix();
+            std::string name = pyname.cast<std::string>();
+            std::string extension = name.size() > 4 ? name.substr(name.size() - 4) : std::string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char ch)
+                           { return static_cast<char>(std::tolower(ch)); });
+            if (extension == ".ttf" || extension == ".otf" || extension == ".ttc")
+            {
+                filenames.push_back(os.attr("path").attr("join")(walked[0], pyname).cast<std::string>());
+            }
         }
-
-        document->render(*(bitmap.get_bitmap()), matrix);
-        return py::none();
     }
+    std::sort(filenames.begin(), filenames.end());
 
-    py::object get_element_by_id(const std::string &id)
+    struct Font
     {
-        auto element = document->getElementById(id);
-        if (element.isNull())
+        DocumentSource data;
+        FontStyle style;
+    };
+
+    std::vector<Font> fonts(filenames.size());
+    int added = 0;
+    {
+        py::gil_scoped_release release;
+        WorkerPool::instance().parallel_for(filenames.size(), threads, [&](size_t index)
+                                            {
+            auto data = read_file_source(filenames[index]);
+            if (data && read_font_style(data->data(), data->size(), fonts[index].style))
+            {
+                fonts[index].data = std::move(data);
+            } });
+        std::unique_lock<std::shared_mutex> lock(font_registry_mutex());
+        for (const auto &font : fonts)
         {
-            return py::none();
+            if (font.data && FontCache::instance().add(font.style.family, font.style.bold, font.style.italic, font.data, font.data->data(), font.data->size()) == FontCache::AddResult::Added)
+            {
+                ++added;
+            }
         }
-        return py::cast(PyElement(std::make_shared<lunasvg::Element>(element), this));
     }
+    return added;
+}
 
-    py::object document_element()
+// Snapshot of the counters for pylunasvg.get_stats().
+static py::dict get_stats()
+{
+    static const char *const phase_names[] = {"parse", "stylesheet", "layout", "rasterize", "convert", "png_encode"};
+    static_assert(sizeof(phase_names) / sizeof(phase_names[0]) == static_cast<size_t>(StatsPhase::Count), "missing phase name");
+    auto &stats = Stats::instance();
+    py::dict phases;
+    for (size_t index = 0; index < stats.phases.size(); ++index)
     {
-        auto element = document->documentElement();
-        if (element.isNull())
-        {
-            return py::none();
-        }
-        return py::cast(PyElement(std::make_shared<lunasvg::Element>(element), this));
+        const auto &counter = stats.phases[index];
+        py::dict phase;
+        phase["calls"] = counter.calls.load(std::memory_order_relaxed);
+        phase["seconds"] = static_cast<double>(counter.nanoseconds.load(std::memory_order_relaxed)) * 1e-9;
+        phases[phase_names[index]] = phase;
     }
-};
+    py::dict result;
+    result["enabled"] = stats.enabled();
+    result["phases"] = phases;
+    result["bitmaps_allocated"] = stats.bitmaps_allocated.load(std::memory_order_relaxed);
+    result["bitmap_bytes"] = stats.bitmap_bytes.load(std::memory_order_relaxed);
+    result["live_documents"] = stats.live_documents.load(std::memory_order_relaxed);
+    result["live_bitmaps"] = stats.live_bitmaps.load(std::memory_order_relaxed);
+    return result;
+}
 
 PYBIND11_MODULE(pylunasvg, m)
 {
@@ -616,6 +7380,14 @@ PYBIND11_MODULE(pylunasvg, m)
     m.attr("__license__") = "MIT";
     m.attr("__lunasvg_version__") = lunasvg_version_string();
 
+    py::class_<PyFloatArray> PyFloatArrayClass(m, "FloatArray", py::buffer_protocol());
+    PyFloatArrayClass.def_buffer(&PyFloatArray::get_buffer_info);
+    PyFloatArrayClass.def("__repr__", &PyFloatArray::__repr__);
+    PyFloatArrayClass.def("__len__", &PyFloatArray::__len__);
+    PyFloatArrayClass.def("__getitem__", &PyFloatArray::__getitem__);
+    PyFloatArrayClass.def_property_readonly("shape", &PyFloatArray::get_shape, "Get the (rows, columns) shape of the array");
+    PyFloatArrayClass.def("tolist", &PyFloatArray::tolist, "Return the rows as a list of tuples");
+
     // Definition of Matrix class
     py::class_<PyMatrix> PyMatrixClass(m, "Matrix");
     PyMatrixClass.def(py::init<>());
@@ -646,6 +7418,9 @@ PYBIND11_MODULE(pylunasvg, m)
     PyMatrixClass.def("__mul__", &PyMatrix::operator*, py::is_operator(), py::arg("other"), "Multiply this matrix with another matrix");
     PyMatrixClass.def("__imul__", &PyMatrix::operator*=, py::is_operator(), py::arg("other"), "Multiply this matrix with another matrix and assign the result to this matrix");
     PyMatrixClass.def("__invert__", &PyMatrix::operator~, py::is_operator(), "Return the inverse of this matrix");
+    PyMatrixClass.def_static("compose", &PyMatrix::compose, py::arg("matrices"), "Multiply a sequence of matrices in order");
+    PyMatrixClass.def("map_points", &PyMatrix::map_points, py::arg("points"), py::arg("out") = py::none(), "Transform an N x 2 buffer of points");
+    PyMatrixClass.def("map_boxes", &PyMatrix::map_boxes, py::arg("boxes"), py::arg("out") = py::none(), "Transform an N x 4 buffer of boxes and return their bounding boxes");
 
     // Definition of Box class
     py::class_<PyBox> PyBoxClass(m, "Box");
@@ -662,34 +7437,174 @@ PYBIND11_MODULE(pylunasvg, m)
     PyBoxClass.def("__len__", &PyBox::__len__);
     PyBoxClass.def("__getitem__", &PyBox::__getitem__);
 
-    py::class_<PyBitmap> PyBitmapClass(m, "Bitmap");
+    py::enum_<PixelFormat>(m, "PixelFormat")
+        .value("RGBA", PixelFormat::RGBA, "Straight alpha R, G, B, A bytes")
+        .value("RGBA_PREMULTIPLIED", PixelFormat::RGBA_PREMULTIPLIED, "Premultiplied alpha R, G, B, A bytes")
+        .value("BGRA", PixelFormat::BGRA, "Straight alpha B, G, R, A bytes")
+        .value("BGRA_PREMULTIPLIED", PixelFormat::BGRA_PREMULTIPLIED, "Premultiplied alpha B, G, R, A bytes")
+        .value("RGB", PixelFormat::RGB, "R, G, B bytes flattened onto the background color")
+        .value("BGR", PixelFormat::BGR, "B, G, R bytes flattened onto the background color")
+        .value("GRAY", PixelFormat::GRAY, "8-bit luma flattened onto the background color")
+        .value("ALPHA", PixelFormat::ALPHA, "8-bit alpha channel only");
+
+    py::enum_<PngFilter>(m, "PngFilter")
+        .value("AUTO", PngFilter::AUTO, "Pick a filter suited to the compression level")
+        .value("NONE", PngFilter::NONE, "No filtering")
+        .value("SUB", PngFilter::SUB, "Difference from the pixel to the left")
+        .value("UP", PngFilter::UP, "Difference from the pixel above")
+        .value("AVERAGE", PngFilter::AVERAGE, "Difference from the average of left and above")
+        .value("PAETH", PngFilter::PAETH, "Difference from the Paeth predictor")
+        .value("ADAPTIVE", PngFilter::ADAPTIVE, "Choose the best filter for each row");
+
+    py::register_exception<LimitExceeded>(m, "LimitExceeded", PyExc_RuntimeError);
+
+    py::class_<PyLimits> PyLimitsClass(m, "Limits");
+    PyLimitsClass.def(py::init([](const py::object &max_input_bytes, const py::object &max_elements, const py::object &max_depth,
+                                  const py::object &max_use_expansion, const py::object &max_pixels, const py::object &max_render_time)
+                               {
+        PyLimits limits;
+        limits.max_input_bytes = limit_from_object<size_t>(max_input_bytes);
+        limits.max_elements = limit_from_object<size_t>(max_elements);
+        limits.max_depth = limit_from_object<size_t>(max_depth);
+        limits.max_use_expansion = limit_from_object<size_t>(max_use_expansion);
+        limits.max_pixels = limit_from_object<uint64_t>(max_pixels);
+        limits.max_render_time = limit_from_object<double>(max_render_time);
+        return limits; }),
+                      py::arg("max_input_bytes") = py::none(), py::arg("max_elements") = py::none(), py::arg("max_depth") = py::none(),
+                      py::arg("max_use_expansion") = py::none(), py::arg("max_pixels") = py::none(), py::arg("max_render_time") = py::none());
+    PyLimitsClass.def("__repr__", [](const PyLimits &limits)
+                      { return "<Limits max_input_bytes=" + py::repr(limit_to_object(limits.max_input_bytes)).cast<std::string>() +
+                               " max_elements=" + py::repr(limit_to_object(limits.max_elements)).cast<std::string>() +
+                               " max_depth=" + py::repr(limit_to_object(limits.max_depth)).cast<std::string>() +
+                               " max_use_expansion=" + py::repr(limit_to_object(limits.max_use_expansion)).cast<std::string>() +
+                               " max_pixels=" + py::repr(limit_to_object(limits.max_pixels)).cast<std::string>() +
+                               " max_render_time=" + py::repr(limit_to_object(limits.max_render_time)).cast<std::string>() + ">"; });
+    PyLimitsClass.def_property(
+        "max_input_bytes", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_input_bytes); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_input_bytes = limit_from_object<size_t>(value); },
+        "Maximum size of the SVG source in bytes");
+    PyLimitsClass.def_property(
+        "max_elements", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_elements); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_elements = limit_from_object<size_t>(value); },
+        "Maximum number of elements in the SVG source");
+    PyLimitsClass.def_property(
+        "max_depth", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_depth); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_depth = limit_from_object<size_t>(value); },
+        "Maximum element nesting depth");
+    PyLimitsClass.def_property(
+        "max_use_expansion", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_use_expansion); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_use_expansion = limit_from_object<size_t>(value); },
+        "Maximum number of element instances added by <use> references");
+    PyLimitsClass.def_property(
+        "max_pixels", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_pixels); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_pixels = limit_from_object<uint64_t>(value); },
+        "Maximum output width times height");
+    PyLimitsClass.def_property(
+        "max_render_time", [](const PyLimits &limits)
+        { return limit_to_object(limits.max_render_time); },
+        [](PyLimits &limits, const py::object &value)
+        { limits.max_render_time = limit_from_object<double>(value); },
+        "Maximum render time in seconds");
+
+    py::class_<PyBitmap> PyBitmapClass(m, "Bitmap", py::buffer_protocol());
+    PyBitmapClass.def_buffer(&PyBitmap::get_buffer_info);
     PyBitmapClass.def(py::init<const std::shared_ptr<lunasvg::Bitmap> &>());
     PyBitmapClass.def(py::init<int, int>());
     PyBitmapClass.def_static("create_for_data", &PyBitmap::create_for_data, py::arg("data"), py::arg("width"), py::arg("height"), py::arg("stride"));
     PyBitmapClass.def("__repr__", &PyBitmap::__repr__);
     PyBitmapClass.def("convert_to_rgba", &PyBitmap::convert_to_rgba, "Convert the bitmap to RGBA format");
-    PyBitmapClass.def("write_to_png", &PyBitmap::write_to_png, py::arg("filename"), "Write the bitmap to a PNG file with the specified filename");
-    PyBitmapClass.def("write_to_png_data", &PyBitmap::write_to_png_data, "Write the bitmap to a PNG and return the data as bytes");
+    PyBitmapClass.def("convert", &PyBitmap::convert, py::arg("format"), py::arg("out") = py::none(), py::arg("background_color") = 0xFFFFFFFF, "Convert the pixels into another layout, writing to a new bytearray or to out");
+    PyBitmapClass.def("write_to_png", &PyBitmap::write_to_png, py::arg("filename"), py::arg("level") = 6, py::arg("filter") = PngFilter::AUTO, "Write the bitmap as PNG to a file, a file-like object or the end of a bytearray");
+    PyBitmapClass.def("write_to_png_data", &PyBitmap::write_to_png_data, py::arg("level") = 6, py::arg("filter") = PngFilter::AUTO, "Write the bitmap to a PNG and return the data as bytes");
     PyBitmapClass.def_property_readonly("data", &PyBitmap::get_data, "Get the raw pixel data of the bitmap as bytes");
     PyBitmapClass.def_property_readonly("width", &PyBitmap::get_width, "Get the width of the bitmap");
     PyBitmapClass.def_property_readonly("height", &PyBitmap::get_height, "Get the height of the bitmap");
     PyBitmapClass.def_property_readonly("stride", &PyBitmap::get_stride, "Get the stride of the bitmap");
     PyBitmapClass.def("clear", &PyBitmap::clear, py::arg("color") = 0, "Clear the bitmap with the specified color");
 
+    py::class_<PyTileIterator> PyTileIteratorClass(m, "TileIterator");
+    PyTileIteratorClass.def("__iter__", [](PyTileIterator &self) -> PyTileIterator & { return self; }, py::return_value_policy::reference_internal);
+    PyTileIteratorClass.def("__next__", &PyTileIterator::next);
+    PyTileIteratorClass.def_property_readonly("width", &PyTileIterator::get_width, "Get the width of the full image");
+    PyTileIteratorClass.def_property_readonly("height", &PyTileIterator::get_height, "Get the height of the full image");
+
+    py::class_<PyFrameIterator> PyFrameIteratorClass(m, "FrameIterator");
+    PyFrameIteratorClass.def("__iter__", [](PyFrameIterator &self) -> PyFrameIterator & { return self; }, py::return_value_policy::reference_internal);
+    PyFrameIteratorClass.def("__next__", &PyFrameIterator::next);
+    PyFrameIteratorClass.def_property_readonly("width", &PyFrameIterator::get_width, "Get the width of the frames");
+    PyFrameIteratorClass.def_property_readonly("height", &PyFrameIterator::get_height, "Get the height of the frames");
+    PyFrameIteratorClass.def_property_readonly("frame_count", &PyFrameIterator::get_frame_count, "Get the total number of frames");
+
+    py::class_<PyStyleSheet> PyStyleSheetClass(m, "StyleSheet");
+    PyStyleSheetClass.def_static("compile", &PyStyleSheet::compile, py::arg("css"), "Compile CSS once for use with any number of documents");
+    PyStyleSheetClass.def("__repr__", &PyStyleSheet::__repr__);
+    PyStyleSheetClass.def_property_readonly("rule_count", &PyStyleSheet::get_rule_count, "Get the number of rules in the style sheet");
+    PyStyleSheetClass.def_property_readonly("css", &PyStyleSheet::get_css, "Get the minified CSS text of the style sheet");
+
     py::class_<PyDocument> PyDocumentClass(m, "Document");
     PyDocumentClass.def(py::init<const std::shared_ptr<lunasvg::Document> &>());
     PyDocumentClass.def("__repr__", &PyDocument::__repr__);
-    PyDocumentClass.def_static("load_from_file", &PyDocument::load_from_file, py::arg("filename"), "Load an SVG document from a file");
-    PyDocumentClass.def_static("load_from_data", &PyDocument::load_from_data, py::arg("data"), "Load an SVG document from a string containing SVG data");
+    PyDocumentClass.def_static("load_from_file", &PyDocument::load_from_file, py::arg("filename"), py::arg("limits") = py::none(), py::arg("stylesheet") = py::none(), py::arg("cloneable") = false, "Load an SVG document from a file");
+    PyDocumentClass.def_static("load_from_data", &PyDocument::load_from_data, py::arg("data"), py::arg("limits") = py::none(), py::arg("stylesheet") = py::none(), py::arg("cloneable") = false, "Load an SVG document from a string containing SVG data");
+    PyDocumentClass.def_static("load_async", &PyDocument::load_async, py::arg("data"), py::arg("limits") = py::none(), py::arg("timeout") = py::none(), py::arg("stylesheet") = py::none(), py::arg("cloneable") = false,
+                               "Parse SVG data on the native worker pool and return an awaitable future");
+    PyDocumentClass.def_static("load_cached", &PyDocument::load_cached, py::arg("data"), py::arg("limits") = py::none(), "Load an SVG document through the process-wide template cache");
+    PyDocumentClass.def_static("cache_info", &PyDocument::cache_info, "Get template cache statistics");
+    PyDocumentClass.def_static("set_cache_limits", &PyDocument::set_cache_limits, py::arg("max_bytes") = 64 * 1024 * 1024, py::arg("max_spares") = 8, "Set the template cache size limits");
+    PyDocumentClass.def_static("clear_cache", &PyDocument::clear_cache, "Empty the template cache and reset its statistics");
+    PyDocumentClass.def("clone", &PyDocument::clone, "Create an independent copy of the document, including its changes");
     PyDocumentClass.def("apply_style_sheet", &PyDocument::apply_style_sheet, py::arg("content"), "Apply a CSS stylesheet to the document");
-    PyDocumentClass.def("render_to_bitmap", &PyDocument::render_to_bitmap, py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000, "Render the SVG document to a bitmap with the specified width, height, and background color");
+    PyDocumentClass.def("render_to_bitmap", &PyDocument::render_to_bitmap, py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000, py::arg("limits") = py::none(), "Render the SVG document to a bitmap with the specified width, height, and background color");
+    PyDocumentClass.def("render_to_bitmap_async", &PyDocument::render_to_bitmap_async,
+                        py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000, py::arg("limits") = py::none(), py::arg("timeout") = py::none(),
+                        "Render the document to a bitmap on the native worker pool and return an awaitable future");
+    PyDocumentClass.def("render_to_png_async", &PyDocument::render_to_png_async,
+                        py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000,
+                        py::arg("level") = 6, py::arg("filter") = PngFilter::AUTO, py::arg("limits") = py::none(), py::arg("timeout") = py::none(),
+                        "Render the document to PNG data on the native worker pool and return an awaitable future");
+    PyDocumentClass.def("render_many", &PyDocument::render_many, py::arg("sizes"), py::arg("background_color") = 0x00000000, py::arg("threads") = 0, py::arg("png") = false, py::arg("downsample") = false, "Render the document at several sizes in parallel and return the results in input order");
+    PyDocumentClass.def("render_to_ico", &PyDocument::render_to_ico,
+                        py::arg("sizes") = py::make_tuple(py::make_tuple(16, 16), py::make_tuple(24, 24), py::make_tuple(32, 32), py::make_tuple(48, 48), py::make_tuple(64, 64), py::make_tuple(128, 128), py::make_tuple(256, 256)),
+                        py::arg("background_color") = 0x00000000, py::arg("threads") = 0, py::arg("downsample") = true,
+                        "Render the document at several sizes and pack them into ICO file data");
+    PyDocumentClass.def("render_tiles", &PyDocument::render_tiles, py::arg("width") = -1, py::arg("height") = -1, py::arg("tile_size") = 256, py::arg("background_color") = 0x00000000, py::arg("threads") = 1, py::arg("reuse") = true, "Render the document tile by tile and iterate over (x, y, bitmap) tuples");
+    PyDocumentClass.def("render_frames", &PyDocument::render_frames, py::arg("keyframes"), py::arg("fps"), py::arg("width") = -1, py::arg("height") = -1,
+                        py::arg("background_color") = 0x00000000, py::arg("duration") = py::none(), py::arg("threads") = 0, py::arg("reuse") = true,
+                        "Render attribute keyframes as a sequence of frames on clones of the document");
+    PyDocumentClass.def("write_to_png", &PyDocument::write_to_png, py::arg("filename"), py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000, py::arg("tile_size") = 256, py::arg("threads") = 0, py::arg("level") = 6, py::arg("filter") = PngFilter::AUTO, "Render the document straight into a PNG file without allocating the full-size bitmap");
     PyDocumentClass.def_property_readonly("width", &PyDocument::get_width, "Get the width of the document");
     PyDocumentClass.def_property_readonly("height", &PyDocument::get_height, "Get the height of the document");
     PyDocumentClass.def_property_readonly("bounding_box", &PyDocument::get_bounding_box, "Get the bounding box of the document");
     PyDocumentClass.def("update_layout", &PyDocument::update_layout, "Update the layout of the document");
     PyDocumentClass.def("render", &PyDocument::render, py::arg("bitmap"), py::arg("matrix") = py::none(), "Render the document to a bitmap");
+    PyDocumentClass.def("render_damaged", &PyDocument::render_damaged, py::arg("bitmap"), py::arg("matrix") = py::none(), py::arg("background_color") = 0x00000000, py::arg("margin") = 2.0f, "Repaint only the regions changed since the previous call and return them");
+    PyDocumentClass.def("invalidate", &PyDocument::invalidate, "Mark the whole document as damaged for the next render_damaged call");
+    PyDocumentClass.def("render_into", &PyDocument::render_into, py::arg("buffer"), py::arg("width"), py::arg("height"), py::arg("stride") = 0, py::arg("matrix") = py::none(), "Render the document into a caller-supplied writable buffer");
     PyDocumentClass.def("get_element_by_id", &PyDocument::get_element_by_id, py::arg("id"), "Get an element by its ID");
     PyDocumentClass.def("document_element", &PyDocument::document_element, "Get the root element of the document");
+    PyDocumentClass.def("query_selector_all", &PyDocument::query_selector_all, py::arg("selector"), "Get all elements matching a CSS selector, in document order");
+    PyDocumentClass.def("elements_by_tag", &PyDocument::elements_by_tag, py::arg("name"), "Get all elements with the given tag name, in document order");
+    PyDocumentClass.def("set_attributes", &PyDocument::set_attributes, py::arg("changes"),
+                        "Apply many (id or element, name, value) attribute changes with a single layout pass");
+    PyDocumentClass.def("build_hit_index", &PyDocument::build_hit_index, "Index the global bounding boxes of the painted elements for hit testing");
+    PyDocumentClass.def("hit_test", &PyDocument::hit_test, py::arg("x"), py::arg("y"), py::arg("exact") = false,
+                        "Get the topmost painted element at a point");
+    PyDocumentClass.def("query_rect", &PyDocument::query_rect, py::arg("box"),
+                        "Get the painted elements whose bounding boxes intersect a box, bottom to top");
+    PyDocumentClass.def("bounding_boxes", &PyDocument::bounding_boxes, py::arg("elements") = py::none(),
+                        "Get the global bounding boxes of many elements as an N x 4 FloatArray");
+    PyDocumentClass.def("global_matrices", &PyDocument::global_matrices, py::arg("elements") = py::none(),
+                        "Get the global matrices of many elements as an N x 6 FloatArray");
 
     // Definition of Element class
     py::class_<PyElement> PyElementClass(m, "Element");
@@ -708,12 +7623,43 @@ PYBIND11_MODULE(pylunasvg, m)
     PyElementClass.def("get_bounding_box", &PyElement::get_bounding_box, "Get the element's bounding box");
     PyElementClass.def("parent_element", &PyElement::parent_element, "Get the parent element");
     PyElementClass.def("owner_document", &PyElement::owner_document, "Get the owner document");
+    PyElementClass.def("children", &PyElement::children, "Get the child elements");
+    PyElementClass.def("first_child", &PyElement::first_child, "Get the first child element");
+    PyElementClass.def("next_sibling", &PyElement::next_sibling, "Get the next sibling element");
+    PyElementClass.def_property_readonly("tag_name", &PyElement::tag_name, "Get the element's tag name");
+
+    m.def("render_many", &render_many,
+          py::arg("sources"), py::arg("width") = -1, py::arg("height") = -1, py::arg("background_color") = 0x00000000,
+          py::arg("threads") = 0, py::arg("png") = false, py::arg("limits") = py::none(),
+          "Parse and render many SVG sources on the native worker pool and return the results in input order");
+    m.def("build_atlas", &build_atlas,
+          py::arg("items"), py::arg("sizes"), py::arg("padding") = 1, py::arg("background_color") = 0x00000000,
+          py::arg("width") = 0, py::arg("threads") = 0,
+          "Render documents and elements at several sizes into one packed atlas bitmap");
+
+    m.def(
+        "enable_stats", [](bool enabled)
+        { Stats::instance().set_enabled(enabled); },
+        py::arg("enabled") = true, "Turn the collection of per-phase timings and bitmap allocations on or off");
+    m.def("get_stats", &get_stats, "Get the collected timings, bitmap allocations and live object counts");
+    m.def(
+        "reset_stats", []
+        { Stats::instance().reset(); },
+        "Zero the collected timings and bitmap allocations");
 
     m.def(
         "add_font_face_from_file",
         [](const std::string &family, bool bold, bool italic, const std::string &filename)
         {
-            bool success = lunasvg_add_font_face_from_file(family.c_str(), bold, italic, filename.c_str());
+            bool success = false;
+            {
+                py::gil_scoped_release release;
+                if (auto data = read_file_source(filename))
+                {
+                    std::unique_lock<std::shared_mutex> fonts(font_registry_mutex());
+                    success = FontCache::instance().add(family, bold, italic, data, data->data(), data->size()) != FontCache::AddResult::Invalid;
+                }
+            }
             if (!success)
             {
                 throw std::runtime_error("Failed to add font face from file");
@@ -726,8 +7672,15 @@ PYBIND11_MODULE(pylunasvg, m)
         "add_font_face_from_data",
         [](const std::string &family, bool bold, bool italic, py::bytes data)
         {
-            py::buffer_info info = py::buffer(data).request();
-            bool success = lunasvg_add_font_face_from_data(family.c_str(), bold, italic, info.ptr, info.size, nullptr, nullptr);
+            // lunasvg keeps using the data after this call, so the face gets
+            // its own copy rather than borrowing from the bytes object.
+            auto owned = std::make_shared<StringSource>(data.cast<std::string>());
+            bool success;
+            {
+                py::gil_scoped_release release;
+                std::unique_lock<std::shared_mutex> fonts(font_registry_mutex());
+                success = FontCache::instance().add(family, bold, italic, owned, owned->data(), owned->size()) != FontCache::AddResult::Invalid;
+            }
             if (!success)
             {
                 throw std::runtime_error("Failed to add font face from data");
@@ -735,4 +7688,62 @@ PYBIND11_MODULE(pylunasvg, m)
             return py::none();
         },
         py::arg("family"), py::arg("bold"), py::arg("italic"), py::arg("data"));
+
+    m.def("add_font_directory", &add_font_directory, py::arg("path"), py::arg("recursive") = true, py::arg("threads") = 0,
+          "Load every TrueType and OpenType font in a directory, named by the family and style they declare");
+
+    m.def(
+        "font_faces", []()
+        {
+            py::list results;
+            std::vector<FontCache::Face> faces;
+            {
+                py::gil_scoped_release release;
+                std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                faces = FontCache::instance().get_faces();
+            }
+            for (const auto &face : faces)
+            {
+                results.append(py::make_tuple(face.family, face.bold, face.italic));
+            }
+            return results; },
+        "Get the (family, bold, italic) font faces added so far, in order");
+
+    m.def(
+        "save_font_snapshot", [](const std::string &filename)
+        {
+            size_t count;
+            {
+                py::gil_scoped_release release;
+                std::vector<FontCache::Face> faces;
+                {
+                    std::shared_lock<std::shared_mutex> fonts(font_registry_mutex());
+                    faces = FontCache::instance().get_faces();
+                }
+                write_font_snapshot(filename, faces);
+                count = faces.size();
+            }
+            return count; },
+        py::arg("filename"), "Write the added font faces to a snapshot file that other processes can map");
+
+    m.def(
+        "load_font_snapshot", [](const std::string &filename)
+        {
+            int added = 0;
+            {
+                py::gil_scoped_release release;
+                const auto faces = read_font_snapshot(filename);
+                std::unique_lock<std::shared_mutex> fonts(font_registry_mutex());
+                for (const auto &face : faces)
+                {
+                    const auto result = FontCache::instance().add(face.family, face.bold, face.italic, face.owner, face.data, face.length);
+                    if (result == FontCache::AddResult::Invalid)
+                    {
+                        throw std::runtime_error("Invalid font snapshot: " + filename);
+                    }
+                    added += result == FontCache::AddResult::Added;
+                }
+            }
+            return added; },
+        py::arg("filename"), "Map a font snapshot file and add its faces without copying them");
 }
\ No newline at end of file
@@ -2,8 +2,30 @@
 Python bindings for lunasvg, a standalone SVG rendering library.
 This module provides classes and functions for loading, manipulating,
 and rendering SVG documents.
+
+Thread safety:
+    Parsing, style sheet application, layout, rendering, RGBA conversion
+    and PNG encoding release the GIL, so work on separate threads runs in
+    parallel.
+
+    - Separate Documents can be used from any number of threads at once.
+    - A single Document (and the Elements obtained from it) can be shared
+      between threads; calls on it are serialized by a per-document lock.
+    - The font registry is global and guarded by a reader/writer lock, so
+      fonts can be registered while other threads parse and render.
+    - Bitmaps are not locked. Reading a Bitmap from several threads is
+      safe, but rendering into, clearing or converting the same Bitmap
+      from more than one thread at a time produces undefined pixels.
 """
 
+import asyncio
+import enum
+import os
+from typing import BinaryIO, Iterable, Iterator, Union
+
+WritableBuffer = Union[bytearray, memoryview, "mmap.mmap", "numpy.ndarray"]
+ReadableBuffer = Union[bytes, bytearray, memoryview, "mmap.mmap", "numpy.ndarray"]
+
 class Matrix:
     """
     A 2D transformation matrix representing affine transformations.
@@ -286,6 +308,94 @@ class Matrix:
             A new matrix representing the inverse of this matrix
         """
         ...
+    
+    @staticmethod
+    def compose(matrices: Iterable['Matrix']) -> 'Matrix':
+        """
+        Multiply a sequence of matrices in order.
+        
+        Equivalent to chaining the matrices with `*`, without creating
+        the intermediate Python objects.
+        
+        Args:
+            matrices: The matrices to multiply, first to last
+            
+        Returns:
+            The product (the identity for an empty sequence)
+        """
+        ...
+    
+    def map_points(self, points: ReadableBuffer, out: WritableBuffer | None = None) -> 'FloatArray' | WritableBuffer:
+        """
+        Transform many points in one call.
+        
+        The loop runs natively with the GIL released.
+        
+        Args:
+            points: C-contiguous float32 or float64 buffer of x, y pairs,
+                for example an N x 2 numpy array
+            out: Optional float32 or float64 buffer with room for as many
+                pairs; may be the input itself
+            
+        Returns:
+            out, or a new N x 2 FloatArray
+            
+        Raises:
+            TypeError: If a buffer does not hold float32 or float64 values
+            ValueError: If the buffer sizes do not match
+        """
+        ...
+    
+    def map_boxes(self, boxes: ReadableBuffer, out: WritableBuffer | None = None) -> 'FloatArray' | WritableBuffer:
+        """
+        Transform many boxes in one call.
+        
+        Each x, y, width, height row is replaced by the bounding box of
+        the transformed rectangle, as Box.transformed() does.
+        
+        Args:
+            boxes: C-contiguous float32 or float64 buffer of x, y, width,
+                height rows, for example an N x 4 numpy array
+            out: Optional float32 or float64 buffer with room for as many
+                rows; may be the input itself
+            
+        Returns:
+            out, or a new N x 4 FloatArray
+            
+        Raises:
+            TypeError: If a buffer does not hold float32 or float64 values
+            ValueError: If the buffer sizes do not match
+        """
+        ...
+
+class FloatArray:
+    """
+    A rows x columns array of float32 values returned by batch APIs.
+    
+    It supports the buffer protocol, so numpy.asarray() and memoryview
+    expose the values without copying.
+    """
+    
+    def __len__(self) -> int:
+        """Return the number of rows."""
+        ...
+    
+    def __getitem__(self, index: int) -> tuple[float, ...]:
+        """Return one row as a tuple."""
+        ...
+    
+    def __buffer__(self, flags: int) -> memoryview:
+        """Return a zero-copy view of the values."""
+        ...
+    
+    @property
+    def shape(self) -> tuple[int, int]:
+        """Get the (rows, columns) shape of the array."""
+        ...
+    
+    def tolist(self) -> list[tuple[float, ...]]:
+        """Return the rows as a list of tuples."""
+        ...
 
 class Box:
     """
@@ -390,11 +500,103 @@ class Box:
         """
         ...
 
+class PixelFormat(enum.Enum):
+    """
+    Pixel layouts that Bitmap.convert() can produce.
+    
+    Straight alpha layouts divide the color channels by alpha; the
+    premultiplied ones keep lunasvg's premultiplied values. The RGB, BGR
+    and GRAY layouts are flattened onto a background color.
+    """
+    RGBA = ...
+    RGBA_PREMULTIPLIED = ...
+    BGRA = ...
+    BGRA_PREMULTIPLIED = ...
+    RGB = ...
+    BGR = ...
+    GRAY = ...
+    ALPHA = ...
+
+class PngFilter(enum.Enum):
+    """
+    Row filters the PNG encoder can apply before compression.
+    
+    AUTO uses NONE at level 0, UP at level 1 and ADAPTIVE otherwise.
+    ADAPTIVE tries every filter on each row and keeps the one with the
+    smallest residuals; it compresses best but filters five times.
+    """
+    AUTO = ...
+    NONE = ...
+    SUB = ...
+    UP = ...
+    AVERAGE = ...
+    PAETH = ...
+    ADAPTIVE = ...
+
+class LimitExceeded(RuntimeError):
+    """Raised when SVG input exceeds one of the Limits it is processed with."""
+
+class Limits:
+    """
+    Resource limits for untrusted SVG input.
+    
+    Accepted by the Document loaders, including load_cached(), by the
+    render_to_bitmap() family and by pylunasvg.render_many(). A document keeps the limits it was loaded
+    with and applies them to every way of rendering it or its elements:
+    render(), render_into(), render_damaged(), render_many(),
+    render_to_ico(), render_tiles(), render_frames(), write_to_png() and
+    build_atlas(), where each item keeps the limits of its own document.
+    Every limit is None (disabled) by default, and the checks behind a
+    disabled limit are skipped entirely.
+    
+    Size, element count and nesting depth are checked with a scan of the
+    source before lunasvg parses it. The <use> expansion is checked on the
+    parsed tree. The output size is checked before any pixels are
+    allocated, for every size a call produces; for render(), render_into()
+    and render_damaged() it is the size of the target. A render time
+    limit covers a whole call and makes it render in bands, tiles, sizes
+    or frames, stopping between two of them once the time is up. For
+    render_tiles() and render_frames() it covers the rendering done by
+    all batches.
+    """
+    
+    def __init__(self, max_input_bytes: int | None = None, max_elements: int | None = None, max_depth: int | None = None, max_use_expansion: int | None = None, max_pixels: int | None = None, max_render_time: float | None = None) -> None:
+        """
+        Initialize limits.
+        
+        Args:
+            max_input_bytes: Maximum size of the SVG source in bytes
+            max_elements: Maximum number of elements in the SVG source
+            max_depth: Maximum element nesting depth
+            max_use_expansion: Maximum number of element instances added
+                by <use> references, counting nested references
+            max_pixels: Maximum output width times height
+            max_render_time: Maximum render time in seconds
+            
+        Raises:
+            ValueError: If a limit is not positive
+        """
+        ...
+    
+    max_input_bytes: int | None
+    max_elements: int | None
+    max_depth: int | None
+    max_use_expansion: int | None
+    max_pixels: int | None
+    max_render_time: float | None
+
 class Bitmap:
     """
     A bitmap representation for rendering SVG content.
     
-    The bitmap stores pixel data in RGBA format, 8 bits per channel.
+    The bitmap stores premultiplied ARGB32 pixels (BGRA byte order on
+    little-endian machines), 8 bits per channel, until convert_to_rgba()
+    turns them into straight RGBA.
+    
+    Bitmap implements the buffer protocol: memoryview(bitmap) and
+    numpy.asarray(bitmap) return a writable height x width x 4 uint8 view
+    of the pixels without copying. The view honors the stride and keeps
+    the bitmap alive.
     """
     def __init__(self, width: int, height: int) -> None:
         """
@@ -410,21 +612,31 @@ class Bitmap:
         ...
     
     @staticmethod
-    def create_for_data(data: bytes, width: int, height: int, stride: int) -> 'Bitmap':
+    def create_for_data(data: WritableBuffer, width: int, height: int, stride: int) -> 'Bitmap':
         """
-        Create a bitmap using the provided pixel data.
+        Create a bitmap that renders directly into a caller-supplied buffer.
+        
+        Any writable, C-contiguous buffer of 8-bit or 32-bit integers is
+        accepted: bytearray, writable memoryview, NumPy array, mmap or
+        multiprocessing.shared_memory.SharedMemory.buf. No pixels are
+        copied; the bitmap keeps the buffer exported (and therefore alive
+        and non-resizable) for as long as the bitmap exists.
         
         Args:
-            data: Raw pixel data
+            data: Writable pixel buffer, aligned to 4 bytes
             width: Width of the bitmap in pixels
             height: Height of the bitmap in pixels
-            stride: Number of bytes per row
+            stride: Number of bytes per row, a multiple of 4 of at least width * 4
             
         Returns:
             A new bitmap using the provided pixel data
             
         Raises:
-            RuntimeError: If bitmap creation fails
+            BufferError: If the buffer is read-only
+            TypeError: If the buffer does not contain 8-bit or 32-bit integers
+            ValueError: If the dimensions or stride are invalid, or the
+                buffer is not contiguous or not aligned
+            RuntimeError: If the buffer is too small or bitmap creation fails
         """
         ...
     
@@ -441,12 +653,43 @@ class Bitmap:
         """
         ...
     
-    def write_to_png(self, filename: str) -> None:
+    def convert(self, format: PixelFormat, out: WritableBuffer | None = None, background_color: int = 0xFFFFFFFF) -> bytearray | WritableBuffer:
         """
-        Write the bitmap to a PNG file with the specified filename.
+        Convert the pixels into another layout without modifying the bitmap.
+        
+        Runs SIMD kernels (SSE2/AVX2 on x86, NEON on ARM64, scalar
+        elsewhere) with the GIL released. Rows are written packed, so the
+        output holds width * height * bytes-per-pixel bytes.
         
         Args:
-            filename: Path to write the PNG file
+            format: Target pixel layout
+            out: Optional writable buffer to write into instead of a new bytearray
+            background_color: RGBA color (0xRRGGBBAA, alpha ignored) that the
+                RGB, BGR and GRAY layouts are flattened onto (default: white)
+            
+        Returns:
+            A new bytearray, or out when it was given
+            
+        Raises:
+            RuntimeError: If the bitmap is null or out is too small
+            TypeError: If out is not a writable integer buffer
+        """
+        ...
+    
+    def write_to_png(self, filename: str | os.PathLike[str] | BinaryIO | bytearray, level: int = 6, filter: PngFilter = PngFilter.AUTO) -> None:
+        """
+        Write the bitmap as PNG.
+        
+        Encoding runs with the GIL released. When writing to a file-like
+        object, the GIL is taken again only to pass each 64 KiB block of
+        output to its write() method.
+        
+        Args:
+            filename: Path to write the PNG file, a binary file-like object
+                with a write() method, or a bytearray the PNG is appended to
+            level: Compression level from 0 (store only, fastest) to 9;
+                1 is a fast mode meant for low-latency previews
+            filter: Row filter strategy
             
         Raises:
             RuntimeError: If writing the PNG file fails
@@ -454,10 +697,15 @@ class Bitmap:
         """
         ...
     
-    def write_to_png_data(self) -> bytes:
+    def write_to_png_data(self, level: int = 6, filter: PngFilter = PngFilter.AUTO) -> bytes:
         """
         Write the bitmap to a PNG and return the data as bytes.
         
+        Args:
+            level: Compression level from 0 (store only, fastest) to 9;
+                1 is a fast mode meant for low-latency previews
+            filter: Row filter strategy
+            
         Returns:
             PNG encoded data as bytes
             
@@ -466,13 +714,20 @@ class Bitmap:
         """
         ...
     
+    def __buffer__(self, flags: int) -> memoryview:
+        """Return a zero-copy height x width x 4 uint8 view of the pixels."""
+        ...
+    
     @property
     def data(self) -> bytes:
         """
-        Get the raw pixel data of the bitmap as bytes.
+        Get a copy of the raw pixel data of the bitmap as bytes.
+        
+        Rows are packed without stride padding. Use memoryview(bitmap) to
+        access the pixels without copying.
         
         Returns:
-            Raw pixel data in RGBA format
+            Raw pixel data, width * height * 4 bytes
             
         Raises:
             RuntimeError: If the bitmap is null
@@ -503,6 +758,96 @@ class Bitmap:
         """
         ...
 
+class TileIterator:
+    """
+    Iterator over the tiles of a document rendered by Document.render_tiles.
+    
+    Yields (x, y, bitmap) tuples in row-major order, where (x, y) is the
+    position of the tile's top-left pixel in the full image. Tiles on the
+    right and bottom edges are smaller than tile_size when the image size
+    is not a multiple of it.
+    """
+    
+    def __iter__(self) -> Iterator[tuple[int, int, Bitmap]]: ...
+    
+    def __next__(self) -> tuple[int, int, Bitmap]: ...
+    
+    @property
+    def width(self) -> int:
+        """Get the width of the full image in pixels."""
+        ...
+    
+    @property
+    def height(self) -> int:
+        """Get the height of the full image in pixels."""
+        ...
+
+class FrameIterator:
+    """
+    Iterator over the frames of an animation rendered by Document.render_frames.
+    
+    Yields one bitmap per frame, in order.
+    """
+    
+    def __iter__(self) -> Iterator[Bitmap]: ...
+    
+    def __next__(self) -> Bitmap: ...
+    
+    @property
+    def width(self) -> int:
+        """Get the width of the frames in pixels."""
+        ...
+    
+    @property
+    def height(self) -> int:
+        """Get the height of the frames in pixels."""
+        ...
+    
+    @property
+    def frame_count(self) -> int:
+        """Get the total number of frames."""
+        ...
+
+class StyleSheet:
+    """
+    A CSS style sheet compiled once and shared by any number of documents.
+    
+    Compiling strips comments and whitespace and indexes the rules by the
+    tags, IDs and classes their selectors require. Applying the sheet to a
+    document passes only the rules that can match one of its elements.
+    A StyleSheet is immutable and can be used from several threads.
+    """
+    
+    @staticmethod
+    def compile(css: str) -> 'StyleSheet':
+        """
+        Compile CSS text.
+        
+        Args:
+            css: CSS content
+            
+        Returns:
+            A new StyleSheet
+            
+        Raises:
+            TypeError: If css is not a string
+        """
+        ...
+    
+    def __repr__(self) -> str:
+        """Return string representation of the style sheet."""
+        ...
+    
+    @property
+    def rule_count(self) -> int:
+        """Get the number of non-empty rules, at-rules included."""
+        ...
+    
+    @property
+    def css(self) -> str:
+        """Get the minified CSS text."""
+        ...
+
 class Element:
     """
     Represents an SVG element within a Document.
@@ -637,6 +982,42 @@ class Element:
             Owner document or None if the element is not associated with a document
         """
         ...
+    
+    @property
+    def tag_name(self) -> str:
+        """
+        Get the element's tag name, such as "rect" or "linearGradient".
+        """
+        ...
+    
+    def children(self) -> list['Element']:
+        """
+        Get the child elements.
+        
+        Text nodes are skipped. The whole list is built natively in one call.
+        
+        Returns:
+            Child elements in document order
+        """
+        ...
+    
+    def first_child(self) -> 'Element | None':
+        """
+        Get the first child element.
+        
+        Returns:
+            First child element or None if the element has no child elements
+        """
+        ...
+    
+    def next_sibling(self) -> 'Element | None':
+        """
+        Get the next sibling element.
+        
+        Returns:
+            Next sibling element or None if this is the last child element
+        """
+        ...
 
 class Document:
     """
@@ -649,46 +1030,181 @@ class Document:
         ...
     
     @staticmethod
-    def load_from_file(filename: str) -> 'Document':
+    def load_from_file(filename: str, limits: Limits | None = None, stylesheet: StyleSheet | str | None = None, cloneable: bool = False) -> 'Document':
         """
         Load an SVG document from a file.
         
+        The file is memory-mapped rather than read into a buffer. The
+        mapping is released once the file is parsed, unless the document
+        is cloneable, in which case it is kept for Document.clone().
+        Replacing the file (writing a new one and renaming it over the
+        old) is safe while a cloneable document is alive; truncating it
+        in place is not.
+        
         Args:
             filename: Path to the SVG file to load
+            limits: Limits checked while loading, and kept for rendering
+            stylesheet: Style sheet cascaded together with the document's
+                own styles while parsing, and kept by clones
+            cloneable: Keep the source and record attribute changes, so
+                that clone() and render_frames() work; off by default,
+                since it holds the source in memory and slows down every
+                set_attribute()
             
         Returns:
             A new Document containing the loaded SVG
             
         Raises:
             RuntimeError: If loading the SVG file fails
+            LimitExceeded: If a limit is exceeded
             ValueError: If filename is None
         """
         ...
     
     @staticmethod
-    def load_from_data(data: str | bytes | bytearray) -> 'Document':
+    def load_from_data(data: str | ReadableBuffer, limits: Limits | None = None, stylesheet: StyleSheet | str | None = None, cloneable: bool = False) -> 'Document':
         """
         Load an SVG document from data.
         
+        str, bytes and read-only buffers (such as a memoryview of bytes or
+        an mmap opened with ACCESS_READ) are parsed in place without a
+        copy. Writable buffers (bytearray, a writable memoryview or mmap)
+        are copied once before parsing, since their contents could change
+        while the GIL is released, so they briefly cost their size again
+        in memory. The data (or its copy) is released once parsed unless
+        the document is cloneable.
+        
         Args:
-            data: SVG content as string, bytes or bytearray
+            data: SVG content as string or any bytes-like object
+            limits: Limits checked while loading, and kept for rendering
+            stylesheet: As in load_from_file()
+            cloneable: As in load_from_file()
             
         Returns:
             A new Document containing the loaded SVG
             
         Raises:
             RuntimeError: If loading the SVG data fails
+            LimitExceeded: If a limit is exceeded
             ValueError: If data is None or empty
             TypeError: If data is not a string, bytes or bytearray
         """
         ...
     
-    def apply_style_sheet(self, content: str) -> None:
+    @staticmethod
+    def load_async(data: str | ReadableBuffer, limits: Limits | None = None, timeout: float | None = None, stylesheet: StyleSheet | str | None = None, cloneable: bool = False) -> 'asyncio.Future[Document]':
+        """
+        Parse SVG data on the native worker pool.
+        
+        Must be called with an asyncio event loop running. The data is
+        referenced as in load_from_data() and parsed without the GIL; the
+        returned future completes on the loop.
+        
+        Args:
+            data: SVG content as string or any bytes-like object
+            limits: As in load_from_data()
+            timeout: Optional limit in seconds
+            stylesheet: As in load_from_file()
+            cloneable: As in load_from_file()
+            
+        Returns:
+            A future resolving to a new Document
+            
+        Raises:
+            RuntimeError: If no event loop is running; through the future,
+                if loading the SVG data fails
+            LimitExceeded: Through the future, if a limit is exceeded
+            TimeoutError: Through the future, if the timeout expires
+        """
+        ...
+    
+    @staticmethod
+    def load_cached(data: str | ReadableBuffer, limits: Limits | None = None) -> Document:
+        """
+        Load an SVG document through the process-wide template cache.
+        
+        The cache is keyed by the content of data. Every call returns a
+        private document that can be changed freely. When it is dropped,
+        its attribute changes are rolled back and the parsed tree is kept
+        for the next load of the same content, so templates that are
+        loaded, customized and rendered over and over skip parsing.
+        Documents whose changes cannot be rolled back (new attributes or
+        style sheets) are discarded instead.
+        
+        Args:
+            data: SVG content as string or any bytes-like object
+            limits: As in load_from_data(); checked on every load, including
+                loads served from the cache
+            
+        Returns:
+            A Document instance
+            
+        Raises:
+            RuntimeError: If parsing fails
+            LimitExceeded: If a limit is exceeded
+        """
+        ...
+    
+    @staticmethod
+    def cache_info() -> dict[str, int]:
+        """
+        Get template cache statistics.
+        
+        Returns:
+            A dict with hits (loads served by a parsed spare), misses
+            (loads that had to parse), entries, spares, bytes, max_bytes
+            and max_spares
+        """
+        ...
+    
+    @staticmethod
+    def set_cache_limits(max_bytes: int = 67108864, max_spares: int = 8) -> None:
+        """
+        Set the template cache size limits.
+        
+        The least recently used templates are evicted to stay within
+        max_bytes, which counts the source of every cached template once
+        plus once more for each parsed spare.
+        
+        Args:
+            max_bytes: Maximum number of bytes held by the cache
+            max_spares: Maximum number of parsed spares kept per template
+        """
+        ...
+    
+    @staticmethod
+    def clear_cache() -> None:
+        """Empty the template cache and reset its statistics."""
+        ...
+    
+    def clone(self) -> Document:
+        """
+        Create an independent copy of the document.
+        
+        The copy starts from the source the document was loaded from
+        (a parsed spare when the document came from load_cached) and
+        has every attribute change and style sheet applied so far
+        replayed onto it. Only documents loaded with cloneable=True or
+        through load_cached keep their source and changes for this.
+        
+        Returns:
+            A new Document instance
+            
+        Raises:
+            RuntimeError: If the document was not loaded with
+                cloneable=True or through load_cached
+        """
+        ...
+    
+    def apply_style_sheet(self, content: str | StyleSheet) -> None:
         """
         Apply a CSS stylesheet to the document.
         
+        A compiled StyleSheet only passes lunasvg the rules that can match
+        an element of this document.
+        
         Args:
-            content: CSS content to apply
+            content: CSS content or compiled StyleSheet to apply
             
         Raises:
             ValueError: If content is None
@@ -696,7 +1212,7 @@ class Document:
         """
         ...
     
-    def render_to_bitmap(self, width: int = -1, height: int = -1, background_color: int = 0) -> Bitmap:
+    def render_to_bitmap(self, width: int = -1, height: int = -1, background_color: int = 0, limits: Limits | None = None) -> Bitmap:
         """
         Render the SVG document to a bitmap.
         
@@ -704,12 +1220,220 @@ class Document:
             width: Width of the output bitmap (-1 uses the document's width)
             height: Height of the output bitmap (-1 uses the document's height)
             background_color: Background color for the bitmap (default: transparent)
+            limits: Output pixel and render time limits; defaults to the
+                limits the document was loaded with
             
         Returns:
             A new bitmap containing the rendered document
             
         Raises:
             RuntimeError: If rendering fails
+            LimitExceeded: If a limit is exceeded
+        """
+        ...
+    
+    def render_to_bitmap_async(self, width: int = -1, height: int = -1, background_color: int = 0, limits: Limits | None = None, timeout: float | None = None) -> 'asyncio.Future[Bitmap]':
+        """
+        Render the document to a bitmap on the native worker pool.
+        
+        Must be called with an asyncio event loop running; the event loop is
+        never blocked by the render. The document is rendered in horizontal
+        bands and stops between two bands when the returned future is
+        cancelled (asyncio.wait_for() cancels it on timeout) or the timeout
+        expires.
+        
+        Args:
+            width: Width of the output bitmap (-1 for auto)
+            height: Height of the output bitmap (-1 for auto)
+            background_color: Background color for the bitmap (default: transparent)
+            limits: As in render_to_bitmap()
+            timeout: Optional limit in seconds
+            
+        Returns:
+            A future resolving to the rendered Bitmap
+            
+        Raises:
+            RuntimeError: If no event loop is running; through the future,
+                if rendering fails
+            LimitExceeded: Through the future, if a limit is exceeded
+            TimeoutError: Through the future, if the timeout expires
+        """
+        ...
+    
+    def render_to_png_async(self, width: int = -1, height: int = -1, background_color: int = 0, level: int = 6, filter: PngFilter = PngFilter.AUTO, limits: Limits | None = None, timeout: float | None = None) -> 'asyncio.Future[bytes]':
+        """
+        Render the document to PNG data on the native worker pool.
+        
+        Behaves like render_to_bitmap_async() and also encodes the result,
+        which can be interrupted the same way.
+        
+        Args:
+            width: Width of the output image (-1 for auto)
+            height: Height of the output image (-1 for auto)
+            background_color: Background color for the bitmap (default: transparent)
+            level: Compression level from 0 (store only, fastest) to 9
+            filter: Row filter strategy
+            limits: As in render_to_bitmap()
+            timeout: Optional limit in seconds
+            
+        Returns:
+            A future resolving to the PNG data
+            
+        Raises:
+            RuntimeError: If no event loop is running; through the future,
+                if rendering or encoding fails
+            LimitExceeded: Through the future, if a limit is exceeded
+            TimeoutError: Through the future, if the timeout expires
+        """
+        ...
+    
+    def render_many(self, sizes: Iterable[tuple[int, int]], background_color: int = 0, threads: int = 0, png: bool = False, downsample: bool = False) -> list[Bitmap] | list[bytes]:
+        """
+        Render the document at several sizes in parallel.
+        
+        The document is laid out once and then rasterized concurrently on
+        the native worker pool. The document lock is held for the whole
+        batch.
+        
+        With downsample enabled, a size whose exact double is also in
+        `sizes` is produced by a 2x2 box filter over that larger render
+        instead of being rasterized again, so 16, 32, 64 ... 1024 costs a
+        single render. The result is the larger image supersampled, which
+        can differ slightly from a direct render at the small size.
+        
+        Args:
+            sizes: (width, height) pairs; 0 selects the document's size
+                and -1 keeps the aspect ratio of the other dimension
+            background_color: Background color for the bitmaps (default: transparent)
+            threads: Maximum number of threads to use (0 uses one per core)
+            png: Return PNG encoded bytes instead of bitmaps
+            downsample: Derive sizes from renders at twice their size
+            
+        Returns:
+            One bitmap (or PNG bytes) per size, in input order
+            
+        Raises:
+            RuntimeError: If rendering or encoding fails
+        """
+        ...
+    
+    def render_to_ico(self, sizes: Iterable[tuple[int, int]] = ((16, 16), (24, 24), (32, 32), (48, 48), (64, 64), (128, 128), (256, 256)), background_color: int = 0, threads: int = 0, downsample: bool = True) -> bytes:
+        """
+        Render the document at several sizes and pack them into an ICO file.
+        
+        Every size is stored as a PNG image, which Windows Vista and later
+        read natively. Rendering works as in render_many.
+        
+        Args:
+            sizes: (width, height) pairs, each between 1 and 256
+            background_color: Background color for the images (default: transparent)
+            threads: Maximum number of threads to use (0 uses one per core)
+            downsample: Derive sizes from renders at twice their size
+            
+        Returns:
+            The ICO file data
+            
+        Raises:
+            ValueError: If a size is out of range or no sizes are given
+            RuntimeError: If rendering or encoding fails
+        """
+        ...
+    
+    def render_tiles(self, width: int = -1, height: int = -1, tile_size: int = 256, background_color: int = 0, threads: int = 1, reuse: bool = True) -> TileIterator:
+        """
+        Render the document tile by tile.
+        
+        Each tile is rendered through a translated matrix into a tile-sized
+        buffer, so memory use depends on the tile size and not on the size
+        of the full image. Tiles are rendered ahead in batches of `threads`
+        on the native worker pool.
+        
+        With reuse enabled (the default) the tile buffers are recycled: a
+        yielded bitmap is overwritten once the iterator renders its next
+        batch, so copy the pixels out (for example with Bitmap.convert) if
+        they are needed for longer.
+        
+        Args:
+            width: Width of the full image (-1 keeps the aspect ratio, 0 uses the document width)
+            height: Height of the full image (-1 keeps the aspect ratio, 0 uses the document height)
+            tile_size: Width and height of a tile in pixels
+            background_color: Background color for the tiles (default: transparent)
+            threads: Number of tiles to render concurrently (0 uses one per core)
+            reuse: Recycle tile buffers between batches
+            
+        Returns:
+            An iterator of (x, y, bitmap) tuples
+            
+        Raises:
+            RuntimeError: If the document has no size
+            ValueError: If tile_size is not positive
+        """
+        ...
+    
+    def render_frames(self, keyframes: Iterable[tuple[str | Element, str, Iterable[tuple[float, str | float]]]], fps: float, width: int = -1, height: int = -1, background_color: int = 0, duration: float | None = None, threads: int = 0, reuse: bool = True) -> FrameIterator:
+        """
+        Render an attribute animation as a sequence of frames.
+        
+        Each track names an element (by ID or as an Element of this
+        document), an attribute and its (time, value) keyframes, with times
+        in seconds. Frame n shows every attribute at time n / fps:
+        values are interpolated linearly between keyframes when they
+        differ only in their numbers, as with "translate(0, 0) rotate(0)"
+        and "translate(50, 10) rotate(90)" or "0.5" and "1", and hex colors
+        are interpolated in RGB. Other values switch at the next keyframe.
+        Before the first and after the last keyframe the attribute keeps
+        that keyframe's value.
+        
+        Frames are rendered natively in batches, one frame per worker
+        thread, each worker on its own clone of the document, so the
+        document itself is not changed. Like Document.clone, this needs
+        cloneable=True at load time (or load_cached).
+        
+        With reuse enabled (the default) the frame bitmaps are recycled: a
+        yielded bitmap is overwritten once the iterator renders its next
+        batch, so copy or encode it before moving on if it is needed for
+        longer.
+        
+        Args:
+            keyframes: (target, name, keyframes) tracks
+            fps: Frames per second
+            width: Width of the frames (-1 keeps the aspect ratio, 0 uses the document width)
+            height: Height of the frames (-1 keeps the aspect ratio, 0 uses the document height)
+            background_color: Background color for the frames (default: transparent)
+            duration: Length of the animation in seconds (default: the last keyframe time)
+            threads: Maximum number of frames rendered at once (0 uses one per core)
+            reuse: Recycle the frame bitmaps between batches
+            
+        Returns:
+            An iterator of frame bitmaps, floor(duration * fps) + 1 in total
+            
+        Raises:
+            ValueError: If a track or keyframe is malformed, or an element is not found
+            RuntimeError: If the source is not available or the document has no size
+        """
+        ...
+    
+    def write_to_png(self, filename: str, width: int = -1, height: int = -1, background_color: int = 0, tile_size: int = 256, threads: int = 0, level: int = 6, filter: PngFilter = PngFilter.AUTO) -> None:
+        """
+        Render the document straight into a PNG file.
+        
+        The image is rendered in bands of tile_size rows that are encoded
+        as soon as they are ready, so the full-size bitmap is never
+        allocated. Use this for outputs too large for render_to_bitmap.
+        
+        Args:
+            filename: Path where the PNG file will be saved
+            width: Width of the image (-1 keeps the aspect ratio, 0 uses the document width)
+            height: Height of the image (-1 keeps the aspect ratio, 0 uses the document height)
+            background_color: Background color (default: transparent)
+            tile_size: Size of the tiles each band is split into
+            threads: Maximum number of threads rendering a band (0 uses one per core)
+            level: Compression level from 0 (store only) to 9
+            filter: Row filter strategy
+            
+        Raises:
+            RuntimeError: If rendering fails or the file cannot be written
+            ValueError: If tile_size is not positive
         """
         ...
     
@@ -742,6 +1466,67 @@ class Document:
         """
         ...
     
+    def render_into(self, buffer: WritableBuffer, width: int, height: int, stride: int = 0, matrix: Matrix | None = None) -> None:
+        """
+        Render the document into a caller-supplied pixel buffer.
+        
+        The buffer is validated like Bitmap.create_for_data() and rendered
+        into in place with the GIL released, without allocating pixels.
+        The document is drawn over the existing contents as premultiplied
+        ARGB32; clear the buffer first if needed.
+        
+        Args:
+            buffer: Writable pixel buffer, aligned to 4 bytes
+            width: Width of the target in pixels
+            height: Height of the target in pixels
+            stride: Number of bytes per row (0 uses width * 4)
+            matrix: Optional transformation matrix to apply
+            
+        Raises:
+            BufferError: If the buffer is read-only
+            TypeError: If the buffer does not contain 8-bit or 32-bit integers
+            ValueError: If the dimensions or stride are invalid, or the
+                buffer is not contiguous or not aligned
+            RuntimeError: If the buffer is too small
+        """
+        ...
+    
+    def render_damaged(self, bitmap: Bitmap, matrix: Matrix | None = None, background_color: int = 0, margin: float = 2.0) -> list[Box]:
+        """
+        Repaint only the parts of a frame that changed since the last call.
+        
+        The bitmap must still hold the frame produced by the previous call.
+        Elements changed through Element.set_attribute since then are
+        repainted by clearing and re-rendering the union of their old and
+        new global bounding boxes, expanded by margin pixels. The whole
+        bitmap is repainted on the first call, after invalidate() or
+        apply_style_sheet(), and when the bitmap or matrix differ from the
+        previous call.
+        
+        The boxes are grown by the strokes of the element and its
+        descendants. The whole bitmap is repainted instead when a changed
+        element has no geometry of its own (a gradient stop, <defs> or
+        <symbol> content), is instantiated by a <use> element, or has
+        markers or a stroke width that is not a plain number. Call
+        invalidate() when a change affects other elements in ways these
+        checks cannot see, such as through CSS selectors.
+        
+        Args:
+            bitmap: Bitmap holding the previous frame
+            matrix: Transformation matrix to apply (default: identity)
+            background_color: Color the damaged regions are cleared to (default: transparent)
+            margin: Extra pixels added around every changed box
+            
+        Returns:
+            The repainted regions in bitmap pixel coordinates; they do not
+            overlap
+        """
+        ...
+    
+    def invalidate(self) -> None:
+        """Mark the whole document as damaged for the next render_damaged() call."""
+        ...
+    
     def get_element_by_id(self, id: str) -> Element | None:
         """
         Get an element by its ID.
@@ -762,11 +1547,246 @@ class Document:
             Root element of the document or None if the document is empty
         """
         ...
+    
+    def query_selector_all(self, selector: str) -> list[Element]:
+        """
+        Get all elements matching a CSS selector.
+        
+        The tree is walked natively with the GIL released.
+        
+        Args:
+            selector: CSS selector, e.g. "text, a" or "g > rect"
+            
+        Returns:
+            Matching elements in document order
+        """
+        ...
+    
+    def elements_by_tag(self, name: str) -> list[Element]:
+        """
+        Get all elements with the given tag name.
+        
+        Args:
+            name: Tag name, e.g. "text"
+            
+        Returns:
+            Matching elements in document order
+            
+        Raises:
+            ValueError: If name is not a valid tag name
+        """
+        ...
+    
+    def set_attributes(self, changes: Iterable[tuple[str | Element, str, str]]) -> None:
+        """
+        Apply many attribute changes in one call.
+        
+        Ids are resolved natively and every target is found before anything
+        changes. The changes are then applied under a single lock with the
+        GIL released, followed by one layout pass, instead of one lunasvg
+        call and one relayout per change.
+        
+        Args:
+            changes: (target, name, value) tuples, where target is an element
+                id or an Element of this document
+            
+        Raises:
+            ValueError: If a change is malformed, an id is not found or an
+                element belongs to a different document; nothing is changed
+        """
+        ...
+    
+    def build_hit_index(self) -> None:
+        """
+        Index the painted elements for hit_test() and query_rect().
+        
+        Lays out the document and buckets the global bounding box of every
+        painted element (shapes, text, images and use elements outside of
+        defs, clip paths, masks, markers, patterns and symbols) into a
+        uniform grid. The index is a snapshot; call this again after
+        changing the document. It is built on first use if needed.
+        """
+        ...
+    
+    def hit_test(self, x: float, y: float, exact: bool = False) -> Element | None:
+        """
+        Get the topmost painted element at a point.
+        
+        Args:
+            x: X coordinate in document space
+            y: Y coordinate in document space
+            exact: Render each candidate into a single pixel and skip it if
+                the point is not actually covered, instead of testing its
+                bounding box only
+            
+        Returns:
+            The last element in paint order that contains the point, or None
+        """
+        ...
+    
+    def query_rect(self, box: Box) -> list[Element]:
+        """
+        Get the painted elements whose bounding boxes intersect a box.
+        
+        Args:
+            box: Area in document space
+            
+        Returns:
+            Matching elements in paint order, bottom to top
+        """
+        ...
+    
+    def bounding_boxes(self, elements: str | Iterable[Element] | None = None) -> FloatArray:
+        """
+        Get the global bounding boxes of many elements in one call.
+        
+        The boxes are gathered natively in a single pass with the GIL
+        released, instead of one get_global_bounding_box() call per element.
+        
+        Args:
+            elements: A CSS selector, elements of this document, or None for
+                every element in document order
+            
+        Returns:
+            An N x 4 FloatArray of x, y, width, height rows
+            
+        Raises:
+            TypeError: If an item is not an Element
+            ValueError: If an element belongs to a different document
+        """
+        ...
+    
+    def global_matrices(self, elements: str | Iterable[Element] | None = None) -> FloatArray:
+        """
+        Get the global transformation matrices of many elements in one call.
+        
+        Args:
+            elements: A CSS selector, elements of this document, or None for
+                every element in document order
+            
+        Returns:
+            An N x 6 FloatArray of a, b, c, d, e, f rows
+            
+        Raises:
+            TypeError: If an item is not an Element
+            ValueError: If an element belongs to a different document
+        """
+        ...
+
+def render_many(sources: Iterable[str | ReadableBuffer | os.PathLike[str]], width: int = -1, height: int = -1, background_color: int = 0, threads: int = 0, png: bool = False, limits: Limits | None = None) -> list[Bitmap] | list[bytes]:
+    """
+    Parse and render many SVG sources on the native worker pool.
+    
+    Every source is loaded, rendered and optionally PNG encoded without
+    returning to Python, with the GIL released for the whole batch.
+    
+    Args:
+        sources: SVG content as string or bytes-like object, or a
+            path-like object naming an SVG file
+        width: Width of the output bitmaps (-1 uses each document's width)
+        height: Height of the output bitmaps (-1 uses each document's height)
+        background_color: Background color for the bitmaps (default: transparent)
+        threads: Maximum number of threads to use (0 uses one per core)
+        png: Return PNG encoded bytes instead of bitmaps
+        limits: Limits applied to loading and rendering each source
+        
+    Returns:
+        One bitmap (or PNG bytes) per source, in input order
+        
+    Raises:
+        RuntimeError: If any source fails to load, render or encode
+        LimitExceeded: If a source exceeds a limit
+        TypeError: If a source is not a string, bytes, bytearray or path
+    """
+    ...
+
+def build_atlas(items: Iterable[Document | Element], sizes: Iterable[tuple[int, int]], padding: int = 1, background_color: int = 0, width: int = 0, threads: int = 0) -> tuple[Bitmap, list[list[tuple[int, int, int, int, float, float, float, float]]]]:
+    """
+    Render documents and elements at several sizes into one atlas bitmap.
+    
+    Every item is rendered at every size. The slots are packed with a
+    skyline packer and rendered in parallel straight into the shared
+    bitmap, so no bitmap is made per icon. Elements, such as the id'd
+    icons of one sprite sheet, are rendered like Element.render_to_bitmap.
+    The documents involved stay locked for the whole call.
+    
+    Args:
+        items: Documents and Elements to render
+        sizes: (width, height) pairs as in Document.render_many; for an
+            element, a non-positive dimension follows the aspect ratio of
+            its bounding box
+        padding: Transparent pixels around every slot
+        background_color: Background color for every slot (default: transparent)
+        width: Width of the atlas (0 makes it roughly square)
+        threads: Maximum number of threads to use (0 uses one per core)
+        
+    Returns:
+        The atlas and, for each item, one (x, y, width, height, u0, v0,
+        u1, v1) rectangle per size, where the u and v values are the
+        rectangle's edges as fractions of the atlas size
+        
+    Raises:
+        RuntimeError: If an item has nothing to render at a size
+        TypeError: If an item is not a Document or Element
+        ValueError: If items or sizes is empty, padding is negative or a
+            slot is wider than the atlas
+    """
+    ...
+
+def enable_stats(enabled: bool = True) -> None:
+    """
+    Turn statistics collection on or off.
+    
+    While enabled, the time spent in each phase and the bitmaps allocated
+    by the bindings are added to process-wide counters. The counters are
+    lock-free, and while disabled no clock is read.
+    
+    Args:
+        enabled: Whether to collect statistics
+    """
+    ...
+
+def get_stats() -> dict:
+    """
+    Get the statistics collected since the last reset.
+    
+    The result has these keys:
+    
+    - "enabled": Whether collection is currently on
+    - "phases": A dict with the entries "parse", "stylesheet", "layout",
+      "rasterize", "convert" and "png_encode", each holding "calls" and
+      "seconds". Time spent on several threads at once is summed.
+    - "bitmaps_allocated", "bitmap_bytes": Bitmaps created by the bindings
+      and their total size in bytes
+    - "live_documents", "live_bitmaps": Document and Bitmap objects alive
+      right now, counted whether or not collection is enabled
+    
+    Layout done on demand inside a single render call is counted as
+    rasterization; the "layout" phase covers explicit layout passes such
+    as Document.update_layout, attribute batches, tiled and streamed
+    rendering. Conversion done row by row while streaming to a PNG file is
+    counted as PNG encoding.
+    
+    Returns:
+        The statistics as a dict
+    """
+    ...
+
+def reset_stats() -> None:
+    """
+    Zero the phase timings and bitmap allocation counters.
+    
+    Live object counts are not affected.
+    """
+    ...
 
 def add_font_face_from_file(family: str, bold: bool, italic: bool, filename: str) -> None:
     """
     Add a font face from a font file.
     
+    The file is read into memory, so it can be changed or removed
+    afterwards. Adding the same face twice has no effect.
+    
     Args:
         family: Font family name
         bold: Whether the font is bold
@@ -782,6 +1802,8 @@ def add_font_face_from_data(family: str, bold: bool, italic: bool, data: bytes)
     """
     Add a font face from font data.
     
+    The data is copied, so the bytes object can be released afterwards.
+    
     Args:
         family: Font family name
         bold: Whether the font is bold
@@ -793,6 +1815,81 @@ def add_font_face_from_data(family: str, bold: bool, italic: bool, data: bytes)
     """
     ...
 
+def add_font_directory(path: str | os.PathLike[str], recursive: bool = True, threads: int = 0) -> int:
+    """
+    Add every TrueType and OpenType font in a directory.
+    
+    Files ending in .ttf, .otf or .ttc (for a collection, its first font)
+    are read and inspected in parallel on the native worker pool. Each
+    font is added under the family name and the bold and italic flags it
+    declares, so the regular, bold, italic and bold italic files of a
+    family are grouped together. Files that are not valid fonts are
+    skipped.
+    
+    Args:
+        path: Directory to scan
+        recursive: Also scan subdirectories
+        threads: Maximum number of threads to use (0 uses one per core)
+        
+    Returns:
+        The number of font faces added
+        
+    Raises:
+        ValueError: If the path is not a directory
+    """
+    ...
+
+def font_faces() -> list[tuple[str, bool, bool]]:
+    """
+    Get the font faces added so far.
+    
+    Returns:
+        (family, bold, italic) tuples, in the order the faces were added
+    """
+    ...
+
+def save_font_snapshot(filename: str) -> int:
+    """
+    Write every added font face to a snapshot file.
+    
+    A snapshot lets other processes, such as spawned render workers, add
+    the same fonts with load_font_snapshot without scanning or reading the
+    font files again. The snapshot is written to a temporary file that is
+    renamed over filename, so processes that loaded an earlier snapshot
+    from the same path keep using it undisturbed.
+    
+    Args:
+        filename: Path of the snapshot file to write
+        
+    Returns:
+        The number of font faces written
+        
+    Raises:
+        RuntimeError: If the file cannot be written
+    """
+    ...
+
+def load_font_snapshot(filename: str) -> int:
+    """
+    Add the font faces of a snapshot file written by save_font_snapshot.
+    
+    The file is memory-mapped and the fonts are used in place, so every
+    process that loads the same snapshot shares its pages instead of
+    keeping a copy. Replace a snapshot only through save_font_snapshot;
+    rewriting it in place changes the fonts under every process that
+    loaded it. Faces that were already added are skipped.
+    
+    Args:
+        filename: Path of the snapshot file
+        
+    Returns:
+        The number of font faces added
+        
+    Raises:
+        RuntimeError: If the file cannot be read or is not a valid snapshot
+    """
+    ...
+
 # Module attributes
 __version__: str  # Version of the pylunasvg package
 __author__: str  # Author of the pylunasvg package
@@ -0,0 +1,82 @@
+"""Pillow plugin that opens SVG files with pylunasvg.
+
+Importing this module registers the SVG format with Pillow::
+
+    import pylunasvg_pillow  # noqa: F401
+    from PIL import Image
+
+    with Image.open("icon.svg") as image:
+        image.thumbnail((128, 128))
+
+Image.open() only parses the document to learn its size. Rasterization
+waits until the pixels are needed, and draft() (called by thumbnail())
+lowers the size it happens at, so a thumbnail is rendered straight at
+the resolution Pillow asks for instead of being scaled down from the
+full-size image. The rendered bitmap becomes the image's pixel memory
+without a copy.
+"""
+
+from __future__ import annotations
+
+import math
+from typing import Any
+
+import pylunasvg
+from PIL import Image, ImageFile
+
+__all__ = ["SvgImageFile"]
+
+# Limits applied to every SVG opened through Pillow, or None.
+limits: pylunasvg.Limits | None = None
+
+
+def _accept(prefix: bytes) -> bool:
+    return prefix.lstrip(b"\xef\xbb\xbf \t\r\n").startswith(b"<")
+
+
+class SvgImageFile(ImageFile.ImageFile):
+    format = "SVG"
+    format_description = "Scalable Vector Graphics"
+
+    def _open(self) -> None:
+        try:
+            document = pylunasvg.Document.load_from_data(self.fp.read(), limits)
+        except RuntimeError as error:
+            raise SyntaxError(str(error)) from error
+        self._document = document
+        self._mode = "RGBA"
+        self._size = (math.ceil(document.width), math.ceil(document.height))
+        self.tile = [("svg", (0, 0, *self._size), 0, None)]
+
+    def draft(self, mode: str | None, size: tuple[int, int] | None) -> tuple[str, tuple[float, float, float, float]] | None:
+        # Scales the render down uniformly so that it still covers `size`.
+        # The mode is kept; lunasvg only produces RGBA.
+        if not self.tile or not size or self.size[0] <= 0 or self.size[1] <= 0:
+            return None
+        width, height = self.size
+        scale = max(size[0] / width, size[1] / height)
+        if scale >= 1.0:
+            return None
+        self._size = (max(1, math.ceil(width * scale)), max(1, math.ceil(height * scale)))
+        self.tile = [("svg", (0, 0, *self._size), 0, None)]
+        return self.mode, (0, 0, width * scale, height * scale)
+
+    def load(self) -> Any:
+        if self.tile:
+            bitmap = self._document.render_to_bitmap(*self.size)
+            bitmap.convert_to_rgba()
+            # Pillow maps the bitmap's buffer instead of copying it, and
+            # copies on the first write since the mapping is read-only.
+            self.im = Image.frombuffer("RGBA", self.size, bitmap, "raw", "RGBA", bitmap.stride, 1).im
+            self.readonly = 1
+            self.tile = []
+            self._document = None
+            if self._exclusive_fp and self._close_exclusive_fp_after_loading:
+                self.fp.close()
+            self.fp = None
+        return Image.Image.load(self)
+
+
+Image.register_open(SvgImageFile.format, SvgImageFile, _accept)
+Image.register_extension(SvgImageFile.format, ".svg")
+Image.register_mime(SvgImageFile.format, "image/svg+xml")
@@ -0,0 +1,94 @@
+import asyncio
+import subprocess
+import sys
+from pathlib import Path
+
+import pylunasvg
+import pytest
+
+TIGER = Path(__file__).resolve().parent.parent / "examples" / "tiger.svg"
+
+
+def test_load_and_render_async():
+    async def main():
+        document = await pylunasvg.Document.load_async(TIGER.read_bytes())
+        bitmap = await document.render_to_bitmap_async(200, 200)
+        png = await document.render_to_png_async(200, 200, level=1)
+        return document, bitmap, png
+
+    document, bitmap, png = asyncio.run(main())
+    expected = document.render_to_bitmap(200, 200)
+    assert bitmap.data == expected.data
+    assert png == expected.write_to_png_data(level=1)
+
+
+def test_concurrent_renders_keep_the_loop_responsive():
+    async def main():
+        document = pylunasvg.Document.load_from_file(TIGER)
+        ticks = 0
+
+        async def ticker():
+            nonlocal ticks
+            while True:
+                ticks += 1
+                await asyncio.sleep(0)
+
+        task = asyncio.ensure_future(ticker())
+        results = await asyncio.gather(*[document.render_to_png_async(600, 600) for _ in range(4)])
+        task.cancel()
+        return results, ticks
+
+    results, ticks = asyncio.run(main())
+    assert len(set(results)) == 1
+    assert ticks > 0
+
+
+def test_errors_are_delivered_through_the_future():
+    async def main():
+        with pytest.raises(RuntimeError):
+            await pylunasvg.Document.load_async(b"<not svg>")
+        document = pylunasvg.Document.load_from_file(TIGER)
+        with pytest.raises(TimeoutError):
+            await document.render_to_bitmap_async(4000, 4000, timeout=0)
+        with pytest.raises(ValueError):
+            document.render_to_png_async(timeout=-1)
+
+    asyncio.run(main())
+
+
+def test_cancellation_stops_the_render():
+    async def main():
+        document = pylunasvg.Document.load_from_file(TIGER)
+        with pytest.raises(asyncio.TimeoutError):
+            await asyncio.wait_for(document.render_to_bitmap_async(8000, 8000), 0.001)
+        # The document is released by the cancelled job and usable again.
+        bitmap = await document.render_to_bitmap_async(100, 100)
+        assert bitmap.width == 100
+
+    asyncio.run(main())
+
+
+def test_requires_a_running_loop():
+    document = pylunasvg.Document.load_from_file(TIGER)
+    with pytest.raises(RuntimeError):
+        document.render_to_png_async()
+
+
+def test_interpreter_exit_with_jobs_running():
+    # Jobs still on the worker pool when the interpreter shuts down must not
+    # take the GIL; the process has to exit cleanly rather than hang.
+    code = f"""
+import asyncio
+import pylunasvg
+
+async def main():
+    data = open({str(TIGER)!r}, "rb").read()
+    document = pylunasvg.Document.load_from_data(data)
+    for _ in range(8):
+        document.render_to_png_async(2000, 2000)
+        pylunasvg.Document.load_async(data)
+
+asyncio.run(main())
+"""
+    result = subprocess.run([sys.executable, "-c", code], timeout=120)
+    assert result.returncode == 0
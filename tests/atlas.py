@@ -0,0 +1,71 @@
+import pylunasvg
+import pytest
+
+SPRITES = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="40">
+<rect id="square" x="0" y="0" width="20" height="20" fill="#ff0000"/>
+<circle id="dot" cx="50" cy="20" r="10" fill="#00ff00"/>
+<rect id="bar" x="70" y="5" width="30" height="10" fill="#0000ff" transform="rotate(10 85 10)"/>
+</svg>"""
+
+ICON = b"""<svg xmlns="http://www.w3.org/2000/svg" width="24" height="24">
+<path d="M2 2 L22 2 L12 22 Z" fill="#336699"/>
+</svg>"""
+
+
+def crop(bitmap, x, y, width, height):
+    data = bitmap.data
+    stride = bitmap.stride
+    return b"".join(data[row * stride + x * 4:row * stride + (x + width) * 4] for row in range(y, y + height))
+
+
+@pytest.mark.parametrize("threads", [1, 4])
+def test_atlas_matches_single_renders(threads):
+    sprites = pylunasvg.Document.load_from_data(SPRITES)
+    elements = [sprites.get_element_by_id(name) for name in ("square", "dot", "bar")]
+    icon = pylunasvg.Document.load_from_data(ICON)
+    items = [*elements, icon]
+    sizes = [(16, 16), (32, -1)]
+    atlas, rects = pylunasvg.build_atlas(items, sizes, padding=2, threads=threads)
+    assert len(rects) == len(items)
+    for item, item_rects in zip(items, rects):
+        assert len(item_rects) == len(sizes)
+        for size, (x, y, width, height, u0, v0, u1, v1) in zip(sizes, item_rects):
+            assert (u0, v0, u1, v1) == (x / atlas.width, y / atlas.height, (x + width) / atlas.width, (y + height) / atlas.height)
+            expected = item.render_to_bitmap(*size)
+            assert (width, height) == (expected.width, expected.height)
+            assert crop(atlas, x, y, width, height) == expected.data
+
+
+def test_atlas_packing():
+    icon = pylunasvg.Document.load_from_data(ICON)
+    atlas, rects = pylunasvg.build_atlas([icon] * 50, [(10, 10), (20, 20)], padding=1, width=128)
+    assert atlas.width <= 128
+    boxes = [rect[:4] for item_rects in rects for rect in item_rects]
+    for x, y, width, height in boxes:
+        assert x >= 1 and y >= 1
+        assert x + width + 1 <= atlas.width and y + height + 1 <= atlas.height
+    for index, (x, y, width, height) in enumerate(boxes):
+        for other_x, other_y, other_width, other_height in boxes[index + 1:]:
+            # Padding keeps at least one pixel between slots.
+            assert x + width + 1 <= other_x or other_x + other_width + 1 <= x or y + height + 1 <= other_y or other_y + other_height + 1 <= y
+    assert atlas.width * atlas.height < 2 * sum(width * height for _, _, width, height in boxes)
+
+
+def test_atlas_background():
+    icon = pylunasvg.Document.load_from_data(ICON)
+    atlas, rects = pylunasvg.build_atlas([icon], [(8, 8)], padding=1, background_color=0xFFFFFFFF)
+    x, y, width, height = rects[0][0][:4]
+    assert crop(atlas, x, y, width, height) == icon.render_to_bitmap(8, 8, 0xFFFFFFFF).data
+    assert crop(atlas, 0, 0, atlas.width, 1) == bytes(atlas.width * 4)
+
+
+def test_atlas_errors():
+    icon = pylunasvg.Document.load_from_data(ICON)
+    with pytest.raises(ValueError):
+        pylunasvg.build_atlas([], [(8, 8)])
+    with pytest.raises(ValueError):
+        pylunasvg.build_atlas([icon], [])
+    with pytest.raises(ValueError):
+        pylunasvg.build_atlas([icon], [(64, 64)], width=32)
+    with pytest.raises(TypeError):
+        pylunasvg.build_atlas([ICON], [(8, 8)])
@@ -0,0 +1,58 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="30" height="10">
+<rect id="a" width="10" height="10" fill="#ff0000"/>
+<rect id="b" x="10" width="10" height="10" fill="#ff0000"/>
+<rect id="c" x="20" width="10" height="10" fill="#ff0000"/>
+</svg>"""
+
+
+def test_set_attributes_by_id_and_element():
+    document = pylunasvg.Document.load_from_data(SVG)
+    c = document.get_element_by_id("c")
+    document.set_attributes([("a", "fill", "#00ff00"), ("b", "height", "5"), (c, "fill", "#0000ff")])
+    assert document.get_element_by_id("a").get_attribute("fill") == "#00ff00"
+    assert document.get_element_by_id("b").get_global_bounding_box().height == 5
+    assert c.get_attribute("fill") == "#0000ff"
+
+
+def test_set_attributes_matches_single_calls():
+    batched = pylunasvg.Document.load_from_data(SVG)
+    single = pylunasvg.Document.load_from_data(SVG)
+    changes = [(name, "fill", "#123456") for name in "abc"] + [("a", "fill", "#654321")]
+    batched.set_attributes(changes)
+    for name, attribute, value in changes:
+        single.get_element_by_id(name).set_attribute(attribute, value)
+    assert bytes(batched.render_to_bitmap().data) == bytes(single.render_to_bitmap().data)
+
+
+def test_set_attributes_is_all_or_nothing():
+    document = pylunasvg.Document.load_from_data(SVG)
+    with pytest.raises(ValueError):
+        document.set_attributes([("a", "fill", "#00ff00"), ("missing", "fill", "#00ff00")])
+    assert document.get_element_by_id("a").get_attribute("fill") == "#ff0000"
+    with pytest.raises(ValueError):
+        document.set_attributes([("a", "fill")])
+    other = pylunasvg.Document.load_from_data(SVG)
+    with pytest.raises(ValueError):
+        document.set_attributes([(other.get_element_by_id("a"), "fill", "#00ff00")])
+    with pytest.raises(TypeError):
+        document.set_attributes([(1, "fill", "#00ff00")])
+
+
+def test_set_attributes_records_damage_and_clone_state():
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    bitmap = pylunasvg.Bitmap(30, 10)
+    document.render_damaged(bitmap)
+    document.set_attributes([("b", "fill", "#00ff00")])
+    boxes = document.render_damaged(bitmap)
+    assert len(boxes) == 1 and boxes[0].x <= 10 and boxes[0].x + boxes[0].width >= 20
+    assert document.clone().get_element_by_id("b").get_attribute("fill") == "#00ff00"
+
+
+def test_clone_needs_cloneable():
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.set_attributes([("b", "fill", "#00ff00")])
+    with pytest.raises(RuntimeError, match="cloneable"):
+        document.clone()
@@ -0,0 +1,120 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="8" height="4">
+<rect width="4" height="4" fill="#ff0000"/>
+</svg>"""
+
+
+def test_buffer_protocol():
+    bitmap = pylunasvg.Document.load_from_data(SVG).render_to_bitmap()
+    view = memoryview(bitmap)
+    assert view.shape == (4, 8, 4)
+    assert view.strides == (bitmap.stride, 4, 1)
+    assert view.format == "B"
+    assert not view.readonly
+    assert view.tobytes() == bitmap.data
+
+
+def test_view_keeps_bitmap_alive():
+    view = memoryview(pylunasvg.Document.load_from_data(SVG).render_to_bitmap())
+    # premultiplied ARGB32: opaque red is stored as B, G, R, A = 0, 0, 255, 255
+    assert view[0, 0].tolist() == [0, 0, 255, 255]
+    assert view[0, 7].tolist() == [0, 0, 0, 0]
+
+
+def test_view_writes_through():
+    bitmap = pylunasvg.Bitmap(2, 2)
+    memoryview(bitmap)[1, 1] = bytes([1, 2, 3, 4])
+    assert bitmap.data[-4:] == bytes([1, 2, 3, 4])
+
+
+def test_numpy_view():
+    numpy = pytest.importorskip("numpy")
+    bitmap = pylunasvg.Document.load_from_data(SVG).render_to_bitmap()
+    array = numpy.asarray(bitmap)
+    assert array.shape == (4, 8, 4)
+    assert array.dtype == numpy.uint8
+    bitmap.clear(0xFFFFFFFF)
+    assert (array == 255).all()
+
+
+def test_create_for_data_keeps_buffer_alive():
+    buffer = bytearray(8 * 4 * 4)
+    bitmap = pylunasvg.Bitmap.create_for_data(buffer, 8, 4, 32)
+    with pytest.raises(BufferError):
+        buffer.extend(b"\0")
+    pylunasvg.Document.load_from_data(SVG).render(bitmap)
+    assert buffer[:4] == bytes([0, 0, 255, 255])
+    del bitmap
+    buffer.extend(b"\0")
+
+
+def test_create_for_data_validation():
+    with pytest.raises(BufferError):
+        pylunasvg.Bitmap.create_for_data(bytes(128), 8, 4, 32)
+    with pytest.raises(RuntimeError):
+        pylunasvg.Bitmap.create_for_data(bytearray(127), 8, 4, 32)
+    with pytest.raises(ValueError):
+        pylunasvg.Bitmap.create_for_data(bytearray(128), 8, 4, 16)
+    with pytest.raises(ValueError):
+        pylunasvg.Bitmap.create_for_data(bytearray(1 << 20), 1 << 16, 1 << 16, 1 << 18)
+    with pytest.raises(ValueError):
+        pylunasvg.Bitmap.create_for_data(memoryview(bytearray(256))[::2], 8, 4, 32)
+
+
+def test_render_into_shared_memory():
+    shared_memory = pytest.importorskip("multiprocessing.shared_memory")
+    segment = shared_memory.SharedMemory(create=True, size=8 * 4 * 4)
+    try:
+        document = pylunasvg.Document.load_from_data(SVG)
+        document.render_into(segment.buf, 8, 4)
+        assert bytes(segment.buf[:4]) == bytes([0, 0, 255, 255])
+    finally:
+        segment.close()
+        segment.unlink()
+
+
+def test_render_into_numpy_and_mmap():
+    numpy = pytest.importorskip("numpy")
+    import mmap
+
+    document = pylunasvg.Document.load_from_data(SVG)
+    frame = numpy.zeros((4, 8), dtype=numpy.uint32)
+    document.render_into(frame, 8, 4, matrix=pylunasvg.Matrix())
+    assert frame[0, 0] == 0xFFFF0000
+
+    surface = mmap.mmap(-1, 8 * 4 * 4)
+    document.render_into(surface, 8, 4, 32)
+    assert surface[:4] == bytes([0, 0, 255, 255])
+    surface.close()
+
+
+def test_convert_layouts():
+    bitmap = pylunasvg.Document.load_from_data(SVG).render_to_bitmap()
+    original = bitmap.data
+    rgba = bitmap.convert(pylunasvg.PixelFormat.RGBA)
+    assert isinstance(rgba, bytearray) and rgba[:4] == bytes([255, 0, 0, 255])
+    assert bitmap.convert(pylunasvg.PixelFormat.BGRA_PREMULTIPLIED) == original
+    assert bitmap.convert(pylunasvg.PixelFormat.RGB)[-3:] == bytes([255, 255, 255])
+    assert bitmap.convert(pylunasvg.PixelFormat.BGR, background_color=0x000000FF)[:3] == bytes([0, 0, 255])
+    assert bitmap.convert(pylunasvg.PixelFormat.ALPHA) == bytes([255] * 4 + [0] * 4) * 4
+    assert len(bitmap.convert(pylunasvg.PixelFormat.GRAY)) == 8 * 4
+    assert bitmap.data == original
+
+    out = bytearray(8 * 4 * 4)
+    assert bitmap.convert(pylunasvg.PixelFormat.RGBA, out) is out
+    assert out == rgba
+    with pytest.raises(RuntimeError):
+        bitmap.convert(pylunasvg.PixelFormat.RGBA, bytearray(10))
+
+    # Buffers from Python need not be four-byte aligned.
+    storage = bytearray(len(original) + 1)
+    bitmap.convert(pylunasvg.PixelFormat.RGBA, memoryview(storage)[1:])
+    assert storage[1:] == rgba
+    source = bytearray(1) + original
+    unaligned = pylunasvg.Bitmap.create_for_data(memoryview(source)[1:], 8, 4, 32)
+    assert unaligned.convert(pylunasvg.PixelFormat.RGBA) == rgba
+
+    bitmap.convert_to_rgba()
+    assert bitmap.data == rgba
@@ -0,0 +1,52 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="20" height="10">
+<rect id="bar" width="10" height="10" fill="#ff0000"/>
+</svg>"""
+
+
+@pytest.fixture(autouse=True)
+def empty_cache():
+    pylunasvg.Document.clear_cache()
+    pylunasvg.Document.set_cache_limits()
+    yield
+    pylunasvg.Document.clear_cache()
+
+
+def test_load_cached_reuses_rolled_back_documents():
+    document = pylunasvg.Document.load_cached(SVG)
+    document.get_element_by_id("bar").set_attribute("fill", "#00ff00")
+    del document
+    info = pylunasvg.Document.cache_info()
+    assert (info["hits"], info["misses"], info["entries"], info["spares"]) == (0, 1, 1, 1)
+
+    document = pylunasvg.Document.load_cached(SVG)
+    assert pylunasvg.Document.cache_info()["hits"] == 1
+    assert document.get_element_by_id("bar").get_attribute("fill") == "#ff0000"
+
+
+def test_load_cached_drops_documents_that_cannot_be_rolled_back():
+    document = pylunasvg.Document.load_cached(SVG)
+    document.get_element_by_id("bar").set_attribute("stroke", "#000000")
+    del document
+    assert pylunasvg.Document.cache_info()["spares"] == 0
+
+
+def test_cache_limits():
+    pylunasvg.Document.set_cache_limits(max_bytes=len(SVG) - 1)
+    pylunasvg.Document.load_cached(SVG)
+    info = pylunasvg.Document.cache_info()
+    assert info["entries"] == 0 and info["bytes"] == 0
+
+
+def test_clone_replays_changes():
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    document.get_element_by_id("bar").set_attribute("width", "15")
+    copy = document.clone()
+    assert copy.get_element_by_id("bar").get_attribute("width") == "15"
+    assert copy.render_to_bitmap().data == document.render_to_bitmap().data
+
+    copy.get_element_by_id("bar").set_attribute("width", "5")
+    assert document.get_element_by_id("bar").get_attribute("width") == "15"
+    assert copy.clone().get_element_by_id("bar").get_attribute("width") == "5"
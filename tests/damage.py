@@ -0,0 +1,66 @@
+import pylunasvg
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="200" height="100">
+<rect width="200" height="100" fill="#eeeeee"/>
+<rect id="gauge" x="20" y="20" width="30" height="10" fill="#ff0000"/>
+<circle id="dial" cx="150" cy="50" r="20" fill="#0000ff"/>
+</svg>"""
+
+
+def test_render_damaged_repaints_changed_regions():
+    document = pylunasvg.Document.load_from_data(SVG)
+    bitmap = pylunasvg.Bitmap(200, 100)
+    first = document.render_damaged(bitmap)
+    assert [(box.x, box.y, box.width, box.height) for box in first] == [(0, 0, 200, 100)]
+    assert document.render_damaged(bitmap) == []
+
+    gauge = document.get_element_by_id("gauge")
+    gauge.set_attribute("width", "60")
+    gauge.set_attribute("fill", "#00ff00")
+    damaged = document.render_damaged(bitmap, margin=1)
+    assert len(damaged) == 1
+    box = damaged[0]
+    assert (box.x, box.y, box.width, box.height) == (19, 19, 62, 12)
+    assert bitmap.data == document.render_to_bitmap(200, 100).data
+
+
+def test_render_damaged_full_repaint_on_new_target():
+    document = pylunasvg.Document.load_from_data(SVG)
+    bitmap = pylunasvg.Bitmap(200, 100)
+    document.render_damaged(bitmap)
+    document.get_element_by_id("dial").set_attribute("r", "10")
+    other = pylunasvg.Bitmap(200, 100)
+    assert len(document.render_damaged(other)) == 1
+    assert other.data == document.render_to_bitmap(200, 100).data
+
+    document.invalidate()
+    assert [(box.width, box.height) for box in document.render_damaged(other)] == [(200, 100)]
+
+
+STYLED = b"""<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" width="200" height="100">
+<defs><linearGradient id="fade"><stop id="stop" offset="0" stop-color="#ff0000"/></linearGradient></defs>
+<g stroke="#000000" stroke-width="6"><rect id="outlined" x="20" y="20" width="30" height="10" fill="url(#fade)"/></g>
+<rect id="template" x="100" y="20" width="10" height="10" fill="#00ff00"/>
+<use xlink:href="#template" x="50" y="50"/>
+</svg>"""
+
+
+def test_render_damaged_includes_inherited_stroke():
+    document = pylunasvg.Document.load_from_data(STYLED)
+    bitmap = pylunasvg.Bitmap(200, 100)
+    document.render_damaged(bitmap)
+    document.get_element_by_id("outlined").set_attribute("x", "24")
+    (box,) = document.render_damaged(bitmap, margin=0)
+    # Miter joins of a 6 unit stroke reach up to 4 half widths outside.
+    assert (box.x, box.y) == (8, 8)
+    assert bitmap.data == document.render_to_bitmap(200, 100).data
+
+
+def test_render_damaged_repaints_everything_for_elements_drawn_elsewhere():
+    document = pylunasvg.Document.load_from_data(STYLED)
+    bitmap = pylunasvg.Bitmap(200, 100)
+    document.render_damaged(bitmap)
+    for name, attribute, value in [("stop", "stop-color", "#0000ff"), ("template", "fill", "#ff00ff")]:
+        document.get_element_by_id(name).set_attribute(attribute, value)
+        assert [(box.width, box.height) for box in document.render_damaged(bitmap)] == [(200, 100)]
+        assert bitmap.data == document.render_to_bitmap(200, 100).data
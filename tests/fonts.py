@@ -0,0 +1,88 @@
+import shutil
+import subprocess
+import sys
+from pathlib import Path
+
+import pylunasvg
+import pytest
+
+FONT_DIRECTORIES = ["/usr/share/fonts", "/Library/Fonts", "/System/Library/Fonts", "C:/Windows/Fonts"]
+
+
+def find_font():
+    for directory in map(Path, FONT_DIRECTORIES):
+        fonts = sorted(directory.rglob("*.ttf")) if directory.is_dir() else []
+        if fonts:
+            return fonts[0]
+    pytest.skip("no TrueType font found")
+
+
+def test_font_data_is_owned():
+    data = bytearray(find_font().read_bytes())
+    pylunasvg.add_font_face_from_data("Owned Test", False, False, bytes(data))
+    data[:] = b"\0" * len(data)
+    assert ("Owned Test", False, False) in pylunasvg.font_faces()
+    with pytest.raises(RuntimeError):
+        pylunasvg.add_font_face_from_data("Broken", False, False, b"not a font")
+
+
+def test_font_file_is_read_into_memory(tmp_path):
+    font = tmp_path / "copy.ttf"
+    shutil.copy(find_font(), font)
+    pylunasvg.add_font_face_from_file("File Copy Test", False, True, str(font))
+    # A mapped font would fault once its file shrinks under it.
+    font.write_bytes(b"")
+    svg = '<svg xmlns="http://www.w3.org/2000/svg" width="60" height="20"><text y="15" font-family="File Copy Test" font-style="italic">Text</text></svg>'
+    assert any(pylunasvg.Document.load_from_data(svg).render_to_bitmap().data)
+
+
+def test_add_font_directory(tmp_path):
+    font = find_font()
+    (tmp_path / "nested").mkdir()
+    shutil.copy(font, tmp_path / "nested" / font.name)
+    (tmp_path / "notes.ttf").write_bytes(b"not a font")
+    assert pylunasvg.add_font_directory(tmp_path, recursive=False) == 0
+    before = len(pylunasvg.font_faces())
+    assert pylunasvg.add_font_directory(tmp_path) == 1
+    assert len(pylunasvg.font_faces()) == before + 1
+    # The same faces are not added twice.
+    assert pylunasvg.add_font_directory(tmp_path) == 0
+    with pytest.raises(ValueError):
+        pylunasvg.add_font_directory(tmp_path / "notes.ttf")
+
+
+def test_font_snapshot(tmp_path):
+    font = find_font()
+    pylunasvg.add_font_face_from_file("Snapshot Test", True, False, str(font))
+    snapshot = tmp_path / "fonts.snapshot"
+    count = pylunasvg.save_font_snapshot(str(snapshot))
+    assert count == len(pylunasvg.font_faces())
+    assert pylunasvg.load_font_snapshot(str(snapshot)) == 0
+
+    script = (
+        "import pylunasvg, sys\n"
+        "added = pylunasvg.load_font_snapshot(sys.argv[1])\n"
+        "assert ('Snapshot Test', True, False) in pylunasvg.font_faces()\n"
+        "print(added)\n"
+    )
+    result = subprocess.run([sys.executable, "-c", script, str(snapshot)], capture_output=True, text=True, check=True)
+    assert int(result.stdout) == count
+
+    (tmp_path / "broken.snapshot").write_bytes(b"PLSVGFNT\xff\xff\xff\xff")
+    with pytest.raises(RuntimeError):
+        pylunasvg.load_font_snapshot(str(tmp_path / "broken.snapshot"))
+
+
+@pytest.mark.skipif(sys.platform == "win32", reason="open files cannot be replaced on Windows")
+def test_font_snapshot_is_replaced_atomically(tmp_path):
+    pylunasvg.add_font_face_from_file("Snapshot Test", True, False, str(find_font()))
+    snapshot = tmp_path / "fonts.snapshot"
+    pylunasvg.save_font_snapshot(str(snapshot))
+    with open(snapshot, "rb") as old:
+        contents = snapshot.read_bytes()
+        pylunasvg.add_font_face_from_data("Snapshot Replace Test", False, False, find_font().read_bytes())
+        pylunasvg.save_font_snapshot(str(snapshot))
+        # Readers of the old file keep its contents.
+        assert old.read() == contents
+    assert len(snapshot.read_bytes()) > len(contents)
+    assert [path.name for path in tmp_path.iterdir()] == ["fonts.snapshot"]
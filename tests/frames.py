@@ -0,0 +1,75 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="64" height="64">
+<rect id="box" x="0" y="8" width="16" height="16" fill="#ff0000"/>
+<circle id="dot" cx="48" cy="48" r="8" opacity="1"/>
+</svg>"""
+
+KEYFRAMES = [
+    ("box", "transform", [(0, "translate(0, 0) rotate(0)"), (1, "translate(40, 20) rotate(90)")]),
+    ("box", "fill", [(0, "#ff0000"), (1, "#0000ff")]),
+    ("dot", "opacity", [(0.5, 1), (1, 0)]),
+]
+
+
+def expected_frame(box_transform, box_fill, dot_opacity):
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.set_attributes([
+        ("box", "transform", box_transform),
+        ("box", "fill", box_fill),
+        ("dot", "opacity", dot_opacity),
+    ])
+    return document.render_to_bitmap().data
+
+
+@pytest.mark.parametrize("threads", [1, 3])
+def test_frames_interpolate(threads):
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    frames = document.render_frames(KEYFRAMES, fps=4, threads=threads)
+    assert frames.frame_count == 5
+    assert (frames.width, frames.height) == (64, 64)
+    data = [bitmap.data for bitmap in frames]
+    assert len(data) == 5
+    assert data[0] == expected_frame("translate(0, 0) rotate(0)", "#ff0000", "1")
+    assert data[2] == expected_frame("translate(20, 10) rotate(45)", "rgb(127.5,0,127.5)", "1")
+    assert data[3] == expected_frame("translate(30, 15) rotate(67.5)", "rgb(63.75,0,191.25)", "0.5")
+    assert data[4] == expected_frame("translate(40, 20) rotate(90)", "#0000ff", "0")
+    # The document itself is left alone.
+    assert document.get_element_by_id("dot").get_attribute("opacity") == "1"
+
+
+def test_frames_reuse():
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    frames = list(document.render_frames(KEYFRAMES, fps=2, threads=2, reuse=False))
+    assert len(frames) == 3
+    assert len({frame.data for frame in frames}) == 3
+
+
+def test_frames_duration_and_changes():
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    document.get_element_by_id("dot").set_attribute("r", "4")
+    box = document.get_element_by_id("box")
+    frames = list(document.render_frames([(box, "x", [(0, 0), (1, 10)])], fps=10, duration=2, width=32, reuse=False))
+    assert len(frames) == 21
+    assert (frames[-1].width, frames[-1].height) == (32, 32)
+    box.set_attribute("x", "10")
+    assert frames[-1].data == document.render_to_bitmap(32).data
+
+
+def test_frames_errors():
+    document = pylunasvg.Document.load_from_data(SVG, cloneable=True)
+    with pytest.raises(ValueError):
+        document.render_frames(KEYFRAMES, fps=0)
+    with pytest.raises(ValueError, match="missing"):
+        document.render_frames([("missing", "x", [(0, 1)])], fps=1)
+    with pytest.raises(ValueError):
+        document.render_frames([("box", "x", [])], fps=1)
+    with pytest.raises(ValueError):
+        document.render_frames([("box", "x", [(-1, 0)])], fps=1)
+    with pytest.raises(ValueError):
+        document.render_frames(["box"], fps=1)
+    with pytest.raises(TypeError):
+        document.render_frames([(1, "x", [(0, 1)])], fps=1)
+    with pytest.raises(RuntimeError, match="cloneable"):
+        pylunasvg.Document.load_from_data(SVG).render_frames(KEYFRAMES, fps=1)
@@ -0,0 +1,98 @@
+import array
+
+import pylunasvg
+import pytest
+
+
+def test_matrix_and_box_are_values():
+    matrix = pylunasvg.Matrix()
+    translated = matrix.translate(5, 6)
+    assert list(matrix) == [1, 0, 0, 1, 0, 0]
+    assert list(translated) == [1, 0, 0, 1, 5, 6]
+    box = pylunasvg.Box(1, 2, 3, 4)
+    moved = box.transformed(translated)
+    box.x = 10
+    assert list(moved) == [6, 8, 3, 4]
+
+
+def test_compose():
+    matrices = [pylunasvg.Matrix.translated(1, 2), pylunasvg.Matrix.scaled(2, 3), pylunasvg.Matrix.rotated(30)]
+    expected = matrices[0] * matrices[1] * matrices[2]
+    assert list(pylunasvg.Matrix.compose(matrices)) == pytest.approx(list(expected))
+    assert list(pylunasvg.Matrix.compose([])) == [1, 0, 0, 1, 0, 0]
+
+
+def test_map_points():
+    matrix = pylunasvg.Matrix(2, 0, 0, 3, 10, 20)
+    points = array.array("f", [0, 0, 1, 1, 2, -1])
+    result = matrix.map_points(points)
+    assert result.shape == (3, 2)
+    assert result.tolist() == [(10, 20), (12, 23), (14, 17)]
+    assert memoryview(result).shape == (3, 2)
+
+    out = array.array("d", [0] * 6)
+    assert matrix.map_points(points, out) is out
+    assert list(out) == [10, 20, 12, 23, 14, 17]
+    matrix.map_points(points, points)
+    assert list(points) == [10, 20, 12, 23, 14, 17]
+
+    with pytest.raises(ValueError):
+        matrix.map_points(array.array("f", [1, 2, 3]))
+    with pytest.raises(TypeError):
+        matrix.map_points(array.array("i", [1, 2]))
+
+
+def test_map_boxes():
+    matrix = pylunasvg.Matrix.rotated(90)
+    boxes = array.array("f", [0, 0, 2, 1])
+    (x, y, w, h) = matrix.map_boxes(boxes)[0]
+    assert (x, y, w, h) == pytest.approx((-1, 0, 1, 2), abs=1e-5)
+    expected = pylunasvg.Box(0, 0, 2, 1).transformed(matrix)
+    assert (x, y, w, h) == pytest.approx(tuple(expected), abs=1e-5)
+
+
+def test_map_float64_keeps_precision():
+    matrix = pylunasvg.Matrix(1, 0, 0, 1, 0.25, -0.5)
+    points = array.array("d", [123456789.5, 987654321.25])
+    out = array.array("d", [0, 0])
+    matrix.map_points(points, out)
+    assert list(out) == [123456789.75, 987654320.75]
+    boxes = array.array("d", [123456789.5, 0, 0.125, 1])
+    matrix.map_boxes(boxes, boxes)
+    assert list(boxes) == [123456789.75, -0.5, 0.125, 1]
+
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="100">
+<g transform="translate(10 20)">
+<rect id="a" x="1" y="2" width="3" height="4"/>
+<rect id="b" x="5" y="6" width="7" height="8" transform="scale(2)"/>
+</g>
+</svg>"""
+
+
+def test_bounding_boxes():
+    document = pylunasvg.Document.load_from_data(SVG)
+    rects = document.elements_by_tag("rect")
+    boxes = document.bounding_boxes("rect")
+    assert boxes.shape == (2, 4)
+    for row, element in zip(boxes.tolist(), rects):
+        assert row == pytest.approx(tuple(element.get_global_bounding_box()))
+    assert document.bounding_boxes(rects).tolist() == boxes.tolist()
+    assert len(document.bounding_boxes()) == len(document.query_selector_all("*"))
+    assert document.bounding_boxes([]).shape == (0, 4)
+
+
+def test_global_matrices():
+    document = pylunasvg.Document.load_from_data(SVG)
+    matrices = document.global_matrices("#b")
+    assert matrices.shape == (1, 6)
+    assert matrices[0] == pytest.approx((2, 0, 0, 2, 10, 20))
+
+
+def test_bulk_queries_reject_foreign_elements():
+    document = pylunasvg.Document.load_from_data(SVG)
+    other = pylunasvg.Document.load_from_data(SVG)
+    with pytest.raises(ValueError):
+        document.bounding_boxes(other.elements_by_tag("rect"))
+    with pytest.raises(TypeError):
+        document.global_matrices([1, 2])
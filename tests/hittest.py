@@ -0,0 +1,50 @@
+import pylunasvg
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="100">
+<defs><rect id="hidden" width="100" height="100"/></defs>
+<rect id="back" width="100" height="100" fill="#ffffff"/>
+<g transform="translate(20 20)">
+<circle id="dot" cx="20" cy="20" r="20" fill="#ff0000"/>
+</g>
+<rect id="bar" x="50" y="60" width="40" height="10"/>
+</svg>"""
+
+
+def element_id(element):
+    return None if element is None else element.get_attribute("id")
+
+
+def test_hit_test_returns_topmost():
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.build_hit_index()
+    assert element_id(document.hit_test(40, 40)) == "dot"
+    assert element_id(document.hit_test(60, 65)) == "bar"
+    assert element_id(document.hit_test(5, 5)) == "back"
+    assert document.hit_test(-5, 5) is None
+    assert document.hit_test(5, 500) is None
+
+
+def test_hit_test_exact():
+    document = pylunasvg.Document.load_from_data(SVG)
+    # Inside the circle's bounding box, outside the circle.
+    assert element_id(document.hit_test(22, 22)) == "dot"
+    assert element_id(document.hit_test(22, 22, exact=True)) == "back"
+    assert element_id(document.hit_test(40, 40, exact=True)) == "dot"
+
+
+def test_query_rect():
+    document = pylunasvg.Document.load_from_data(SVG)
+    found = document.query_rect(pylunasvg.Box(45, 55, 10, 10))
+    assert [element_id(element) for element in found] == ["back", "dot", "bar"]
+    found = document.query_rect(pylunasvg.Box(0, 80, 10, 10))
+    assert [element_id(element) for element in found] == ["back"]
+    assert document.query_rect(pylunasvg.Box(200, 200, 10, 10)) == []
+
+
+def test_index_is_a_snapshot():
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.build_hit_index()
+    document.get_element_by_id("bar").set_attribute("x", "0")
+    assert element_id(document.hit_test(10, 65)) == "back"
+    document.build_hit_index()
+    assert element_id(document.hit_test(10, 65)) == "bar"
@@ -0,0 +1,101 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="100">
+<g><g><rect width="10" height="10"/></g></g>
+</svg>"""
+
+
+def nested_uses(levels, fanout=10):
+    parts = ['<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" width="10" height="10"><defs>']
+    parts.append('<rect id="l0" width="1" height="1"/>')
+    for level in range(1, levels + 1):
+        uses = "".join(f'<use xlink:href="#l{level - 1}"/>' for _ in range(fanout))
+        parts.append(f'<g id="l{level}">{uses}</g>')
+    parts.append(f'</defs><use xlink:href="#l{levels}"/></svg>')
+    return "".join(parts)
+
+
+def test_limits_default_to_none():
+    limits = pylunasvg.Limits()
+    assert limits.max_elements is None and limits.max_render_time is None
+    limits.max_depth = 3
+    assert limits.max_depth == 3
+    with pytest.raises(ValueError):
+        pylunasvg.Limits(max_pixels=0)
+
+
+def test_load_limits():
+    assert pylunasvg.Document.load_from_data(SVG, pylunasvg.Limits(max_input_bytes=1000, max_elements=4, max_depth=4))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.Document.load_from_data(SVG, pylunasvg.Limits(max_input_bytes=10))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.Document.load_from_data(SVG, pylunasvg.Limits(max_elements=3))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.Document.load_from_data(SVG, pylunasvg.Limits(max_depth=3))
+
+
+def test_use_expansion_limit():
+    data = nested_uses(6)
+    assert pylunasvg.Document.load_from_data(nested_uses(2), pylunasvg.Limits(max_use_expansion=1000))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.Document.load_from_data(data, pylunasvg.Limits(max_use_expansion=100000))
+
+
+def test_render_limits():
+    document = pylunasvg.Document.load_from_data(SVG, pylunasvg.Limits(max_pixels=100 * 100))
+    assert document.render_to_bitmap().width == 100
+    with pytest.raises(pylunasvg.LimitExceeded):
+        document.render_to_bitmap(1000, 1000)
+    assert document.render_to_bitmap(1000, 1000, limits=pylunasvg.Limits()).width == 1000
+    with pytest.raises(pylunasvg.LimitExceeded):
+        document.render_to_bitmap(limits=pylunasvg.Limits(max_render_time=1e-9))
+
+
+def test_limit_exceeded_is_a_runtime_error():
+    assert issubclass(pylunasvg.LimitExceeded, RuntimeError)
+
+
+def render_paths(path):
+    # Every way of rendering a document or its elements at 1000x1000.
+    return {
+        "render": lambda document: document.render(pylunasvg.Bitmap(1000, 1000)),
+        "render_into": lambda document: document.render_into(bytearray(1000 * 1000 * 4), 1000, 1000),
+        "render_damaged": lambda document: document.render_damaged(pylunasvg.Bitmap(1000, 1000)),
+        "render_many": lambda document: document.render_many([(1000, 1000)]),
+        "render_many_downsample": lambda document: document.render_many([(1000, 1000), (500, 500)], downsample=True),
+        "render_to_ico": lambda document: document.render_to_ico([(256, 256)]),
+        "render_tiles": lambda document: list(document.render_tiles(1000, 1000)),
+        "render_frames": lambda document: list(document.render_frames([(document.query_selector_all("rect")[0], "x", [(0, 0), (1, 5)])], fps=2, width=1000, height=1000)),
+        "write_to_png": lambda document: document.write_to_png(path, 1000, 1000),
+        "element_render": lambda document: document.query_selector_all("rect")[0].render(pylunasvg.Bitmap(1000, 1000)),
+        "element_render_to_bitmap": lambda document: document.query_selector_all("rect")[0].render_to_bitmap(1000, 1000),
+        "build_atlas": lambda document: pylunasvg.build_atlas([document.query_selector_all("rect")[0], document], [(1000, 1000)]),
+    }
+
+
+@pytest.mark.parametrize("name", sorted(render_paths(None)))
+@pytest.mark.parametrize("limits", [pylunasvg.Limits(max_pixels=100 * 100), pylunasvg.Limits(max_render_time=1e-9)], ids=["max_pixels", "max_render_time"])
+def test_render_paths_apply_document_limits(name, limits, tmp_path):
+    render = render_paths(str(tmp_path / "out.png"))[name]
+    render(pylunasvg.Document.load_from_data(SVG, cloneable=True))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        render(pylunasvg.Document.load_from_data(SVG, limits, cloneable=True))
+
+
+def test_load_cached_limits():
+    pylunasvg.Document.load_cached(SVG)
+    # Loads served from the cache are checked like fresh ones.
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.Document.load_cached(SVG, pylunasvg.Limits(max_elements=3))
+    document = pylunasvg.Document.load_cached(SVG, pylunasvg.Limits(max_pixels=100 * 100))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        document.render_many([(1000, 1000)])
+
+
+def test_module_render_many_limits():
+    assert len(pylunasvg.render_many([SVG], 1000, 1000)) == 1
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.render_many([SVG], limits=pylunasvg.Limits(max_elements=3))
+    with pytest.raises(pylunasvg.LimitExceeded):
+        pylunasvg.render_many([SVG], 1000, 1000, limits=pylunasvg.Limits(max_pixels=100 * 100))
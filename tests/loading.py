@@ -0,0 +1,56 @@
+import mmap
+
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="20" height="10">
+<rect width="10" height="10" fill="#ff0000"/>
+</svg>"""
+
+
+def test_load_from_buffers():
+    expected = pylunasvg.Document.load_from_data(SVG).render_to_bitmap().data
+    for data in (SVG, SVG.decode(), bytearray(SVG), memoryview(SVG), memoryview(bytearray(SVG))):
+        assert pylunasvg.Document.load_from_data(data).render_to_bitmap().data == expected
+
+
+def test_load_from_writable_buffer_copies(tmp_path):
+    data = bytearray(SVG)
+    document = pylunasvg.Document.load_from_data(data, cloneable=True)
+    data[:] = b"x" * len(data)
+    data.extend(b"more")
+    assert document.clone().width == 20
+
+
+def test_load_from_mmap(tmp_path):
+    path = tmp_path / "image.svg"
+    path.write_bytes(SVG)
+    with open(path, "rb") as file, mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ) as mapping:
+        document = pylunasvg.Document.load_from_data(mapping)
+        assert document.width == 20
+        del document
+
+
+def test_load_from_file_mapping(tmp_path):
+    path = tmp_path / "image.svg"
+    path.write_bytes(SVG)
+    document = pylunasvg.Document.load_from_file(str(path), cloneable=True)
+    assert document.clone().render_to_bitmap().data == document.render_to_bitmap().data
+    # Without cloneable the mapping is released after parsing.
+    document = pylunasvg.Document.load_from_file(str(path))
+    path.write_bytes(b"x")
+    assert document.render_to_bitmap().data == pylunasvg.Document.load_from_data(SVG).render_to_bitmap().data
+    with pytest.raises(RuntimeError, match="cloneable"):
+        document.clone()
+
+    empty = tmp_path / "empty.svg"
+    empty.write_bytes(b"")
+    with pytest.raises(RuntimeError):
+        pylunasvg.Document.load_from_file(str(empty))
+
+
+def test_load_from_data_validation():
+    with pytest.raises(ValueError):
+        pylunasvg.Document.load_from_data(b"")
+    with pytest.raises(ValueError):
+        pylunasvg.Document.load_from_data(42)
@@ -0,0 +1,70 @@
+import io
+
+import pylunasvg
+import pytest
+
+Image = pytest.importorskip("PIL.Image")
+pylunasvg_pillow = pytest.importorskip("pylunasvg_pillow")
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="400" height="200" viewBox="0 0 40 20">
+<rect width="20" height="20" fill="#ff0000"/>
+<rect x="20" width="20" height="20" fill="#0000ff" fill-opacity="0.5"/>
+</svg>"""
+
+
+def test_open_is_lazy(monkeypatch):
+    rendered = []
+    render = pylunasvg.Document.render_to_bitmap
+    monkeypatch.setattr(pylunasvg.Document, "render_to_bitmap", lambda self, *args: rendered.append(args) or render(self, *args))
+    with Image.open(io.BytesIO(SVG)) as image:
+        assert image.format == "SVG"
+        assert image.mode == "RGBA"
+        assert image.size == (400, 200)
+        assert rendered == []
+        image.load()
+        assert rendered == [(400, 200)]
+        image.load()
+        assert len(rendered) == 1
+
+
+def test_pixels():
+    with Image.open(io.BytesIO(SVG)) as image:
+        assert image.getpixel((10, 10)) == (255, 0, 0, 255)
+        red, green, blue, alpha = image.getpixel((390, 10))
+        assert (red, green, alpha) == (0, 0, 128)
+        assert blue >= 254
+        # Writes go to a private copy of the mapped bitmap.
+        image.putpixel((0, 0), (1, 2, 3, 4))
+        assert image.getpixel((0, 0)) == (1, 2, 3, 4)
+
+
+def test_thumbnail_renders_at_draft_size():
+    with Image.open(io.BytesIO(SVG)) as image:
+        image.thumbnail((50, 50))
+        assert image.size == (50, 25)
+        assert image.getpixel((5, 12))[:3] == (255, 0, 0)
+
+
+def test_draft():
+    with Image.open(io.BytesIO(SVG)) as image:
+        assert image.draft(None, (800, 800)) is None
+        assert image.draft(None, (100, 20)) == ("RGBA", (0, 0, 100.0, 50.0))
+        assert image.size == (100, 50)
+        image.load()
+        assert image.draft(None, (10, 10)) is None
+        assert image.size == (100, 50)
+
+
+def test_convert_and_save():
+    with Image.open(io.BytesIO(SVG)) as image:
+        assert image.convert("RGB").getpixel((10, 10)) == (255, 0, 0)
+        output = io.BytesIO()
+        image.save(output, "PNG")
+    with Image.open(io.BytesIO(output.getvalue())) as png:
+        assert png.format == "PNG"
+        assert png.size == (400, 200)
+
+
+def test_not_svg():
+    with pytest.raises(Image.UnidentifiedImageError):
+        Image.open(io.BytesIO(b"<html></html>"))
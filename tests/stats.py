@@ -0,0 +1,63 @@
+import gc
+
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="64" height="64">
+<rect id="box" width="32" height="32" fill="red"/>
+</svg>"""
+
+
+@pytest.fixture
+def stats():
+    pylunasvg.enable_stats()
+    pylunasvg.reset_stats()
+    yield
+    pylunasvg.enable_stats(False)
+
+
+def test_phases_are_timed(stats):
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.apply_style_sheet("rect { fill: blue; }")
+    document.update_layout()
+    bitmap = document.render_to_bitmap()
+    bitmap.write_to_png_data()
+    bitmap.convert(pylunasvg.PixelFormat.RGBA)
+
+    phases = pylunasvg.get_stats()["phases"]
+    for name in ("parse", "stylesheet", "layout", "rasterize", "convert", "png_encode"):
+        assert phases[name]["calls"] >= 1, name
+        assert phases[name]["seconds"] >= 0.0
+
+
+def test_bitmap_bytes(stats):
+    pylunasvg.Bitmap(10, 20)
+    result = pylunasvg.get_stats()
+    assert result["enabled"]
+    assert result["bitmaps_allocated"] == 1
+    assert result["bitmap_bytes"] == 10 * 20 * 4
+
+
+def test_disabled_collects_nothing():
+    pylunasvg.enable_stats(False)
+    pylunasvg.reset_stats()
+    pylunasvg.Document.load_from_data(SVG).render_to_bitmap()
+    result = pylunasvg.get_stats()
+    assert not result["enabled"]
+    assert result["phases"]["parse"]["calls"] == 0
+    assert result["bitmaps_allocated"] == 0
+
+
+def test_live_objects():
+    gc.collect()
+    before = pylunasvg.get_stats()
+    document = pylunasvg.Document.load_from_data(SVG)
+    bitmap = document.render_to_bitmap()
+    during = pylunasvg.get_stats()
+    assert during["live_documents"] == before["live_documents"] + 1
+    assert during["live_bitmaps"] == before["live_bitmaps"] + 1
+    del document, bitmap
+    gc.collect()
+    after = pylunasvg.get_stats()
+    assert after["live_documents"] == before["live_documents"]
+    assert after["live_bitmaps"] == before["live_bitmaps"]
@@ -0,0 +1,85 @@
+import threading
+
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="32" height="32">
+<rect id="box" class="a b" width="16" height="16"/>
+<circle cx="24" cy="24" r="8"/>
+</svg>"""
+
+CSS = """
+/* Boxes */
+rect.a.b { fill: #ff0000 ; }
+#box:hover , circle { fill : blue }
+ellipse, .missing { fill: green; }
+path {}
+@media screen { rect { stroke: black } }
+"""
+
+
+def render(document):
+    return document.render_to_bitmap().data
+
+
+def test_compile():
+    sheet = pylunasvg.StyleSheet.compile(CSS)
+    assert sheet.rule_count == 4
+    assert "/*" not in sheet.css
+    assert "rect.a.b{fill:#ff0000}" in sheet.css
+    assert repr(sheet) == "<StyleSheet rules=4>"
+    with pytest.raises(TypeError):
+        pylunasvg.StyleSheet.compile(b"rect{}")
+
+
+def test_apply_matches_text():
+    expected = pylunasvg.Document.load_from_data(SVG)
+    expected.apply_style_sheet(CSS)
+    document = pylunasvg.Document.load_from_data(SVG)
+    document.apply_style_sheet(pylunasvg.StyleSheet.compile(CSS))
+    assert render(document) == render(expected)
+    assert render(document) != render(pylunasvg.Document.load_from_data(SVG))
+
+
+@pytest.mark.parametrize("stylesheet", [CSS, pylunasvg.StyleSheet.compile(CSS)])
+def test_load_with_stylesheet(stylesheet):
+    expected = pylunasvg.Document.load_from_data(SVG)
+    expected.apply_style_sheet(CSS)
+    document = pylunasvg.Document.load_from_data(SVG, stylesheet=stylesheet, cloneable=True)
+    assert render(document) == render(expected)
+    assert render(document.clone()) == render(expected)
+
+
+def test_load_self_closing_root():
+    svg = b'<svg xmlns="http://www.w3.org/2000/svg" width="8" height="8"/>'
+    document = pylunasvg.Document.load_from_data(svg, stylesheet=pylunasvg.StyleSheet.compile("svg{opacity:0.5}"))
+    assert document.width == 8
+
+
+def test_load_from_file_with_stylesheet(tmp_path):
+    path = tmp_path / "image.svg"
+    path.write_bytes(SVG)
+    expected = pylunasvg.Document.load_from_data(SVG)
+    expected.apply_style_sheet(CSS)
+    document = pylunasvg.Document.load_from_file(str(path), stylesheet=pylunasvg.StyleSheet.compile(CSS))
+    assert render(document) == render(expected)
+
+
+def test_shared_between_threads():
+    sheet = pylunasvg.StyleSheet.compile(CSS)
+    expected = pylunasvg.Document.load_from_data(SVG, stylesheet=sheet)
+    results = []
+
+    def work():
+        for _ in range(10):
+            document = pylunasvg.Document.load_from_data(SVG)
+            document.apply_style_sheet(sheet)
+            results.append(render(document))
+
+    threads = [threading.Thread(target=work) for _ in range(4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert len(results) == 40
+    assert all(result == render(expected) for result in results)
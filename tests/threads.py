@@ -0,0 +1,125 @@
+import struct
+from concurrent.futures import ThreadPoolExecutor
+from pathlib import Path
+
+import pylunasvg
+import pytest
+
+TIGER = Path(__file__).resolve().parent.parent / "examples" / "tiger.svg"
+SIZE = 384
+
+
+def render(data):
+    document = pylunasvg.Document.load_from_data(data)
+    return document.render_to_bitmap(SIZE, SIZE).write_to_png_data()
+
+
+def test_separate_documents():
+    data = TIGER.read_bytes()
+    expected = render(data)
+    with ThreadPoolExecutor(max_workers=8) as executor:
+        results = list(executor.map(render, [data] * 32))
+    assert all(result == expected for result in results)
+
+
+def test_shared_document():
+    document = pylunasvg.Document.load_from_file(TIGER)
+    expected = document.render_to_bitmap(SIZE, SIZE).data
+
+    def worker(_):
+        document.document_element().get_attribute("width")
+        return document.render_to_bitmap(SIZE, SIZE).data
+
+    with ThreadPoolExecutor(max_workers=8) as executor:
+        results = list(executor.map(worker, range(32)))
+    assert all(result == expected for result in results)
+
+
+def test_shared_bitmap_reads():
+    bitmap = pylunasvg.Document.load_from_file(TIGER).render_to_bitmap(SIZE, SIZE)
+    with ThreadPoolExecutor(max_workers=8) as executor:
+        results = list(executor.map(lambda _: bitmap.write_to_png_data(), range(16)))
+    assert len(set(results)) == 1
+
+
+def test_font_registry_while_rendering():
+    data = TIGER.read_bytes()
+
+    def register(_):
+        with pytest.raises(RuntimeError):
+            pylunasvg.add_font_face_from_data("Broken", False, False, b"not a font")
+
+    with ThreadPoolExecutor(max_workers=8) as executor:
+        renders = [executor.submit(render, data) for _ in range(8)]
+        registrations = [executor.submit(register, i) for i in range(8)]
+        for future in renders + registrations:
+            future.result()
+
+
+def test_render_many():
+    data = TIGER.read_bytes()
+    sources = [data, data.decode(), TIGER, bytearray(data)]
+    expected = render(data)
+    results = pylunasvg.render_many(sources, SIZE, SIZE, png=True)
+    assert results == [expected] * len(sources)
+
+    bitmaps = pylunasvg.render_many(sources, SIZE, SIZE, threads=2)
+    assert [bitmap.write_to_png_data() for bitmap in bitmaps] == results
+
+    with pytest.raises(RuntimeError, match="index 1"):
+        pylunasvg.render_many([data, b"<not-svg"])
+
+
+def test_document_render_many():
+    document = pylunasvg.Document.load_from_file(TIGER)
+    sizes = [(16, 16), (64, 64), (SIZE, SIZE), (100, 50)]
+    bitmaps = document.render_many(sizes)
+    assert [(bitmap.width, bitmap.height) for bitmap in bitmaps] == sizes
+    expected = [document.render_to_bitmap(w, h).write_to_png_data() for w, h in sizes]
+    assert document.render_many(sizes, png=True) == expected
+
+
+def box_filter(bitmap):
+    data, width = bitmap.data, bitmap.width
+    stride = width * 4
+    result = bytearray()
+    for y in range(0, bitmap.height, 2):
+        for x in range(0, stride, 8):
+            for channel in range(4):
+                top = y * stride + x + channel
+                bottom = top + stride
+                total = data[top] + data[top + 4] + data[bottom] + data[bottom + 4]
+                result.append((total + 2) >> 2)
+    return bytes(result)
+
+
+def test_document_render_many_downsample():
+    document = pylunasvg.Document.load_from_file(TIGER)
+    sizes = [(16, 16), (32, 32), (64, 64), (48, 48), (32, 32)]
+    bitmaps = document.render_many(sizes, downsample=True)
+    assert [(bitmap.width, bitmap.height) for bitmap in bitmaps] == sizes
+    assert bitmaps[2].data == document.render_to_bitmap(64, 64).data
+    assert bitmaps[3].data == document.render_to_bitmap(48, 48).data
+    assert bitmaps[1].data == box_filter(bitmaps[2])
+    assert bitmaps[0].data == box_filter(bitmaps[1])
+    assert bitmaps[4].data == bitmaps[1].data
+    bitmaps[4].clear(0)
+    assert bitmaps[4].data != bitmaps[1].data
+
+
+def test_document_render_to_ico():
+    document = pylunasvg.Document.load_from_file(TIGER)
+    sizes = [(16, 16), (32, 32), (256, 256)]
+    ico = document.render_to_ico(sizes)
+    reserved, kind, count = struct.unpack_from("<HHH", ico)
+    assert (reserved, kind, count) == (0, 1, len(sizes))
+    expected = document.render_many(sizes, png=True, downsample=True)
+    for index, (width, height) in enumerate(sizes):
+        w, h, _, _, planes, bits, size, offset = struct.unpack_from("<BBBBHHII", ico, 6 + 16 * index)
+        assert (w or 256, h or 256, planes, bits) == (width, height, 1, 32)
+        assert ico[offset:offset + size] == expected[index]
+
+    with pytest.raises(ValueError):
+        document.render_to_ico([(512, 512)])
+    with pytest.raises(ValueError):
+        document.render_to_ico([])
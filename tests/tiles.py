@@ -0,0 +1,123 @@
+import random
+import struct
+import zlib
+
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="60">
+<circle cx="50" cy="30" r="25" fill="#3366cc" fill-opacity="0.75"/>
+<rect x="10" y="5" width="37" height="13" fill="#ff0000"/>
+</svg>"""
+
+
+def read_png(path):
+    with open(path, "rb") as file:
+        data = file.read()
+    assert data[:8] == b"\x89PNG\r\n\x1a\n"
+    offset, idat = 8, b""
+    while offset < len(data):
+        (length,) = struct.unpack(">I", data[offset : offset + 4])
+        kind = data[offset + 4 : offset + 8]
+        body = data[offset + 8 : offset + 8 + length]
+        (crc,) = struct.unpack(">I", data[offset + 8 + length : offset + 12 + length])
+        assert zlib.crc32(kind + body) == crc
+        if kind == b"IHDR":
+            width, height = struct.unpack(">II", body[:8])
+        elif kind == b"IDAT":
+            idat += body
+        offset += 12 + length
+
+    raw = zlib.decompress(idat)
+    stride = width * 4
+    previous = bytearray(stride)
+    pixels = bytearray()
+    for y in range(height):
+        kind = raw[y * (stride + 1)]
+        row = bytearray(raw[y * (stride + 1) + 1 : (y + 1) * (stride + 1)])
+        for i in range(stride):
+            a = row[i - 4] if i >= 4 else 0
+            b = previous[i]
+            c = previous[i - 4] if i >= 4 else 0
+            if kind == 1:
+                row[i] = (row[i] + a) & 255
+            elif kind == 2:
+                row[i] = (row[i] + b) & 255
+            elif kind == 3:
+                row[i] = (row[i] + ((a + b) >> 1)) & 255
+            elif kind == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                row[i] = (row[i] + (a if pa <= pb and pa <= pc else b if pb <= pc else c)) & 255
+        pixels += row
+        previous = row
+    return width, height, bytes(pixels)
+
+
+@pytest.mark.parametrize("threads,reuse", [(1, True), (4, True), (0, False)])
+def test_tiles_match_full_render(threads, reuse):
+    document = pylunasvg.Document.load_from_data(SVG)
+    expected = memoryview(document.render_to_bitmap(250, 150))
+    tiles = document.render_tiles(250, 150, tile_size=64, threads=threads, reuse=reuse)
+    assert (tiles.width, tiles.height) == (250, 150)
+    seen = 0
+    for x, y, tile in tiles:
+        assert tile.width == min(64, 250 - x) and tile.height == min(64, 150 - y)
+        assert memoryview(tile).tobytes() == expected[y : y + tile.height, x : x + tile.width].tobytes()
+        seen += 1
+    assert seen == 4 * 3
+
+
+def test_tiles_validation():
+    document = pylunasvg.Document.load_from_data(SVG)
+    with pytest.raises(ValueError):
+        document.render_tiles(tile_size=0)
+
+
+def test_write_to_png_streams_bands(tmp_path):
+    document = pylunasvg.Document.load_from_data(SVG)
+    path = tmp_path / "large.png"
+    document.write_to_png(str(path), 300, -1, background_color=0xFFFFFFFF, tile_size=32)
+    expected = document.render_to_bitmap(300, 180, 0xFFFFFFFF).convert(pylunasvg.PixelFormat.RGBA)
+    assert read_png(path) == (300, 180, bytes(expected))
+
+
+def stress_bitmap():
+    # Noise, an exact repeat of it within the 32 KiB deflate window, a flat
+    # run and a repeat from beyond the window: 80 KiB of rows, so stored
+    # blocks split and the match window slides.
+    width, height = 128, 160
+    generator = random.Random(1)
+    rows = [bytes(generator.randrange(256) if i % 4 != 3 else 255 for i in range(width * 4)) for _ in range(40)]
+    rows += rows[:40]
+    rows += [bytes([12, 34, 56, 255]) * width] * 20
+    rows += rows[:60]
+    bitmap = pylunasvg.Bitmap(width, height)
+    assert bitmap.stride == width * 4
+    memoryview(bitmap).cast("B")[:] = b"".join(rows)
+    return bitmap
+
+
+@pytest.mark.parametrize("level", range(10))
+@pytest.mark.parametrize("filter", list(pylunasvg.PngFilter.__members__.values()))
+def test_png_options(tmp_path, level, filter):
+    for bitmap in (pylunasvg.Document.load_from_data(SVG).render_to_bitmap(120, 72), stress_bitmap()):
+        expected = (bitmap.width, bitmap.height, bytes(bitmap.convert(pylunasvg.PixelFormat.RGBA)))
+        path = tmp_path / "image.png"
+        path.write_bytes(bitmap.write_to_png_data(level=level, filter=filter))
+        assert read_png(path) == expected
+
+
+def test_png_targets(tmp_path):
+    import io
+
+    bitmap = pylunasvg.Document.load_from_data(SVG).render_to_bitmap()
+    data = bitmap.write_to_png_data()
+    stream = io.BytesIO()
+    bitmap.write_to_png(stream)
+    assert stream.getvalue() == data
+    buffer = bytearray(b"head")
+    bitmap.write_to_png(buffer)
+    assert buffer == b"head" + data
+    bitmap.write_to_png(tmp_path / "image.png")
+    assert (tmp_path / "image.png").read_bytes() == data
@@ -0,0 +1,63 @@
+import pylunasvg
+import pytest
+
+SVG = b"""<svg xmlns="http://www.w3.org/2000/svg" width="100" height="100">
+<g id="group">
+<rect id="first" width="10" height="10"/>
+<text id="label" x="5" y="5">label</text>
+<a id="link" href="#first"><circle id="dot" r="2"/></a>
+</g>
+<rect id="last" width="5" height="5"/>
+</svg>"""
+
+
+def ids(elements):
+    return [element.get_attribute("id") for element in elements]
+
+
+def test_children_and_siblings():
+    document = pylunasvg.Document.load_from_data(SVG)
+    root = document.document_element()
+    assert root.tag_name == "svg"
+    assert ids(root.children()) == ["group", "last"]
+
+    group = root.first_child()
+    assert group.tag_name == "g"
+    assert ids(group.children()) == ["first", "label", "link"]
+    assert group.next_sibling().get_attribute("id") == "last"
+    assert group.next_sibling().next_sibling() is None
+
+    first = group.first_child()
+    assert first.get_attribute("id") == "first"
+    assert first.first_child() is None
+    assert first.next_sibling().tag_name == "text"
+
+
+def test_query_selector_all():
+    document = pylunasvg.Document.load_from_data(SVG)
+    assert ids(document.query_selector_all("rect")) == ["first", "last"]
+    assert ids(document.query_selector_all("g > rect")) == ["first"]
+    assert ids(document.query_selector_all("text, a")) == ["label", "link"]
+    assert document.query_selector_all("ellipse") == []
+
+
+def test_elements_by_tag():
+    document = pylunasvg.Document.load_from_data(SVG)
+    links = document.elements_by_tag("a")
+    assert ids(links) == ["link"]
+    assert [element.tag_name for element in links[0].children()] == ["circle"]
+    with pytest.raises(ValueError):
+        document.elements_by_tag("g > rect")
+
+
+def test_elements_keep_document_alive():
+    elements = pylunasvg.Document.load_from_data(SVG).elements_by_tag("rect")
+    assert elements[0].owner_document() is not None
+    assert ids(elements) == ["first", "last"]
+
+
+def test_element_owner_document_is_the_document():
+    document = pylunasvg.Document.load_from_data(SVG)
+    element = document.query_selector_all("rect")[0]
+    assert element.owner_document() is document
+    assert element.parent_element().owner_document() is document